@@ -0,0 +1,628 @@
+/* Broadphase (dynamic AABB tree)
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define USE_SSE
+#include <xmmintrin.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "object.h"
+#include "rigidbody.h"
+#include "physic.h"
+#include "collide.h"
+#include "broadphase.h"
+
+float Broadphase::margin = 0.2f;
+
+Mutex Broadphase::mutex;
+
+int Broadphase::root = -1;
+int Broadphase::num_objects = 0;
+
+int Broadphase::num_nodes = 0;
+int Broadphase::all_nodes = 0;
+Broadphase::Node *Broadphase::nodes = NULL;
+int Broadphase::free_node = -1;
+
+int Broadphase::num_sector_pairs = 0;
+int Broadphase::num_pairs = 0;
+
+/*
+ */
+static inline void merge(const vec3 &min0,const vec3 &max0,const vec3 &min1,const vec3 &max1,vec3 &min,vec3 &max) {
+	min.x = min0.x < min1.x ? min0.x : min1.x;
+	min.y = min0.y < min1.y ? min0.y : min1.y;
+	min.z = min0.z < min1.z ? min0.z : min1.z;
+	max.x = max0.x > max1.x ? max0.x : max1.x;
+	max.y = max0.y > max1.y ? max0.y : max1.y;
+	max.z = max0.z > max1.z ? max0.z : max1.z;
+}
+
+static inline float area(const vec3 &min,const vec3 &max) {
+	vec3 size = max - min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static inline int overlap(const vec3 &min0,const vec3 &max0,const vec3 &min1,const vec3 &max1) {
+	if(min0.x > max1.x || max0.x < min1.x) return 0;
+	if(min0.y > max1.y || max0.y < min1.y) return 0;
+	if(min0.z > max1.z || max0.z < min1.z) return 0;
+	return 1;
+}
+
+static inline int segment(const vec3 &min,const vec3 &max,const vec3 &line0,const vec3 &dir,float &fraction) {
+	float t0 = 0.0f;
+	float t1 = 1.0f;
+	for(int i = 0; i < 3; i++) {
+		if(fabs(dir[i]) < EPSILON) {
+			if(line0[i] < min[i] || line0[i] > max[i]) return 0;
+			continue;
+		}
+		float idir = 1.0f / dir[i];
+		float d0 = (min[i] - line0[i]) * idir;
+		float d1 = (max[i] - line0[i]) * idir;
+		if(d0 > d1) {
+			float d = d0;
+			d0 = d1;
+			d1 = d;
+		}
+		if(t0 < d0) t0 = d0;
+		if(t1 > d1) t1 = d1;
+		if(t0 > t1) return 0;
+	}
+	fraction = t0;
+	return 1;
+}
+
+static inline int contains(const vec3 &min0,const vec3 &max0,const vec3 &min1,const vec3 &max1) {
+	if(min1.x < min0.x || max1.x > max0.x) return 0;
+	if(min1.y < min0.y || max1.y > max0.y) return 0;
+	if(min1.z < min0.z || max1.z > max0.z) return 0;
+	return 1;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* objects                                                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+/* world bound box of the object
+ */
+void Broadphase::getBounds(Object *object,vec3 &min,vec3 &max) {
+	if(object->is_identity) {
+		min = object->getMin();
+		max = object->getMax();
+	} else if(object->rigidbody && Physic::threaded) {
+		// the object is drawn between the last two steps of the physic thread
+		RigidBody *rb = object->rigidbody;
+		vec3 center = rb->transform * object->getCenter();
+		vec3 old_center = rb->old_orienation * object->getCenter() + rb->old_pos;
+		float radius = object->getRadius();
+		merge(center,center,old_center,old_center,min,max);
+		min -= vec3(radius,radius,radius);
+		max += vec3(radius,radius,radius);
+	} else {
+		const mat4 &transform = object->rigidbody ? object->rigidbody->transform : object->transform;
+		vec3 center = transform * object->getCenter();
+		float radius = object->getRadius();
+		min = center - vec3(radius,radius,radius);
+		max = center + vec3(radius,radius,radius);
+	}
+}
+
+/*
+ */
+void Broadphase::addObject(Object *object) {
+	mutex.lock();
+	if(object->proxy == -1) add(object);
+	else update(object);
+	mutex.unlock();
+}
+
+void Broadphase::removeObject(Object *object) {
+	mutex.lock();
+	if(object->proxy != -1) remove(object);
+	mutex.unlock();
+}
+
+void Broadphase::updateObject(Object *object) {
+	mutex.lock();
+	if(object->proxy == -1) add(object);
+	else update(object);
+	mutex.unlock();
+}
+
+/*
+ */
+void Broadphase::add(Object *object) {
+	int leaf = allocNode();
+	Node *n = &nodes[leaf];
+	getBounds(object,n->min,n->max);
+	n->min -= vec3(margin,margin,margin);
+	n->max += vec3(margin,margin,margin);
+	n->object = object;
+	n->height = 0;
+	insertLeaf(leaf);
+	object->proxy = leaf;
+	num_objects++;
+}
+
+void Broadphase::remove(Object *object) {
+	removeLeaf(object->proxy);
+	freeNode(object->proxy);
+	object->proxy = -1;
+	num_objects--;
+}
+
+void Broadphase::update(Object *object) {
+	int leaf = object->proxy;
+	vec3 min,max;
+	getBounds(object,min,max);
+	if(contains(nodes[leaf].min,nodes[leaf].max,min,max)) return;
+	removeLeaf(leaf);
+	nodes[leaf].min = min - vec3(margin,margin,margin);
+	nodes[leaf].max = max + vec3(margin,margin,margin);
+	insertLeaf(leaf);
+}
+
+/*
+ */
+int Broadphase::getNumObjects() {
+	return num_objects;
+}
+
+void Broadphase::addCounters(int sector_pairs,int pairs) {
+	mutex.lock();
+	num_sector_pairs += sector_pairs;
+	num_pairs += pairs;
+	mutex.unlock();
+}
+
+void Broadphase::resetCounters() {
+	num_sector_pairs = 0;
+	num_pairs = 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* query                                                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+int Broadphase::query(const vec3 &min,const vec3 &max,Object **objects,int num) {
+	mutex.lock();
+	int ret = 0;
+	int depth = 0;
+	int stack[NUM_STACK];
+	if(root != -1) stack[depth++] = root;
+	while(depth > 0) {
+		Node *n = &nodes[stack[--depth]];
+		if(overlap(n->min,n->max,min,max) == 0) continue;
+		if(n->height == 0) {
+			if(ret < num) objects[ret] = n->object;
+			ret++;
+		} else {
+			if(depth + 2 > NUM_STACK) {
+				fprintf(stderr,"Broadphase::query(): stack overflow\n");
+				continue;
+			}
+			stack[depth++] = n->right;
+			stack[depth++] = n->left;
+		}
+	}
+	mutex.unlock();
+	return ret;
+}
+
+/* boxes are tested only under the nodes which they overlap
+ */
+int Broadphase::query(const vec3 *min,const vec3 *max,int num_boxes,Object **objects,int *masks,int num) {
+	mutex.lock();
+	int ret = 0;
+	int depth = 0;
+	int stack[NUM_STACK];
+	int stack_masks[NUM_STACK];
+	if(root != -1) {
+		stack[depth] = root;
+		stack_masks[depth++] = num_boxes < 32 ? (1 << num_boxes) - 1 : ~0;
+	}
+	while(depth > 0) {
+		depth--;
+		Node *n = &nodes[stack[depth]];
+		int parent_mask = stack_masks[depth];
+		int mask = 0;
+		for(int i = 0; i < num_boxes; i++) {
+			if((parent_mask & (1 << i)) && overlap(n->min,n->max,min[i],max[i])) mask |= 1 << i;
+		}
+		if(mask == 0) continue;
+		if(n->height == 0) {
+			if(ret < num) {
+				objects[ret] = n->object;
+				masks[ret] = mask;
+			}
+			ret++;
+		} else {
+			if(depth + 2 > NUM_STACK) {
+				fprintf(stderr,"Broadphase::query(): stack overflow\n");
+				continue;
+			}
+			stack[depth] = n->right;
+			stack_masks[depth++] = mask;
+			stack[depth] = n->left;
+			stack_masks[depth++] = mask;
+		}
+	}
+	mutex.unlock();
+	return ret;
+}
+
+/*
+ */
+int Broadphase::intersection(const vec3 &line0,const vec3 &line1,Object **objects,float *fractions,int num) {
+	mutex.lock();
+	vec3 dir = line1 - line0;
+	int ret = 0;
+	int depth = 0;
+	int stack[NUM_STACK];
+	if(root != -1) stack[depth++] = root;
+	while(depth > 0) {
+		Node *n = &nodes[stack[--depth]];
+		float fraction;
+		if(segment(n->min,n->max,line0,dir,fraction) == 0) continue;
+		if(n->height == 0) {
+			if(ret < num) {
+				objects[ret] = n->object;
+				fractions[ret] = fraction;
+			}
+			ret++;
+		} else {
+			if(depth + 2 > NUM_STACK) {
+				fprintf(stderr,"Broadphase::intersection(): stack overflow\n");
+				continue;
+			}
+			stack[depth++] = n->right;
+			stack[depth++] = n->left;
+		}
+	}
+	mutex.unlock();
+	return ret;
+}
+
+/* mask of the packet segments crossing the box
+ */
+int Broadphase::packetMask(const Packet &packet,const vec3 &min,const vec3 &max,float *fractions) {
+#ifdef USE_SSE
+	if(Collide::simd) {
+		__m128 t0 = _mm_setzero_ps();
+		__m128 t1 = _mm_set1_ps(1.0f);
+		for(int i = 0; i < 3; i++) {
+			__m128 line0 = _mm_loadu_ps(packet.line0[i]);
+			__m128 idir = _mm_loadu_ps(packet.idir[i]);
+			__m128 d0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min[i]),line0),idir);
+			__m128 d1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max[i]),line0),idir);
+			t0 = _mm_max_ps(t0,_mm_min_ps(d0,d1));
+			t1 = _mm_min_ps(t1,_mm_max_ps(d0,d1));
+		}
+		_mm_storeu_ps(fractions,t0);
+		return _mm_movemask_ps(_mm_cmple_ps(t0,t1));
+	}
+#endif
+	int mask = 0;
+	for(int i = 0; i < NUM_PACKET; i++) {
+		float t0 = 0.0f;
+		float t1 = 1.0f;
+		for(int j = 0; j < 3; j++) {
+			float d0 = (min[j] - packet.line0[j][i]) * packet.idir[j][i];
+			float d1 = (max[j] - packet.line0[j][i]) * packet.idir[j][i];
+			if(d0 > d1) {
+				float d = d0;
+				d0 = d1;
+				d1 = d;
+			}
+			if(t0 < d0) t0 = d0;
+			if(t1 > d1) t1 = d1;
+		}
+		fractions[i] = t0;
+		if(t0 <= t1) mask |= 1 << i;
+	}
+	return mask;
+}
+
+/* segments of the packet are traversed together, the node is skipped when all of them miss it
+ */
+int Broadphase::intersection(const vec3 *line0,const vec3 *line1,int mask,Object **objects,int *masks,float *fractions,int num) {
+	Packet packet;
+	for(int i = 0; i < NUM_PACKET; i++) {
+		int j = (mask & (1 << i)) ? i : 0;
+		vec3 dir = line1[j] - line0[j];
+		for(int k = 0; k < 3; k++) {
+			// parallel segments are moved a little along the axis
+			float d = dir[k];
+			if(fabs(d) < EPSILON) d = d < 0.0f ? -EPSILON : EPSILON;
+			packet.line0[k][i] = line0[j][k];
+			packet.idir[k][i] = 1.0f / d;
+		}
+	}
+	mutex.lock();
+	int ret = 0;
+	int depth = 0;
+	int stack[NUM_STACK];
+	if(root != -1) stack[depth++] = root;
+	while(depth > 0) {
+		Node *n = &nodes[stack[--depth]];
+		float f[NUM_PACKET];
+		int m = packetMask(packet,n->min,n->max,f) & mask;
+		if(m == 0) continue;
+		if(n->height == 0) {
+			if(ret < num) {
+				objects[ret] = n->object;
+				masks[ret] = m;
+				memcpy(fractions + ret * NUM_PACKET,f,sizeof(float) * NUM_PACKET);
+			}
+			ret++;
+		} else {
+			if(depth + 2 > NUM_STACK) {
+				fprintf(stderr,"Broadphase::intersection(): stack overflow\n");
+				continue;
+			}
+			stack[depth++] = n->right;
+			stack[depth++] = n->left;
+		}
+	}
+	mutex.unlock();
+	return ret;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* tree                                                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+int Broadphase::allocNode() {
+	if(free_node == -1) {
+		int all = all_nodes ? all_nodes * 2 : 64;
+		Node *n = new Node[all];
+		for(int i = 0; i < num_nodes; i++) n[i] = nodes[i];
+		delete [] nodes;
+		nodes = n;
+		for(int i = num_nodes; i < all; i++) {
+			nodes[i].parent = i + 1;
+			nodes[i].height = -1;
+			nodes[i].object = NULL;
+		}
+		nodes[all - 1].parent = -1;
+		free_node = num_nodes;
+		all_nodes = all;
+		num_nodes = all;
+	}
+	int node = free_node;
+	free_node = nodes[node].parent;
+	nodes[node].parent = -1;
+	nodes[node].left = -1;
+	nodes[node].right = -1;
+	nodes[node].height = 0;
+	nodes[node].object = NULL;
+	return node;
+}
+
+void Broadphase::freeNode(int node) {
+	nodes[node].parent = free_node;
+	nodes[node].height = -1;
+	nodes[node].object = NULL;
+	free_node = node;
+}
+
+/* the sibling is found by the surface area heuristic
+ */
+void Broadphase::insertLeaf(int leaf) {
+	
+	if(root == -1) {
+		root = leaf;
+		nodes[root].parent = -1;
+		return;
+	}
+	
+	vec3 min = nodes[leaf].min;
+	vec3 max = nodes[leaf].max;
+	
+	int sibling = root;
+	while(nodes[sibling].height > 0) {
+		Node *n = &nodes[sibling];
+		vec3 cmin,cmax;
+		
+		float a = area(n->min,n->max);
+		merge(n->min,n->max,min,max,cmin,cmax);
+		float combined = area(cmin,cmax);
+		
+		float cost = 2.0f * combined;
+		float inheritance = 2.0f * (combined - a);
+		
+		float cost_left,cost_right;
+		Node *l = &nodes[n->left];
+		merge(l->min,l->max,min,max,cmin,cmax);
+		if(l->height == 0) cost_left = area(cmin,cmax) + inheritance;
+		else cost_left = area(cmin,cmax) - area(l->min,l->max) + inheritance;
+		
+		Node *r = &nodes[n->right];
+		merge(r->min,r->max,min,max,cmin,cmax);
+		if(r->height == 0) cost_right = area(cmin,cmax) + inheritance;
+		else cost_right = area(cmin,cmax) - area(r->min,r->max) + inheritance;
+		
+		if(cost < cost_left && cost < cost_right) break;
+		
+		sibling = cost_left < cost_right ? n->left : n->right;
+	}
+	
+	int old_parent = nodes[sibling].parent;
+	int parent = allocNode();
+	Node *p = &nodes[parent];
+	p->parent = old_parent;
+	merge(nodes[sibling].min,nodes[sibling].max,min,max,p->min,p->max);
+	p->height = nodes[sibling].height + 1;
+	p->left = sibling;
+	p->right = leaf;
+	nodes[sibling].parent = parent;
+	nodes[leaf].parent = parent;
+	
+	if(old_parent != -1) {
+		if(nodes[old_parent].left == sibling) nodes[old_parent].left = parent;
+		else nodes[old_parent].right = parent;
+	} else {
+		root = parent;
+	}
+	
+	fixUpwards(parent);
+}
+
+/*
+ */
+void Broadphase::removeLeaf(int leaf) {
+	
+	if(leaf == root) {
+		root = -1;
+		return;
+	}
+	
+	int parent = nodes[leaf].parent;
+	int grand_parent = nodes[parent].parent;
+	int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	
+	if(grand_parent != -1) {
+		if(nodes[grand_parent].left == parent) nodes[grand_parent].left = sibling;
+		else nodes[grand_parent].right = sibling;
+		nodes[sibling].parent = grand_parent;
+		freeNode(parent);
+		fixUpwards(grand_parent);
+	} else {
+		root = sibling;
+		nodes[sibling].parent = -1;
+		freeNode(parent);
+	}
+	nodes[leaf].parent = -1;
+}
+
+/*
+ */
+void Broadphase::fixUpwards(int node) {
+	while(node != -1) {
+		node = balance(node);
+		Node *n = &nodes[node];
+		Node *l = &nodes[n->left];
+		Node *r = &nodes[n->right];
+		n->height = 1 + (l->height > r->height ? l->height : r->height);
+		merge(l->min,l->max,r->min,r->max,n->min,n->max);
+		node = n->parent;
+	}
+}
+
+/* rotate the node if its subtrees differ in height by more than one
+ */
+int Broadphase::balance(int a) {
+	
+	Node *A = &nodes[a];
+	if(A->height < 2) return a;
+	
+	int b = A->left;
+	int c = A->right;
+	Node *B = &nodes[b];
+	Node *C = &nodes[c];
+	
+	int diff = C->height - B->height;
+	
+	// rotate c up
+	if(diff > 1) {
+		int f = C->left;
+		int g = C->right;
+		Node *F = &nodes[f];
+		Node *G = &nodes[g];
+		
+		C->left = a;
+		C->parent = A->parent;
+		A->parent = c;
+		
+		if(C->parent != -1) {
+			if(nodes[C->parent].left == a) nodes[C->parent].left = c;
+			else nodes[C->parent].right = c;
+		} else {
+			root = c;
+		}
+		
+		if(F->height > G->height) {
+			C->right = f;
+			A->right = g;
+			G->parent = a;
+			merge(B->min,B->max,G->min,G->max,A->min,A->max);
+			merge(A->min,A->max,F->min,F->max,C->min,C->max);
+			A->height = 1 + (B->height > G->height ? B->height : G->height);
+			C->height = 1 + (A->height > F->height ? A->height : F->height);
+		} else {
+			C->right = g;
+			A->right = f;
+			F->parent = a;
+			merge(B->min,B->max,F->min,F->max,A->min,A->max);
+			merge(A->min,A->max,G->min,G->max,C->min,C->max);
+			A->height = 1 + (B->height > F->height ? B->height : F->height);
+			C->height = 1 + (A->height > G->height ? A->height : G->height);
+		}
+		return c;
+	}
+	
+	// rotate b up
+	if(diff < -1) {
+		int d = B->left;
+		int e = B->right;
+		Node *D = &nodes[d];
+		Node *E = &nodes[e];
+		
+		B->left = a;
+		B->parent = A->parent;
+		A->parent = b;
+		
+		if(B->parent != -1) {
+			if(nodes[B->parent].left == a) nodes[B->parent].left = b;
+			else nodes[B->parent].right = b;
+		} else {
+			root = b;
+		}
+		
+		if(D->height > E->height) {
+			B->right = d;
+			A->left = e;
+			E->parent = a;
+			merge(C->min,C->max,E->min,E->max,A->min,A->max);
+			merge(A->min,A->max,D->min,D->max,B->min,B->max);
+			A->height = 1 + (C->height > E->height ? C->height : E->height);
+			B->height = 1 + (A->height > D->height ? A->height : D->height);
+		} else {
+			B->right = e;
+			A->left = d;
+			D->parent = a;
+			merge(C->min,C->max,D->min,D->max,A->min,A->max);
+			merge(A->min,A->max,E->min,E->max,B->min,B->max);
+			A->height = 1 + (C->height > D->height ? C->height : D->height);
+			B->height = 1 + (A->height > E->height ? A->height : E->height);
+		}
+		return b;
+	}
+	
+	return a;
+}
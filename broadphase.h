@@ -0,0 +1,117 @@
+/* Broadphase (dynamic AABB tree)
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __BROADPHASE_H__
+#define __BROADPHASE_H__
+
+#include "mathlib.h"
+#include "thread.h"
+
+class Object;
+
+/* all objects placed in the sectors are kept in one tree of fat bound boxes
+ * the tree is changed only when the object leaves its fat box
+ * it is shared by the physic thread and the main thread under the mutex
+ */
+class Broadphase {
+public:
+	
+	static void addObject(Object *object);
+	static void removeObject(Object *object);
+	static void updateObject(Object *object);
+	
+	// returns the number of found objects, only num of them are written
+	static int query(const vec3 &min,const vec3 &max,Object **objects,int num);
+	
+	// boxes of the queries at once, the masks of the overlapped boxes are given for the objects
+	enum {
+		NUM_BOXES = 32,
+	};
+	static int query(const vec3 *min,const vec3 *max,int num_boxes,Object **objects,int *masks,int num);
+	
+	// objects with the boxes crossed by the segment and the fractions of the segment where the boxes are entered
+	static int intersection(const vec3 &line0,const vec3 &line1,Object **objects,float *fractions,int num);
+	
+	// packet of segments at once, the masks of the segments are given for the objects
+	// fractions are written by NUM_PACKET for each object
+	enum {
+		NUM_PACKET = 4,
+	};
+	static int intersection(const vec3 *line0,const vec3 *line1,int mask,Object **objects,int *masks,float *fractions,int num);
+	
+	static void getBounds(Object *object,vec3 &min,vec3 &max);
+	
+	static int getNumObjects();
+	
+	// pairs counters
+	static void addCounters(int sector_pairs,int pairs);
+	static void resetCounters();
+	
+	static int num_sector_pairs;	// pairs the sector scan would test
+	static int num_pairs;			// pairs given to the narrowphase
+
+protected:
+	
+	enum {
+		NUM_STACK = 256,
+	};
+	
+	struct Node {
+		vec3 min;
+		vec3 max;
+		Object *object;
+		int parent;
+		int left;
+		int right;
+		int height;
+	};
+	
+	struct Packet {
+		float line0[3][NUM_PACKET];
+		float idir[3][NUM_PACKET];
+	};
+	
+	static int packetMask(const Packet &packet,const vec3 &min,const vec3 &max,float *fractions);
+	
+	static void add(Object *object);
+	static void remove(Object *object);
+	static void update(Object *object);
+	
+	static int allocNode();
+	static void freeNode(int node);
+	
+	static void insertLeaf(int leaf);
+	static void removeLeaf(int leaf);
+	static int balance(int node);
+	static void fixUpwards(int node);
+	
+	static float margin;
+	
+	static Mutex mutex;
+	
+	static int root;
+	static int num_objects;
+	
+	static int num_nodes;
+	static int all_nodes;
+	static Node *nodes;
+	static int free_node;
+};
+
+#endif /* __BROADPHASE_H__ */
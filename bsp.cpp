@@ -25,6 +25,8 @@
 #include "meshvbo.h"
 #include "object.h"
 #include "objectmesh.h"
+#include "broadphase.h"
+#include "occlusion.h"
 #include "bsp.h"
 
 /*****************************************************************************/
@@ -157,14 +159,14 @@ void Node::create(Mesh *mesh) {
 		} else {
 			mesh->create_shadow_volumes();
 			mesh->create_triangle_strips();
-			object = new ObjectMesh(new MeshVBO(mesh));
+			object = new ObjectMesh(Engine::headless ? new Mesh(mesh) : new MeshVBO(mesh));
 			delete right_mesh;
 			delete left_mesh;
 		}
 	} else {
 		mesh->create_shadow_volumes();
 		mesh->create_triangle_strips();
-		object = new ObjectMesh(new MeshVBO(mesh));
+		object = new ObjectMesh(Engine::headless ? new Mesh(mesh) : new MeshVBO(mesh));
 	}
 	delete mesh;
 }
@@ -191,7 +193,7 @@ void Node::load(FILE *file) {
 		max = mesh->getMax();
 		center = mesh->getCenter();
 		radius = mesh->getRadius();
-		object = new ObjectMesh(new MeshVBO(mesh));
+		object = new ObjectMesh(Engine::headless ? new Mesh(mesh) : new MeshVBO(mesh));
 		delete mesh;
 	}
 }
@@ -223,27 +225,39 @@ void Node::bindMaterial(const char *name,Material *material) {
 
 /*
  */
-void Node::render() {
+void Node::render(Sector *sector,int mask) {
 	if(left && right) {
-		int check_left = Engine::frustum->inside(left->center,left->radius);
-		int check_right = Engine::frustum->inside(right->center,right->radius);
+		// childrens skip the planes which the parent is fully inside
+		int left_mask = mask;
+		int right_mask = mask;
+		int check_left = 1;
+		int check_right = 1;
+		if(mask || Engine::frustum->getNumPlanes() > 32) {
+			check_left = Engine::frustum->inside(left->min,left->max,left_mask);
+			check_right = Engine::frustum->inside(right->min,right->max,right_mask);
+		} else {
+			// the whole subtree is inside
+			Frustum::num_saved_tests += Engine::frustum->getNumPlanes() * 2;
+			Frustum::num_inside += 2;
+		}
+		if(check_left) check_left = Engine::occlusion->inside(left->min,left->max);
+		if(check_right) check_right = Engine::occlusion->inside(right->min,right->max);
 		if(check_left && check_right) {
 			if((left->center - Engine::camera).length() < (right->center - Engine::camera).length()) {
-				left->render();
-				right->render();
+				left->render(sector,left_mask);
+				right->render(sector,right_mask);
 			} else {
-				right->render();
-				left->render();
+				right->render(sector,right_mask);
+				left->render(sector,left_mask);
 			}
 			return;
 		}
-		if(check_left) left->render();
-		else if(check_right) right->render();
+		if(check_left) left->render(sector,left_mask);
+		else if(check_right) right->render(sector,right_mask);
 		return;
 	}
 	if(object && object->frame != Engine::frame) {
-		Sector *s = Bsp::visible_sectors[Bsp::num_visible_sectors - 1];
-		s->visible_objects[s->num_visible_objects++] = object;
+		sector->visible_objects[sector->num_visible_objects++] = object;
 		Engine::num_triangles += object->render(Object::RENDER_OPACITY);
 	}
 }
@@ -254,7 +268,7 @@ void Node::render() {
 /*                                                                           */
 /*****************************************************************************/
 
-Portal::Portal() : center(0,0,0), radius(1000000.0), num_sectors(0), sectors(NULL), frame(0) {
+Portal::Portal() : center(0,0,0), radius(1000000.0), num_sectors(0), sectors(NULL) {
 	
 }
 
@@ -357,8 +371,8 @@ void Portal::render() {
 /*****************************************************************************/
 
 Sector::Sector() : center(0,0,0), radius(1000000.0), num_planes(0), planes(NULL), root(NULL),
-	num_portals(0), portals(NULL), num_objects(0), objects(NULL), num_node_objects(0), node_objects(NULL),
-	num_visible_objects(0), visible_objects(NULL), portal(NULL), frame(0),
+	num_portals(0), portals(NULL), num_objects(0), all_objects(0), objects(NULL), num_node_objects(0), node_objects(NULL),
+	num_occluder_vertex(0), occluder_vertex(NULL), num_occluders(0), occluders(NULL), num_visible_objects(0), visible_objects(NULL), portal(NULL), frame(0), path(0),
 	old_num_visible_objects(0), old_visible_objects(NULL), old_portal(NULL), old_frame(0) {
 	
 }
@@ -369,6 +383,8 @@ Sector::~Sector() {
 	if(root) delete root;
 	if(objects) delete objects;
 	if(node_objects) delete node_objects;
+	if(occluder_vertex) delete [] occluder_vertex;
+	if(occluders) delete [] occluders;
 	if(visible_objects) delete visible_objects;
 	if(old_visible_objects) delete old_visible_objects;
 }
@@ -402,21 +418,69 @@ void Sector::getNodeObjects(Node *node) {
 	}
 }
 
+/* big triangles of the tree for the software occlusion
+ */
+void Sector::getOccluders(Node *node) {
+	if(node->left && node->right) {
+		getOccluders(node->left);
+		getOccluders(node->right);
+	}
+	if(node->object) {
+		Mesh *mesh = node->object->mesh;
+		for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+			int num_triangles = mesh->getNumTriangles(i);
+			Mesh::Triangle *t = mesh->getTriangles(i);
+			int first_vertex = num_occluder_vertex;
+			for(int j = 0; j < num_triangles; j++) {
+				const vec3 *v = t[j].v;
+				if(cross(v[1] - v[0],v[2] - v[0]).length() * 0.5f < Occlusion::min_area) continue;
+				if(occluder_vertex) {
+					occluder_vertex[num_occluder_vertex + 0] = v[0];
+					occluder_vertex[num_occluder_vertex + 1] = v[1];
+					occluder_vertex[num_occluder_vertex + 2] = v[2];
+				}
+				num_occluder_vertex += 3;
+			}
+			if(first_vertex == num_occluder_vertex) continue;
+			if(occluders) {
+				Occluder *o = &occluders[num_occluders];
+				o->object = node->object;
+				o->surface = i;
+				o->num_vertex = num_occluder_vertex - first_vertex;
+				o->vertex = occluder_vertex + first_vertex;
+			}
+			num_occluders++;
+		}
+	}
+}
+
 /*
  */
 void Sector::create() {
 	
-	objects = new Object*[NUM_OBJECTS];
+	all_objects = NUM_OBJECTS;
+	objects = new Object*[all_objects];
 	
 	num_node_objects = 0;
 	getNodeObjects(root);
 	
 	node_objects = new Object*[num_node_objects];
-	visible_objects = new Object*[num_node_objects + NUM_OBJECTS];
-	old_visible_objects = new Object*[num_node_objects + NUM_OBJECTS];
+	visible_objects = new Object*[num_node_objects + all_objects];
+	old_visible_objects = new Object*[num_node_objects + all_objects];
 	
 	num_node_objects = 0;
 	getNodeObjects(root);
+	
+	num_occluder_vertex = 0;
+	num_occluders = 0;
+	getOccluders(root);
+	occluder_vertex = new vec3[num_occluder_vertex];
+	occluders = new Occluder[num_occluders];
+	num_occluder_vertex = 0;
+	num_occluders = 0;
+	getOccluders(root);
+	
+	for(int i = 0; i < num_node_objects; i++) Broadphase::addObject(node_objects[i]);
 }
 
 /*
@@ -457,6 +521,22 @@ void Sector::addObject(Object *object) {
 	if(!objects) return;
 	int i = 0;
 	for(; i < num_objects; i++) if(objects[i] == object) return;
+	if(num_objects == all_objects) {
+		all_objects *= 2;
+		Object **o = new Object*[all_objects];
+		memcpy(o,objects,sizeof(Object*) * num_objects);
+		delete objects;
+		objects = o;
+		// all dynamic objects can be visible
+		o = new Object*[num_node_objects + all_objects];
+		memcpy(o,visible_objects,sizeof(Object*) * num_visible_objects);
+		delete visible_objects;
+		visible_objects = o;
+		o = new Object*[num_node_objects + all_objects];
+		memcpy(o,old_visible_objects,sizeof(Object*) * old_num_visible_objects);
+		delete old_visible_objects;
+		old_visible_objects = o;
+	}
 	objects[num_objects++] = object;
 }
 
@@ -480,34 +560,100 @@ void Sector::bindMaterial(const char *name,Material *material) {
 
 /*
  */
+static inline int pvs_visible(int sector) {
+	if(Bsp::camera_pvs == NULL) return 1;
+	return Bsp::camera_pvs[sector >> 3] & (1 << (sector & 7));
+}
+
 void Sector::render(Portal *portal) {
 	
-	if(frame == Engine::frame) return;
-	frame = Engine::frame;
+	if(pvs_visible(this - Bsp::sectors) == 0) return;
 	
-	this->portal = portal;
-	Bsp::visible_sectors[Bsp::num_visible_sectors++] = this;
+	// the sector is on the current chain of the portals
+	if(path) return;
 	
-	num_visible_objects = 0;
+	// the sector can be seen again through the other portal window,
+	// the rendered objects are skipped by their frames
+	if(frame == Engine::frame) {
+		if(this->portal != portal) this->portal = NULL;
+	} else {
+		frame = Engine::frame;
+		this->portal = portal;
+		Bsp::visible_sectors[Bsp::num_visible_sectors++] = this;
+		num_visible_objects = 0;
+	}
+	path = 1;
 	
-	root->render();
+	// the root mask goes down the tree
+	int mask = -1;
+	if(Engine::frustum->inside(root->min,root->max,mask) && Engine::occlusion->inside(root->min,root->max)) root->render(this,mask);
 	
+	// dynamic objects are culled by four
+	static int all_cull_objects;
+	static Object **cull_objects;
+	static Frustum::Bounds *cull_bounds;
+	static int *cull_indices;
+	static int *cull_masks;
+	if(all_cull_objects < num_objects) {
+		delete [] cull_objects;
+		delete [] cull_bounds;
+		delete [] cull_indices;
+		delete [] cull_masks;
+		all_cull_objects = (num_objects + 3) & ~3;
+		cull_objects = new Object*[all_cull_objects];
+		cull_bounds = new Frustum::Bounds[all_cull_objects / 4];
+		cull_indices = new int[all_cull_objects];
+		cull_masks = new int[all_cull_objects];
+	}
+	int num_cull_objects = 0;
 	for(int i = 0; i < num_objects; i++) {
 		Object *o = objects[i];
 		if(o->frame == Engine::frame) continue;
-		if(Engine::frustum->inside(o->pos + o->getCenter(),o->getRadius())) {
-			Engine::num_triangles += o->render(Object::RENDER_OPACITY);
-			visible_objects[num_visible_objects++] = o;
+		Frustum::Bounds &b = cull_bounds[num_cull_objects / 4];
+		int k = num_cull_objects & 3;
+		vec3 center = o->pos + o->getCenter();
+		float radius = o->getRadius();
+		for(int j = 0; j < 3; j++) {
+			b.min[j][k] = center[j] - radius;
+			b.max[j][k] = center[j] + radius;
 		}
+		cull_objects[num_cull_objects++] = o;
+	}
+	for(int i = num_cull_objects; i & 3; i++) {	// unused lanes
+		Frustum::Bounds &b = cull_bounds[i / 4];
+		for(int j = 0; j < 3; j++) b.min[j][i & 3] = b.max[j][i & 3] = 0.0f;
+	}
+	int num_visible = Engine::frustum->inside(cull_bounds,num_cull_objects,-1,cull_indices,cull_masks);
+	for(int i = 0; i < num_visible; i++) {
+		Object *o = cull_objects[cull_indices[i]];
+		if(Engine::occlusion->inside(o->pos + o->getCenter(),o->getRadius()) == 0) continue;
+		Engine::num_triangles += o->render(Object::RENDER_OPACITY);
+		visible_objects[num_visible_objects++] = o;
 	}
 	
 	for(int i = 0; i < num_portals; i++) {
 		Portal *p = &Bsp::portals[portals[i]];
-		if(p->frame == Engine::frame) continue;
-		p->frame = Engine::frame;
+		// sectors behind the portal can't be seen from the camera sector
+		int j = 0;
+		for(; j < p->num_sectors; j++) {
+			Sector *s = &Bsp::sectors[p->sectors[j]];
+			if(s->path == 0 && pvs_visible(p->sectors[j])) break;
+		}
+		if(j == p->num_sectors) continue;
+		
 		if(Engine::frustum->inside(p->center,p->radius)) {
 			float dist = (Engine::camera - p->center).length();
 			
+			vec3 min = p->points[0];
+			vec3 max = p->points[0];
+			for(int j = 1; j < 4; j++) {
+				for(int k = 0; k < 3; k++) {
+					if(min[k] > p->points[j][k]) min[k] = p->points[j][k];
+					if(max[k] < p->points[j][k]) max[k] = p->points[j][k];
+				}
+			}
+			if(Engine::occlusion->inside(min,max) == 0) continue;
+			
 			if(Engine::have_occlusion && dist > p->radius) {
 				
 				if(Material::old_material) Material::old_material->disable();
@@ -527,13 +673,19 @@ void Sector::render(Portal *portal) {
 				if(samples == 0) continue;
 			}
 			
-			if(dist > p->radius) Engine::frustum->addPortal(Engine::camera,p->points);
+			// the neighbours are seen through the visible part of the portal
+			if(dist > p->radius && Engine::frustum->addPortal(Engine::camera,p->points) == 0) {
+				Engine::frustum->removePortal();
+				continue;
+			}
 			for(int j = 0; j < p->num_sectors; j++) {
 				Bsp::sectors[p->sectors[j]].render(dist > p->radius ? p : NULL);
 			}
 			if(dist > p->radius) Engine::frustum->removePortal();
 		}
 	}
+	
+	path = 0;
 }
 
 /*
@@ -566,6 +718,9 @@ int Bsp::num_portals;
 Portal *Bsp::portals;
 int Bsp::num_sectors;
 Sector *Bsp::sectors;
+int Bsp::pvs_size;
+unsigned char *Bsp::pvs;
+unsigned char *Bsp::camera_pvs;
 int Bsp::num_visible_sectors;
 Sector **Bsp::visible_sectors;
 int Bsp::old_num_visible_sectors;
@@ -576,6 +731,9 @@ Bsp::Bsp() {
 	portals = NULL;
 	num_sectors = 0;
 	sectors = NULL;
+	pvs_size = 0;
+	pvs = NULL;
+	camera_pvs = NULL;
 	num_visible_sectors = 0;
 	visible_sectors = NULL;
 	old_num_visible_sectors = 0;
@@ -589,6 +747,10 @@ Bsp::~Bsp() {
 	if(num_sectors) delete [] sectors;
 	num_sectors = 0;
 	sectors = NULL;
+	if(pvs) delete [] pvs;
+	pvs_size = 0;
+	pvs = NULL;
+	camera_pvs = NULL;
 	if(visible_sectors) delete visible_sectors;
 	num_visible_sectors = 0;
 	visible_sectors = NULL;
@@ -597,6 +759,197 @@ Bsp::~Bsp() {
 	old_visible_sectors = NULL;
 }
 
+/*****************************************************************************/
+/*                                                                           */
+/* Bsp PVS                                                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+#define PVS_EPSILON		0.001f
+#define NUM_PVS_POINTS	64
+
+/* plane of the portal with the point in front
+ */
+static vec4 pvs_plane(const Portal *portal,const vec3 &point) {
+	vec3 normal = cross(portal->points[1] - portal->points[0],portal->points[2] - portal->points[0]);
+	normal.normalize();
+	vec4 plane(normal,-(normal * portal->points[0]));
+	if(plane * point < 0.0f) plane = -plane;
+	return plane;
+}
+
+/* the part of the polygon in front of the plane, the points on the plane are kept
+ */
+static int pvs_clip(vec3 *polygon,int num,const vec4 &plane) {
+	if(num + 2 > NUM_PVS_POINTS) return num;
+	vec3 points[NUM_PVS_POINTS];
+	int ret = 0;
+	for(int i = 0; i < num; i++) {
+		int j = (i + 1) % num;
+		float d0 = plane * polygon[i];
+		float d1 = plane * polygon[j];
+		if(d0 >= -PVS_EPSILON) points[ret++] = polygon[i];
+		if((d0 > PVS_EPSILON && d1 < -PVS_EPSILON) || (d0 < -PVS_EPSILON && d1 > PVS_EPSILON)) {
+			points[ret++] = polygon[i] + (polygon[j] - polygon[i]) * (d0 / (d0 - d1));
+		}
+	}
+	if(ret < 3) return 0;
+	for(int i = 0; i < ret; i++) polygon[i] = points[i];
+	return ret;
+}
+
+/* planes through an edge of the first polygon and a vertex of the second one
+ * which have the polygons on the different sides, the target is kept on the
+ * side of the second polygon or on the side of the first one if flip is set
+ */
+static int pvs_separate(const vec3 *polygon0,int num0,const vec3 *polygon1,int num1,int flip,vec3 *target,int num_target) {
+	for(int i = 0; i < num0; i++) {
+		const vec3 &v0 = polygon0[i];
+		vec3 edge = polygon0[(i + 1) % num0] - v0;
+		for(int j = 0; j < num1; j++) {
+			vec3 normal = cross(edge,polygon1[j] - v0);
+			if(normal.normalize() < EPSILON) continue;
+			vec4 plane(normal,-(normal * v0));
+			int front = 0;
+			int back = 0;
+			for(int k = 0; k < num0; k++) {
+				float d = plane * polygon0[k];
+				if(d > PVS_EPSILON) front = 1;
+				else if(d < -PVS_EPSILON) back = 1;
+			}
+			if(front == back) continue;
+			if(front) plane = -plane;
+			int k = 0;
+			for(; k < num1; k++) {
+				if(plane * polygon1[k] < -PVS_EPSILON) break;
+			}
+			if(k != num1) continue;
+			if(flip) plane = -plane;
+			num_target = pvs_clip(target,num_target,plane);
+			if(num_target == 0) return 0;
+		}
+	}
+	return num_target;
+}
+
+/* sectors behind the sector which can be seen from the source portal through the pass portal
+ */
+static void pvs_flood(unsigned char *row,int *path,int sector,const vec3 *source,int num_source,const vec4 &source_plane,const vec3 *pass,int num_pass,const vec4 &pass_plane) {
+	Sector *s = &Bsp::sectors[sector];
+	for(int i = 0; i < s->num_portals; i++) {
+		Portal *p = &Bsp::portals[s->portals[i]];
+		for(int j = 0; j < p->num_sectors; j++) {
+			int next = p->sectors[j];
+			if(path[next]) continue;
+			vec4 plane = pvs_plane(p,Bsp::sectors[next].center);
+			
+			vec3 target[NUM_PVS_POINTS];
+			for(int k = 0; k < 4; k++) target[k] = p->points[k];
+			int num_target = pvs_clip(target,4,source_plane);
+			if(pass && num_target) num_target = pvs_clip(target,num_target,pass_plane);
+			if(num_target == 0) continue;
+			
+			// the source behind the target
+			vec3 points[NUM_PVS_POINTS];
+			for(int k = 0; k < num_source; k++) points[k] = source[k];
+			int num_points = pvs_clip(points,num_source,-plane);
+			if(num_points == 0) continue;
+			
+			if(pass) {
+				num_target = pvs_separate(points,num_points,pass,num_pass,0,target,num_target);
+				if(num_target) num_target = pvs_separate(pass,num_pass,points,num_points,1,target,num_target);
+				if(num_target == 0) continue;
+			}
+			
+			row[next >> 3] |= 1 << (next & 7);
+			path[next] = 1;
+			pvs_flood(row,path,next,points,num_points,source_plane,target,num_target,plane);
+			path[next] = 0;
+		}
+	}
+}
+
+/* zero bytes are written as the zero and the length of the run
+ */
+static int pvs_compress(const unsigned char *src,int size,unsigned char *dest) {
+	int ret = 0;
+	for(int i = 0; i < size; i++) {
+		dest[ret++] = src[i];
+		if(src[i]) continue;
+		int run = 1;
+		while(i + run < size && src[i + run] == 0 && run < 255) run++;
+		dest[ret++] = run;
+		i += run - 1;
+	}
+	return ret;
+}
+
+/* returns the offset of the next row or -1 for the broken data
+ */
+static int pvs_decompress(const unsigned char *src,int offset,int size,unsigned char *dest,int dest_size) {
+	for(int i = 0; i < dest_size;) {
+		if(offset >= size) return -1;
+		unsigned char c = src[offset++];
+		if(c) {
+			dest[i++] = c;
+			continue;
+		}
+		if(offset >= size) return -1;
+		int run = src[offset++];
+		if(run == 0 || i + run > dest_size) return -1;
+		for(; run > 0; run--) dest[i++] = 0;
+	}
+	return offset;
+}
+
+/*
+ */
+static int pvs_count() {
+	int ret = 0;
+	for(int i = 0; i < Bsp::num_sectors; i++) {
+		unsigned char *row = Bsp::pvs + Bsp::pvs_size * i;
+		for(int j = 0; j < Bsp::num_sectors; j++) {
+			if(row[j >> 3] & (1 << (j & 7))) ret++;
+		}
+	}
+	return ret;
+}
+
+/* sector to sector visibility through the chains of the portals
+ * the first portal is the source, each next portal is clipped by the source,
+ * by the previous portal and by the planes which separate them
+ */
+void Bsp::createPVS() {
+	if(pvs) delete [] pvs;
+	pvs_size = (num_sectors + 7) / 8;
+	pvs = new unsigned char[num_sectors * pvs_size];
+	memset(pvs,0,sizeof(unsigned char) * num_sectors * pvs_size);
+	int *path = new int[num_sectors];
+	memset(path,0,sizeof(int) * num_sectors);
+	for(int i = 0; i < num_sectors; i++) {
+		unsigned char *row = pvs + pvs_size * i;
+		row[i >> 3] |= 1 << (i & 7);
+		path[i] = 1;
+		Sector *s = &sectors[i];
+		for(int j = 0; j < s->num_portals; j++) {
+			Portal *p = &portals[s->portals[j]];
+			for(int k = 0; k < p->num_sectors; k++) {
+				int next = p->sectors[k];
+				if(path[next]) continue;
+				row[next >> 3] |= 1 << (next & 7);
+				vec3 source[4];
+				for(int l = 0; l < 4; l++) source[l] = p->points[l];
+				vec4 plane = pvs_plane(p,sectors[next].center);
+				path[next] = 1;
+				pvs_flood(row,path,next,source,4,plane,NULL,0,plane);
+				path[next] = 0;
+			}
+		}
+		path[i] = 0;
+	}
+	delete [] path;
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* Bsp IO                                                                    */
@@ -652,12 +1005,34 @@ void Bsp::load(const char *name) {
 			s->create();
 		}
 		
+		// the files without the visibility are older
+		if(fread(&magic,sizeof(int),1,file) == 1 && magic == BSP_PVS_MAGIC) {
+			int size;
+			fread(&size,sizeof(int),1,file);
+			unsigned char *data = new unsigned char[size];
+			fread(data,sizeof(unsigned char),size,file);
+			pvs_size = (num_sectors + 7) / 8;
+			pvs = new unsigned char[num_sectors * pvs_size];
+			int offset = 0;
+			for(int i = 0; i < num_sectors && offset >= 0; i++) {
+				offset = pvs_decompress(data,offset,size,pvs + pvs_size * i,pvs_size);
+			}
+			delete [] data;
+			if(offset != size) {
+				fprintf(stderr,"Bsp::load(): bad visibility in \"%s\" file\n",name);
+				createPVS();
+			}
+		} else {
+			createPVS();
+		}
+		
 		fclose(file);
 		
 		visible_sectors = new Sector*[num_sectors];
 		old_visible_sectors = new Sector*[num_sectors];
 		
 		Engine::console->printf("sectors %d\nportals %d\n",num_sectors,num_portals);
+		Engine::console->printf("pvs %d of %d\n",pvs_count(),num_sectors * num_sectors);
 		
 		return;
 	}
@@ -684,6 +1059,8 @@ void Bsp::load(const char *name) {
 		sectors[0].root->create(mesh);
 		sectors[0].create();
 		
+		createPVS();
+	
 	} else {
 		
 		portals = new Portal[num_portals];
@@ -733,6 +1110,8 @@ void Bsp::load(const char *name) {
 			s->create();
 		}
 		
+		createPVS();
+		
 		delete usage_flag;
 		delete mesh;
 	}
@@ -741,6 +1120,7 @@ void Bsp::load(const char *name) {
 	old_visible_sectors = new Sector*[num_sectors];
 	
 	Engine::console->printf("sectors %d\nportals %d\n",num_sectors,num_portals);
+	Engine::console->printf("pvs %d of %d\n",pvs_count(),num_sectors * num_sectors);
 }
 
 /*
@@ -773,6 +1153,16 @@ void Bsp::save(const char *name) {
 		fwrite(s->planes,sizeof(vec4),s->num_planes,file);
 		s->root->save(file);
 	}
+	magic = BSP_PVS_MAGIC;
+	fwrite(&magic,sizeof(int),1,file);
+	unsigned char *data = new unsigned char[num_sectors * pvs_size * 2];
+	int size = 0;
+	for(int i = 0; i < num_sectors; i++) {
+		size += pvs_compress(pvs + pvs_size * i,pvs_size,data + size);
+	}
+	fwrite(&size,sizeof(int),1,file);
+	fwrite(data,sizeof(unsigned char),size,file);
+	delete [] data;
 	fclose(file);
 }
 
@@ -792,20 +1182,65 @@ void Bsp::bindMaterial(const char *name,Material *material) {
  */
 void Bsp::render() {
 	num_visible_sectors = 0;
-	if(Engine::camera.sector != -1) {
-		sectors[Engine::camera.sector].render();
-	} else {
-		int sector = -1;
-		float dist = 1000000.0;
-		for(int i = 0; i < num_sectors; i++) {
-			float d = (sectors[i].center - Engine::camera).length();
-			if(d < dist) {
-				dist = d;
-				sector = i;
-			}
+	// the camera can be in the overlapping sectors near the portal,
+	// the reflected camera of the mirror looks out of them
+	camera_pvs = NULL;
+	if(pvs && Engine::camera.sector != -1 && Engine::current_mirror == NULL) {
+		static int all_rows;
+		static unsigned char *rows;
+		if(all_rows < pvs_size) {
+			delete [] rows;
+			all_rows = pvs_size;
+			rows = new unsigned char[all_rows];
+		}
+		memset(rows,0,sizeof(unsigned char) * pvs_size);
+		for(int i = 0; i < Engine::camera.num_sectors; i++) {
+			unsigned char *row = pvs + pvs_size * Engine::camera.sectors[i];
+			for(int j = 0; j < pvs_size; j++) rows[j] |= row[j];
+		}
+		camera_pvs = rows;
+	}
+	int sector = getCameraSector();
+	if(sector != -1) sectors[sector].render();
+}
+
+/* big triangles of the camera sector and of the sectors behind its portals
+ * the surfaces with the blended or the alpha tested materials are seen through
+ */
+void Bsp::addOccluders() {
+	int sector = getCameraSector();
+	if(sector == -1) return;
+	Sector *s = &sectors[sector];
+	for(int i = 0; i < num_sectors; i++) {
+		int neighbour = (i == sector);
+		for(int j = 0; j < s->num_portals && neighbour == 0; j++) {
+			Portal *p = &portals[s->portals[j]];
+			for(int k = 0; k < p->num_sectors; k++) if(p->sectors[k] == i) neighbour = 1;
+		}
+		if(neighbour == 0) continue;
+		for(int j = 0; j < sectors[i].num_occluders; j++) {
+			Sector::Occluder *o = &sectors[i].occluders[j];
+			Material *material = o->object->materials[o->surface];
+			if(material->blend || material->alpha_test) continue;
+			Engine::occlusion->addOccluder(o->vertex,o->num_vertex);
+		}
+	}
+}
+
+/* the nearest sector when the camera is outside
+ */
+int Bsp::getCameraSector() {
+	if(Engine::camera.sector != -1) return Engine::camera.sector;
+	int sector = -1;
+	float dist = 1000000.0;
+	for(int i = 0; i < num_sectors; i++) {
+		float d = (sectors[i].center - Engine::camera).length();
+		if(d < dist) {
+			dist = d;
+			sector = i;
 		}
-		if(sector != -1) sectors[sector].render();
 	}
+	return sector;
 }
 
 /*
@@ -24,11 +24,13 @@
 #include "mathlib.h"
 
 #define BSP_MAGIC ('B' | ('S' << 8) | ('P' << 16) | ('M' << 24))
+#define BSP_PVS_MAGIC ('P' | ('V' << 8) | ('S' << 16) | ('0' << 24))
 
 class Mesh;
 class Material;
 class Object;
 class ObjectMesh;
+class Sector;
 
 /*
  */
@@ -43,7 +45,7 @@ public:
 	void save(FILE *file);
 	
 	void bindMaterial(const char *name,Material *material);
-	void render();
+	void render(Sector *sector,int mask = -1);
 	
 	enum {
 		TRIANGLES_PER_NODE = 1024,
@@ -80,8 +82,6 @@ public:
 	int *sectors;
 	
 	vec3 points[4];
-
-	int frame;
 };
 
 /*
@@ -94,6 +94,7 @@ public:
 	
 	void create(Mesh *mesh,int s);
 	void getNodeObjects(Node *node);
+	void getOccluders(Node *node);
 	void create();
 	
 	int inside(const vec3 &point);
@@ -126,17 +127,32 @@ public:
 	int *portals;
 	
 	int num_objects;				// dynamic objects
+	int all_objects;
 	Object **objects;
 	
 	int num_node_objects;			// static object from the node
 	Object **node_objects;
 	
+	int num_occluder_vertex;		// big triangles of the tree
+	vec3 *occluder_vertex;
+	
+	struct Occluder {				// triangles of one surface of the node
+		ObjectMesh *object;			// materials are bound after the creation
+		int surface;
+		int num_vertex;
+		vec3 *vertex;
+	};
+	
+	int num_occluders;
+	Occluder *occluders;
+	
 	int num_visible_objects;		// only visible objects
 	Object **visible_objects;
 	
-	Portal *portal;					// sector is visible through this portal
+	Portal *portal;					// sector is visible through this portal, NULL for the several portals
 	
 	int frame;
+	int path;						// the sector is on the chain of the portals
 
 	int old_num_visible_objects;	// save/restore state
 	Object **old_visible_objects;
@@ -155,18 +171,27 @@ public:
 	void load(const char *name);
 	void save(const char *name);
 	
+	void createPVS();
+	
 	void bindMaterial(const char *name,Material *material);
+	void addOccluders();
 	void render();
 	
 	void saveState();
 	void restoreState(int frame);
 	
+	static int getCameraSector();
+	
 	static int num_portals;
 	static Portal *portals;
 
 	static int num_sectors;
 	static Sector *sectors;
 	
+	static int pvs_size;				// bytes of the sector row
+	static unsigned char *pvs;			// potentially visible sectors, row by the sector
+	static unsigned char *camera_pvs;	// row of the camera sector, NULL when all sectors can be seen
+	
 	static int num_visible_sectors;
 	static Sector **visible_sectors;
 
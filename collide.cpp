@@ -17,6 +17,15 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define USE_SSE
+#include <xmmintrin.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
 #include "engine.h"
 #include "object.h"
 #include "objectmesh.h"
@@ -24,39 +33,170 @@
 #include "mesh.h"
 #include "skinnedmesh.h"
 #include "rigidbody.h"
+#include "broadphase.h"
 #include "collide.h"
 
-int Collide::counter;
-Position Collide::position;
-int Collide::num_surfaces;
-Collide::Surface *Collide::surfaces;
+int Collide::simd = Collide::isSIMD();
 
 /*
  */
-Collide::Collide() : num_contacts(0), num_objects(0) {
-	
-	contacts = new Contact[NUM_CONTACTS];
-	objects = new Object*[NUM_OBJECTS];
-	
-	if(counter++ == 0) {
-		surfaces = new Surface[NUM_SURFACES];
-		for(int i = 0; i < NUM_SURFACES; i++) {
-			surfaces[i].triangles = new Triangle[NUM_TRIANGLES];
-		}
-	}
+Collide::Collide() : num_contacts(0), all_contacts(0), contacts(NULL), max_contacts(0), num_objects(0), all_objects(0), objects(NULL), all_candidates(0), candidates(NULL), all_found(0), found(NULL), found_masks(NULL), all_orders(0), orders(NULL),
+	num_sweep_triangles(0), all_sweep_triangles(0), sweep_triangles(NULL),
+	num_surfaces(0), all_surfaces(0), surfaces(NULL),
+	num_hull_vertex(0), all_hull_vertex(0), hull_vertex(NULL), num_hull_planes(0), all_hull_planes(0), hull_planes(NULL) {
+
 }
 
 Collide::~Collide() {
 	
-	delete contacts;
-	delete objects;
+	delete [] contacts;
+	delete [] objects;
+	delete [] candidates;
+	delete [] found;
+	delete [] found_masks;
+	delete [] orders;
+	delete [] sweep_triangles;
+	delete [] hull_vertex;
+	delete [] hull_planes;
 	
-	if(--counter == 0) {
-		for(int i = 0; i < NUM_SURFACES; i++) {
-			delete surfaces[i].triangles;
-		}
-		delete surfaces;
+	for(int i = 0; i < all_surfaces; i++) {
+		delete [] surfaces[i].triangles;
+	}
+	delete [] surfaces;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* SIMD kernels                                                              */
+/*                                                                           */
+/*****************************************************************************/
+
+/* runtime SSE check
+ */
+int Collide::isSIMD() {
+#ifdef USE_SSE
+#ifdef _WIN32
+	int info[4];
+	__cpuid(info,1);
+	return (info[3] >> 25) & 1;
+#else
+	unsigned int eax,ebx,ecx,edx;
+	if(__get_cpuid(1,&eax,&ebx,&ecx,&edx) == 0) return 0;
+	return (edx >> 25) & 1;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/* the kernels only reject triangles of the pack, contacts are
+ * calculated by the scalar code so they are the same with and without SIMD
+ * epsilon keeps the rejection conservative
+ */
+#define PACK_EPSILON 0.001f
+
+/* mask of triangles which can touch the sphere
+ */
+static int sphere_pack(const Mesh::TrianglePack *pack,const vec3 &pos,float radius) {
+#ifdef USE_SSE
+	__m128 x = _mm_set1_ps(pos.x);
+	__m128 y = _mm_set1_ps(pos.y);
+	__m128 z = _mm_set1_ps(pos.z);
+	// distance to the plane is in [0,radius)
+	__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pack->plane[0]),x),_mm_mul_ps(_mm_loadu_ps(pack->plane[1]),y)),
+		_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pack->plane[2]),z),_mm_loadu_ps(pack->plane[3])));
+	__m128 mask = _mm_and_ps(_mm_cmplt_ps(dist,_mm_set1_ps(radius + PACK_EPSILON)),_mm_cmpge_ps(dist,_mm_set1_ps(-PACK_EPSILON)));
+	// projected center isn`t farther than radius from the triangle
+	__m128 r = _mm_set1_ps(-radius - PACK_EPSILON);
+	for(int i = 0; i < 3; i++) {
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pack->c[i][0]),x),_mm_mul_ps(_mm_loadu_ps(pack->c[i][1]),y)),
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(pack->c[i][2]),z),_mm_loadu_ps(pack->c[i][3])));
+		mask = _mm_and_ps(mask,_mm_cmpgt_ps(d,r));
+	}
+	return _mm_movemask_ps(mask);
+#else
+	return 0xf;
+#endif
+}
+
+/* mask of triangles whose planes are crossed by the triangle
+ */
+static int triangle_pack(const Mesh::TrianglePack *pack,const vec3 *v,float radius) {
+#ifdef USE_SSE
+	__m128 px = _mm_loadu_ps(pack->plane[0]);
+	__m128 py = _mm_loadu_ps(pack->plane[1]);
+	__m128 pz = _mm_loadu_ps(pack->plane[2]);
+	__m128 pw = _mm_loadu_ps(pack->plane[3]);
+	__m128 eps = _mm_set1_ps(PACK_EPSILON);
+	__m128 neps = _mm_set1_ps(-PACK_EPSILON);
+	__m128 far_dist = _mm_set1_ps(radius * 2.0f + PACK_EPSILON);
+	__m128 near_dist = _mm_set1_ps(-radius * 2.0f - PACK_EPSILON);
+	__m128 far_mask = _mm_setzero_ps();
+	__m128 front = _mm_cmpeq_ps(far_mask,far_mask);
+	__m128 back = front;
+	for(int i = 0; i < 3; i++) {
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px,_mm_set1_ps(v[i].x)),_mm_mul_ps(py,_mm_set1_ps(v[i].y))),
+			_mm_add_ps(_mm_mul_ps(pz,_mm_set1_ps(v[i].z)),pw));
+		front = _mm_and_ps(front,_mm_cmpgt_ps(dist,eps));
+		back = _mm_and_ps(back,_mm_cmplt_ps(dist,neps));
+		far_mask = _mm_or_ps(far_mask,_mm_or_ps(_mm_cmpgt_ps(dist,far_dist),_mm_cmplt_ps(dist,near_dist)));
+	}
+	return ~_mm_movemask_ps(_mm_or_ps(_mm_or_ps(front,back),far_mask)) & 0xf;
+#else
+	return 0xf;
+#endif
+}
+
+/* rigidbodies are simulated apart from the objects,
+ * other objects are moved by the main thread and collided by their copies
+ */
+inline int Collide::isIdentity(Object *object) {
+	return object->rigidbody ? object->is_identity : object->physic_identity;
+}
+
+inline const mat4 &Collide::getTransform(Object *object) {
+	return object->rigidbody ? object->rigidbody->transform : object->physic_transform;
+}
+
+inline const mat4 &Collide::getITransform(Object *object) {
+	return object->rigidbody ? object->rigidbody->itransform : object->physic_itransform;
+}
+
+inline const Position &Collide::getPosition(Object *object) {
+	return object->rigidbody ? object->rigidbody->position : object->pos;
+}
+
+inline vec3 Collide::getPos(Object *object) {
+	const mat4 &transform = getTransform(object);
+	return vec3(transform[12],transform[13],transform[14]);
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* broadphase                                                                */
+/*                                                                           */
+/*****************************************************************************/
+
+static int candidate_cmp(const void *a,const void *b) {
+	Object *o0 = *(Object**)a;
+	Object *o1 = *(Object**)b;
+	return o0->id - o1->id;
+}
+
+/* objects overlapped with the box in the order of their creation
+ * proxies are reused when the objects leave the sectors and come back,
+ * so they depend on the history which isn`t saved by the physic snapshot
+ */
+int Collide::findObjects(const vec3 &min,const vec3 &max) {
+	int num = Broadphase::query(min,max,candidates,all_candidates);
+	if(num > all_candidates) {
+		delete [] candidates;
+		all_candidates = num * 2;
+		candidates = new Object*[all_candidates];
+		num = Broadphase::query(min,max,candidates,all_candidates);
 	}
+	qsort(candidates,num,sizeof(Object*),candidate_cmp);
+	return num;
 }
 
 /*****************************************************************************/
@@ -66,10 +206,17 @@ Collide::~Collide() {
 /*****************************************************************************/
 
 int Collide::addContact(Object *object,Material *material,const vec3 &point,const vec3 &normal,float depth,int min_depth) {
+	if(num_contacts == all_contacts) {
+		all_contacts = all_contacts ? all_contacts * 2 : 32;
+		Contact *c = new Contact[all_contacts];
+		for(int i = 0; i < num_contacts; i++) c[i] = contacts[i];
+		delete [] contacts;
+		contacts = c;
+	}
 	Contact *c = &contacts[num_contacts++];
 	if(min_depth) {
-		vec3 p = object->is_identity ? point : object->transform * point;
-		for(int i = 0; i < num_contacts; i++) {
+		vec3 p = isIdentity(object) ? point : getTransform(object) * point;
+		for(int i = 0; i < num_contacts - 1; i++) {	// the last one is the new contact
 			if(contacts[i].point == p) {
 				num_contacts--;
 				if(contacts[i].depth < depth) return 1;
@@ -78,22 +225,28 @@ int Collide::addContact(Object *object,Material *material,const vec3 &point,cons
 			}
 		}
 	}
-	if(num_contacts == NUM_CONTACTS) {
+	if(max_contacts && num_contacts > max_contacts) {
 		num_contacts--;
 		return 0;
 	}
-	if(num_objects == 0) {
-		objects[num_objects++] = object;
-	} else {
-		for(int i = 0; i < num_objects; i++) {
-			if(objects[i] == object) break;
-			else if(i == num_objects - 1) objects[num_objects++] = object;
+	int i = 0;
+	for(; i < num_objects; i++) {
+		if(objects[i] == object) break;
+	}
+	if(i == num_objects) {
+		if(num_objects == all_objects) {
+			all_objects = all_objects ? all_objects * 2 : 16;
+			Object **o = new Object*[all_objects];
+			if(objects) memcpy(o,objects,sizeof(Object*) * num_objects);
+			delete [] objects;
+			objects = o;
 		}
+		objects[num_objects++] = object;
 	}
 	c->object = object;
 	c->material = material;
-	c->point = object->is_identity ? point : object->transform * point;
-	c->normal = object->is_identity ? normal : object->transform.rotation() * normal;
+	c->point = isIdentity(object) ? point : getTransform(object) * point;
+	c->normal = isIdentity(object) ? normal : getTransform(object).rotation() * normal;
 	c->depth = depth;
 	
 	/*glDepthFunc(GL_ALWAYS);
@@ -123,37 +276,58 @@ int Collide::collide(Object *object,const vec3 &pos,float radius) {
 }
 
 int Collide::collide(Object *object,const Position &pos,float radius) {
+	return collide(object,pos,pos,radius);
+}
+
+/* the sphere is in the center, sectors are given by the pos
+ */
+int Collide::collide(Object *object,const Position &pos,const vec3 &center,float radius) {
 	num_contacts = 0;
 	num_objects = 0;
 	
 	if(Bsp::num_sectors == 0) return 0;
 	if(pos.sector == -1) return 0;
 	
+	int num_sector_pairs = 0;
 	for(int i = 0; i < pos.num_sectors; i++) {
 		Sector *s = &Bsp::sectors[pos.sectors[i]];
-		for(int j = 0; j < s->num_node_objects; j++) {	// static objects
-			Object *o = s->node_objects[j];
-			if((o->getCenter() - pos).length() >= o->getRadius() + radius) continue;
-			collideObjectSphere(o,pos,radius);
-		}
-		for(int j = 0; j < s->num_objects; j++) {	// dynamic objects
-			Object *o = s->objects[j];
-			if(object == o) continue;
-			vec3 p = o->is_identity ? pos : o->itransform * pos;
-			if((o->getCenter() - p).length() >= o->getRadius() + radius) continue;
-			if(object && object->rigidbody && object->rigidbody->num_joints > 0 && o->rigidbody) {
-				RigidBody *rb = object->rigidbody;
-				int k;
-				for(k = 0; k < rb->num_joints; k++) {
-					if(rb->joined_rigidbodies[k] == o->rigidbody) break;
-				}
-				if(k == rb->num_joints) collideObjectSphere(o,p,radius);
-			} else {
-				collideObjectSphere(o,p,radius);
+		num_sector_pairs += s->num_node_objects + s->num_objects;
+	}
+	
+	int num = findObjects(center - vec3(radius,radius,radius),center + vec3(radius,radius,radius));
+	
+	Broadphase::addCounters(num_sector_pairs,collideObjects(object,center,radius,num));
+	return num_contacts;
+}
+
+/* the sphere with the candidates, returns the number of tested pairs
+ */
+int Collide::collideObjects(Object *object,const vec3 &center,float radius,int num) {
+	int num_pairs = 0;
+	for(int i = 0; i < num; i++) {	// static objects
+		Object *o = candidates[i];
+		if(isIdentity(o) == 0) continue;
+		if((o->getCenter() - center).length() >= o->getRadius() + radius) continue;
+		num_pairs++;
+		collideObjectSphere(o,center,radius);
+	}
+	for(int i = 0; i < num; i++) {	// dynamic objects
+		Object *o = candidates[i];
+		if(object == o || isIdentity(o)) continue;
+		vec3 p = getITransform(o) * center;
+		if((o->getCenter() - p).length() >= o->getRadius() + radius) continue;
+		if(object && object->rigidbody && object->rigidbody->num_joints > 0 && o->rigidbody) {
+			RigidBody *rb = object->rigidbody;
+			int k;
+			for(k = 0; k < rb->num_joints; k++) {
+				if(rb->joined_rigidbodies[k] == o->rigidbody) break;
 			}
+			if(k != rb->num_joints) continue;
 		}
+		num_pairs++;
+		collideObjectSphere(o,p,radius);
 	}
-	return num_contacts;
+	return num_pairs;
 }
 
 /*
@@ -166,13 +340,17 @@ void Collide::collideObjectSphere(Object *object,const vec3 &pos,float radius) {
 	if(object->type == Object::OBJECT_MESH) {
 		
 		// collide sphere-sphere
-		if(object->rigidbody && object->rigidbody->collide_type == RigidBody::BODY_SPHERE) {
-			float r = object->getRadius();
-			if(pos.length() < radius + r) {
-				vec3 normal = pos;
-				normal.normalize();
-				if(!addContact(object,NULL,normal * radius,normal,radius + r - pos.length())) return;
-			}
+		RigidBody *rb = object->rigidbody;
+		if(rb && rb->collide_type == RigidBody::COLLIDE_SPHERE) {
+			collideSphereSphere(object,pos,radius,vec3(0,0,0),object->getRadius());
+			return;
+		}
+		
+		// collide sphere-shape
+		if(rb && rb->collide_type == RigidBody::COLLIDE_SHAPE && rb->body_type != RigidBody::BODY_CYLINDER) {
+			Shape shape;
+			getShape(object,mat4(),shape);
+			collideSphereShape(object,pos,radius,shape);
 			return;
 		}
 		
@@ -183,54 +361,81 @@ void Collide::collideObjectSphere(Object *object,const vec3 &pos,float radius) {
 			if((mesh->getCenter(i) - pos).length() > mesh->getRadius(i) + radius) continue;
 			
 			Mesh::Triangle *triangles = mesh->getTriangles(i);
+			Mesh::BVHNode *nodes = mesh->getNodes(i);
+			Mesh::TrianglePack *packs = mesh->getPacks(i);
 			
-			int num_triangles = mesh->getNumTriangles(i);
-			for(int j = 0; j < num_triangles; j++) {
-				Mesh::Triangle *t = &triangles[j];
-				
-				// distance from the center of sphere to the plane of triangle
-				float dist = vec4(pos,1) * t->plane;
-				if(dist >= radius || dist < 0) continue;
-				
-				vec3 normal = t->plane;
-				vec3 point = pos - normal * radius;
-				float depth = radius - dist;
+			if(mesh->getNumNodes(i) == 0) continue;
+			
+			vec3 min = pos - vec3(radius,radius,radius);	// sphere bound box
+			vec3 max = pos + vec3(radius,radius,radius);
+			
+			// only the triangles from the overlapped bvh leaves
+			int stack[Mesh::NUM_BVH_STACK];
+			int num_stack = 0;
+			stack[num_stack++] = 0;
+			while(num_stack) {
+				int id = stack[--num_stack];
+				Mesh::BVHNode *node = &nodes[id];
+				if(node->min.x > max.x || node->max.x < min.x) continue;
+				if(node->min.y > max.y || node->max.y < min.y) continue;
+				if(node->min.z > max.z || node->max.z < min.z) continue;
+				if(node->num_triangles == 0) {
+					stack[num_stack++] = node->right;
+					stack[num_stack++] = id + 1;
+					continue;
+				}
 				
-				int k;	// point in traingle
-				for(k = 0; k < 3; k++) if(vec4(point,1) * t->c[k] < 0.0) break;
+				int mask = simd ? sphere_pack(&packs[node->right],pos,radius) : 0xf;
 				
-				// collide sphere with edges
-				if(k != 3) {
-					point = pos - normal * dist;	// point on triangle plane
-					for(k = 0; k < 3; k++) {
-						vec3 edge = t->v[next[k]] - t->v[k];
-						vec3 dir = cross(edge,normal);
-						dir.normalize();
-						
-						float d = (point - t->v[k]) * dir;
-						if(d >= radius || d <= 0) continue;
-						
-						vec3 p = point - dir * d;	// point on edge
-						
-						float dot = p * edge;	// clamp point
-						if(dot > t->v[next[k]] * edge) p = t->v[next[k]];
-						else if(dot < t->v[k] * edge) p = t->v[k];
-						
-						d = (point - p).length();
-						if(d > radius) continue;
-						
-						depth = sqrt(radius * radius - d * d) - dist;
-						if(depth <= 0.0) continue;
-						
-						point = p - normal * depth;
-						
-						break;	// ok
+				for(int j = node->first; j < node->first + node->num_triangles; j++) {
+					if((mask & (1 << (j - node->first))) == 0) continue;
+					
+					Mesh::Triangle *t = &triangles[j];
+					
+					// distance from the center of sphere to the plane of triangle
+					float dist = vec4(pos,1) * t->plane;
+					if(dist >= radius || dist < 0) continue;
+					
+					vec3 normal = t->plane;
+					vec3 point = pos - normal * radius;
+					float depth = radius - dist;
+					
+					int k;	// point in traingle
+					for(k = 0; k < 3; k++) if(vec4(point,1) * t->c[k] < 0.0) break;
+					
+					// collide sphere with edges
+					if(k != 3) {
+						point = pos - normal * dist;	// point on triangle plane
+						for(k = 0; k < 3; k++) {
+							vec3 edge = t->v[next[k]] - t->v[k];
+							vec3 dir = cross(edge,normal);
+							dir.normalize();
+							
+							float d = (point - t->v[k]) * dir;
+							if(d >= radius || d <= 0) continue;
+							
+							vec3 p = point - dir * d;	// point on edge
+							
+							float dot = p * edge;	// clamp point
+							if(dot > t->v[next[k]] * edge) p = t->v[next[k]];
+							else if(dot < t->v[k] * edge) p = t->v[k];
+							
+							d = (point - p).length();
+							if(d > radius) continue;
+							
+							depth = sqrt(radius * radius - d * d) - dist;
+							if(depth <= 0.0) continue;
+							
+							point = p - normal * depth;
+							
+							break;	// ok
+						}
+						if(k == 3) continue;	// next triangle
 					}
-					if(k == 3) continue;	// next triangle
+					
+					// add new contact
+					if(!addContact(object,object->materials[i],point,t->plane,depth)) return;
 				}
-				
-				// add new contact
-				if(!addContact(object,object->materials[i],point,t->plane,depth)) return;
 			}
 		}
 		return;
@@ -302,347 +507,632 @@ void Collide::collideObjectSphere(Object *object,const vec3 &pos,float radius) {
 
 /*****************************************************************************/
 /*                                                                           */
-/* collide with mesh                                                         */
+/* sweep sphere                                                              */
 /*                                                                           */
 /*****************************************************************************/
 
-int Collide::collide(Object *object) {
+/* the sphere touches the triangle
+ */
+#define SWEEP_EPSILON 0.001f
+
+/* closest point of the triangle
+ */
+static vec3 triangle_closest(const vec3 &p,const vec3 &a,const vec3 &b,const vec3 &c) {
+	vec3 ab = b - a;
+	vec3 ac = c - a;
+	vec3 ap = p - a;
+	float d1 = ab * ap;
+	float d2 = ac * ap;
+	if(d1 <= 0.0f && d2 <= 0.0f) return a;
+	vec3 bp = p - b;
+	float d3 = ab * bp;
+	float d4 = ac * bp;
+	if(d3 >= 0.0f && d4 <= d3) return b;
+	float vc = d1 * d4 - d3 * d2;
+	if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+	vec3 cp = p - c;
+	float d5 = ab * cp;
+	float d6 = ac * cp;
+	if(d6 >= 0.0f && d5 <= d6) return c;
+	float vb = d5 * d2 - d1 * d6;
+	if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+	float va = d3 * d6 - d5 * d4;
+	if(va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	float idenom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * idenom) + ac * (vc * idenom);
+}
+
+/* time of impact of the sphere moving from pos0 to pos1 with the static objects
+ * only the triangles whose planes are crossed by the center are swept,
+ * the others are found by the discrete collision at the end of the motion
+ * conservative advancement: the sphere is moved by the distance to the nearest
+ * triangle until it touches, returns the fraction of the motion or 1.0
+ */
+float Collide::sweep(Object *object,const vec3 &pos0,const vec3 &pos1,float radius) {
 	
-	num_contacts = 0;
-	num_objects = 0;
+	vec3 dir = pos1 - pos0;
+	float length = dir.length();
+	if(length < EPSILON) return 1.0f;
 	
-	if(Bsp::num_sectors == 0) return 0;
-	if(object->pos.sector == -1) return 0;
+	vec3 min,max;	// sweep bound box
+	for(int i = 0; i < 3; i++) {
+		min[i] = (pos0[i] < pos1[i] ? pos0[i] : pos1[i]) - radius;
+		max[i] = (pos0[i] > pos1[i] ? pos0[i] : pos1[i]) + radius;
+	}
+	return sweepObjects(object,pos0,pos1,radius,findObjects(min,max));
+}
+
+/* the sphere is swept against the static candidates
+ */
+float Collide::sweepObjects(Object *object,const vec3 &pos0,const vec3 &pos1,float radius,int num) {
 	
-	num_surfaces = 0;
+	vec3 dir = pos1 - pos0;
+	float length = dir.length();
 	
-	// transform and copy triangles from the mesh in to collide surface
-	if(object->type == Object::OBJECT_MESH) {
+	vec3 min,max;
+	for(int i = 0; i < 3; i++) {
+		min[i] = (pos0[i] < pos1[i] ? pos0[i] : pos1[i]) - radius;
+		max[i] = (pos0[i] > pos1[i] ? pos0[i] : pos1[i]) + radius;
+	}
+	vec3 center = (pos0 + pos1) / 2.0f;
+	float center_radius = length / 2.0f + radius;
+	
+	num_sweep_triangles = 0;
+	
+	for(int i = 0; i < num; i++) {
+		Object *o = candidates[i];
+		if(object == o || isIdentity(o) == 0 || o->type != Object::OBJECT_MESH) continue;
+		if((o->getCenter() - center).length() >= o->getRadius() + center_radius) continue;
 		
-		Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+		Mesh *mesh = reinterpret_cast<ObjectMesh*>(o)->mesh;
 		
-		for(int i = 0; i < mesh->getNumSurfaces(); i++) {
-			
-			surfaces[num_surfaces].num_triangles = mesh->getNumTriangles(i);
-			
-			if(surfaces[num_surfaces].num_triangles > NUM_TRIANGLES) {
-				fprintf(stderr,"Collide::collide(): many vertex %d\n",surfaces[num_surfaces].num_triangles);
-				continue;
-			}
+		for(int j = 0; j < mesh->getNumSurfaces(); j++) {
+			if((mesh->getCenter(j) - center).length() > mesh->getRadius(j) + center_radius) continue;
+			if(mesh->getNumNodes(j) == 0) continue;
 			
-			Mesh::Triangle *t = mesh->getTriangles(i);
-			Triangle *ct = surfaces[num_surfaces].triangles;
+			Mesh::Triangle *triangles = mesh->getTriangles(j);
+			Mesh::BVHNode *nodes = mesh->getNodes(j);
 			
-			vec3 min = vec3(1000000,1000000,1000000);	// calculate bound box
-			vec3 max = vec3(-1000000,-1000000,-1000000);
-			
-			for(int j = 0; j < surfaces[num_surfaces].num_triangles; j++) {
-				ct[j].v[0] = object->transform * t[j].v[0];
-				ct[j].v[1] = object->transform * t[j].v[1];
-				ct[j].v[2] = object->transform * t[j].v[2];
-				mat4 rotate = object->transform.rotation();
-				vec3 normal = rotate * vec3(t[j].plane);
-				ct[j].plane = vec4(normal,-ct[j].v[0] * normal);
-				normal = rotate * vec4(t[j].c[0]);
-				ct[j].c[0] = vec4(normal,-ct[j].v[0] * normal);
-				normal = rotate * vec4(t[j].c[1]);
-				ct[j].c[1] = vec4(normal,-ct[j].v[1] * normal);
-				normal = rotate * vec4(t[j].c[2]);
-				ct[j].c[2] = vec4(normal,-ct[j].v[2] * normal);
-				for(int k = 0; k < 3; k++) {
-					if(min.x > ct[j].v[k].x) min.x = ct[j].v[k].x;
-					else if(max.x < ct[j].v[k].x) max.x = ct[j].v[k].x;
-					if(min.y > ct[j].v[k].y) min.y = ct[j].v[k].y;
-					else if(max.y < ct[j].v[k].y) max.y = ct[j].v[k].y;
-					if(min.z > ct[j].v[k].z) min.z = ct[j].v[k].z;
-					else if(max.z < ct[j].v[k].z) max.z = ct[j].v[k].z;
+			int stack[Mesh::NUM_BVH_STACK];
+			int num_stack = 0;
+			stack[num_stack++] = 0;
+			while(num_stack) {
+				int id = stack[--num_stack];
+				Mesh::BVHNode *node = &nodes[id];
+				if(node->min.x > max.x || node->max.x < min.x) continue;
+				if(node->min.y > max.y || node->max.y < min.y) continue;
+				if(node->min.z > max.z || node->max.z < min.z) continue;
+				if(node->num_triangles == 0) {
+					stack[num_stack++] = node->right;
+					stack[num_stack++] = id + 1;
+					continue;
+				}
+				for(int k = node->first; k < node->first + node->num_triangles; k++) {
+					Mesh::Triangle *t = &triangles[k];
+					if(vec4(pos0,1) * t->plane < 0.0 || vec4(pos1,1) * t->plane >= 0.0) continue;
+					
+					if(num_sweep_triangles == all_sweep_triangles) {
+						all_sweep_triangles = all_sweep_triangles ? all_sweep_triangles * 2 : 32;
+						Triangle *new_triangles = new Triangle[all_sweep_triangles];
+						for(int l = 0; l < num_sweep_triangles; l++) new_triangles[l] = sweep_triangles[l];
+						delete [] sweep_triangles;
+						sweep_triangles = new_triangles;
+					}
+					Triangle *st = &sweep_triangles[num_sweep_triangles++];
+					st->v[0] = t->v[0];
+					st->v[1] = t->v[1];
+					st->v[2] = t->v[2];
+					st->plane = t->plane;
 				}
-			}
-			// bound sphere
-			surfaces[num_surfaces].center = (max + min) / 2.0f;
-			surfaces[num_surfaces].radius = (max - min).length() / 2.0f;
-			// bound box
-			surfaces[num_surfaces].min = min;
-			surfaces[num_surfaces].max = max;
-		
-			// new surface
-			num_surfaces++;
-			if(num_surfaces == NUM_SURFACES) {
-				fprintf(stderr,"Collide::collide(): many surfaces %d\n",NUM_SURFACES);
-				break;
 			}
 		}
-	} else {
-		fprintf(stderr,"Collide::collide(): %d format isn`t supported\n",object->type);
 	}
+	if(num_sweep_triangles == 0) return 1.0f;
+	
+	// conservative advancement
+	float time = 0.0f;
+	for(int i = 0; i < NUM_SWEEP_ITERATIONS; i++) {
+		vec3 pos = pos0 + dir * time;
+		float dist = 1e10;
+		for(int j = 0; j < num_sweep_triangles; j++) {
+			Triangle *t = &sweep_triangles[j];
+			float d = (pos - triangle_closest(pos,t->v[0],t->v[1],t->v[2])).length();
+			if(dist > d) dist = d;
+		}
+		if(dist < radius + SWEEP_EPSILON) return time;
+		time += (dist - radius) / length;
+		if(time >= 1.0f) return 1.0f;
+	}
+	return time;
+}
+
+int Collide::order_cmp(const void *a,const void *b) {
+	const Collide::Order *o0 = (const Collide::Order*)a;
+	const Collide::Order *o1 = (const Collide::Order*)b;
+	if(o0->key != o1->key) return o0->key - o1->key;
+	return o0->query - o1->query;
+}
+
+/* candidates of all queries are found by one traversal of the broadphase tree,
+ * each query gets the same contacts as by the sweep() and collide() calls
+ */
+int Collide::collide(Query *queries,int num_queries,Contact *buffer,int num) {
 	
-	if(!num_surfaces) return 0;
+	if(num_queries <= 0) return 0;
 	
-	// static objects
-	for(int i = 0; i < object->pos.num_sectors; i++) {
-		Sector *s = &Bsp::sectors[object->pos.sectors[i]];
-		for(int j = 0; j < s->num_node_objects; j++) {
-			Object *o = s->node_objects[j];
-			if((o->getCenter() - object->pos - object->getCenter()).length() >= o->getRadius() + object->getRadius()) continue;
-			collideObjectMesh(o);
+	// near queries are grouped by the order along the curve
+	if(all_orders < num_queries) {
+		delete [] orders;
+		all_orders = num_queries * 2;
+		orders = new Order[all_orders];
+	}
+	vec3 min = queries[0].pos0;
+	vec3 max = queries[0].pos0;
+	for(int i = 1; i < num_queries; i++) {
+		const vec3 &p = queries[i].pos0;
+		for(int j = 0; j < 3; j++) {
+			if(min[j] > p[j]) min[j] = p[j];
+			if(max[j] < p[j]) max[j] = p[j];
+		}
+	}
+	vec3 scale = max - min;
+	for(int i = 0; i < 3; i++) scale[i] = scale[i] > EPSILON ? 1023.0f / scale[i] : 0.0f;
+	for(int i = 0; i < num_queries; i++) {
+		const vec3 &p = queries[i].pos0;
+		int key = 0;
+		int x = (int)((p.x - min.x) * scale.x);
+		int y = (int)((p.y - min.y) * scale.y);
+		int z = (int)((p.z - min.z) * scale.z);
+		for(int j = 0; j < 10; j++) {
+			key |= (((x >> j) & 1) << (j * 3)) | (((y >> j) & 1) << (j * 3 + 1)) | (((z >> j) & 1) << (j * 3 + 2));
 		}
+		orders[i].key = key;
+		orders[i].query = i;
 	}
+	qsort(orders,num_queries,sizeof(Order),order_cmp);
 	
-	// dynamic objects
-	for(int i = 0; i < object->pos.num_sectors; i++) {
+	int ret = 0;
+	for(int i = 0; i < num_queries; i += Broadphase::NUM_BOXES) {
 		
-		Sector *s = &Bsp::sectors[object->pos.sectors[i]];
+		int num_boxes = num_queries - i < Broadphase::NUM_BOXES ? num_queries - i : Broadphase::NUM_BOXES;
 		
-		for(int j = 0; j < s->num_objects; j++) {
-			
-			Object *o = s->objects[j];
-			if(object == o) continue;
-			
-			if((o->pos + o->getCenter() - object->pos - object->getCenter()).length() >= o->getRadius() + object->getRadius()) continue;
-			mat4 transform = o->itransform * object->transform;
-			
-			if(object->rigidbody && object->rigidbody->num_joints > 0 && o->rigidbody) {
-				RigidBody *rb = object->rigidbody;
-				int k;
-				for(k = 0; k < rb->num_joints; k++) {
-					if(rb->joined_rigidbodies[k] == o->rigidbody) break;
-				}
-				if(k != rb->num_joints) continue;
+		vec3 min[Broadphase::NUM_BOXES];
+		vec3 max[Broadphase::NUM_BOXES];
+		for(int j = 0; j < num_boxes; j++) {
+			Query *q = &queries[orders[i + j].query];
+			for(int k = 0; k < 3; k++) {
+				min[j][k] = (q->pos0[k] < q->pos1[k] ? q->pos0[k] : q->pos1[k]) - q->radius;
+				max[j][k] = (q->pos0[k] > q->pos1[k] ? q->pos0[k] : q->pos1[k]) + q->radius;
 			}
+		}
+		
+		int num_found = Broadphase::query(min,max,num_boxes,found,found_masks,all_found);
+		if(num_found > all_found) {
+			delete [] found;
+			delete [] found_masks;
+			all_found = num_found * 2;
+			found = new Object*[all_found];
+			found_masks = new int[all_found];
+			num_found = Broadphase::query(min,max,num_boxes,found,found_masks,all_found);
+			if(num_found > all_found) num_found = all_found;	// the physic thread
+		}
+		if(all_candidates < num_found) {
+			delete [] candidates;
+			all_candidates = num_found * 2;
+			candidates = new Object*[all_candidates];
+		}
+		
+		for(int j = 0; j < num_boxes; j++) {
+			Query *q = &queries[orders[i + j].query];
 			
-			// object bound box
-			vec3 object_min = vec3(1000000,1000000,1000000);
-			vec3 object_max = vec3(-1000000,-1000000,-1000000);
-			
-			// transform vertex and calcualte bound box
-			num_surfaces = 0;
-			if(object->type == Object::OBJECT_MESH) {
-				Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
-				for(int k = 0; k < mesh->getNumSurfaces(); k++) {
-					
-					surfaces[num_surfaces].num_triangles = mesh->getNumTriangles(k);
-					if(surfaces[num_surfaces].num_triangles > NUM_TRIANGLES) continue;
-					
-					Mesh::Triangle *t = mesh->getTriangles(k);
-					Triangle *ct = surfaces[num_surfaces].triangles;
-					
-					vec3 min = vec3(1000000,1000000,1000000);	// calculate bound box
-					vec3 max = vec3(-1000000,-1000000,-1000000);
-					for(int l = 0; l < surfaces[num_surfaces].num_triangles; l++) {
-						ct[l].v[0] = transform * t[l].v[0];
-						ct[l].v[1] = transform * t[l].v[1];
-						ct[l].v[2] = transform * t[l].v[2];
-						for(int m = 0; m < 3; m++) {
-							if(min.x > ct[l].v[m].x) min.x = ct[l].v[m].x;
-							else if(max.x < ct[l].v[m].x) max.x = ct[l].v[m].x;
-							if(min.y > ct[l].v[m].y) min.y = ct[l].v[m].y;
-							else if(max.y < ct[l].v[m].y) max.y = ct[l].v[m].y;
-							if(min.z > ct[l].v[m].z) min.z = ct[l].v[m].z;
-							else if(max.z < ct[l].v[m].z) max.z = ct[l].v[m].z;
-						}
-					}
-					// bound sphere
-					surfaces[num_surfaces].center = (max + min) / 2.0f;
-					surfaces[num_surfaces].radius = (max - min).length() / 2.0f;
-					// bound box
-					surfaces[num_surfaces].min = min;
-					surfaces[num_surfaces].max = max;
-					// object bound box
-					if(object_min.x > min.x) object_min.x = min.x;
-					if(object_max.x < max.x) object_max.x = max.x;
-					if(object_min.y > min.y) object_min.y = min.y;
-					if(object_max.y < max.y) object_max.y = max.y;
-					if(object_min.z > min.z) object_min.z = min.z;
-					if(object_max.z < max.z) object_max.z = max.z;
-					
-					num_surfaces++;
-					if(num_surfaces == NUM_SURFACES) break;
-				}
+			int num_candidates = 0;
+			for(int k = 0; k < num_found; k++) {
+				if(found_masks[k] & (1 << j)) candidates[num_candidates++] = found[k];
 			}
+			qsort(candidates,num_candidates,sizeof(Object*),candidate_cmp);
 			
-			if(num_surfaces == 0) continue;
+			q->fraction = 1.0f;
+			if((q->pos1 - q->pos0).length() >= EPSILON) q->fraction = sweepObjects(q->object,q->pos0,q->pos1,q->radius,num_candidates);
 			
-			// bound box test
-			const vec3 &min = o->getMin();
-			const vec3 &max = o->getMax();
+			// no contacts outside the sectors as by the collide()
+			num_contacts = 0;
+			num_objects = 0;
+			vec3 center = q->pos0 + (q->pos1 - q->pos0) * q->fraction;
+			position = center;
+			if(Bsp::num_sectors && position.sector != -1) collideObjects(q->object,center,q->radius,num_candidates);
 			
-			if(min.x >= object_max.x) continue;
-			if(max.x <= object_min.x) continue;
-			if(min.y >= object_max.y) continue;
-			if(max.y <= object_min.y) continue;
-			if(min.z >= object_max.z) continue;
-			if(max.z <= object_min.z) continue;
-			
-			// recalculate normals and fast point and triangle
-			num_surfaces = 0;
-			if(object->type == Object::OBJECT_MESH) {
-				Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
-				for(int k = 0; k < mesh->getNumSurfaces(); k++) {
-					
-					surfaces[num_surfaces].num_triangles = mesh->getNumTriangles(k);
-					if(surfaces[num_surfaces].num_triangles > NUM_TRIANGLES) continue;
-					
-					Mesh::Triangle *t = mesh->getTriangles(k);
-					Triangle *ct = surfaces[num_surfaces].triangles;
-					
-					for(int l = 0; l < surfaces[num_surfaces].num_triangles; l++) {
-						mat4 rotate = transform.rotation();
-						vec3 normal = rotate * vec3(t[l].plane);
-						ct[l].plane = vec4(normal,-ct[l].v[0] * normal);
-						normal = rotate * vec4(t[l].c[0]);
-						ct[l].c[0] = vec4(normal,-ct[l].v[0] * normal);
-						normal = rotate * vec4(t[l].c[1]);
-						ct[l].c[1] = vec4(normal,-ct[l].v[1] * normal);
-						normal = rotate * vec4(t[l].c[2]);
-						ct[l].c[2] = vec4(normal,-ct[l].v[2] * normal);
-					}
-					
-					num_surfaces++;
-					if(num_surfaces == NUM_SURFACES) break;
-				}
+			q->first_contact = ret;
+			q->num_contacts = num_contacts;
+			for(int k = 0; k < num_contacts; k++, ret++) {
+				if(ret < num) buffer[ret] = contacts[k];
 			}
-			if(num_surfaces == 0) continue;
-			
-			// collide it
-			collideObjectMesh(o);
 		}
 	}
 	
-	return num_contacts;
+	return ret;
 }
 
-/*
- */
-void Collide::collideObjectMesh(Object *object) {
+/*****************************************************************************/
+/*                                                                           */
+/* collide with mesh                                                         */
+/*                                                                           */
+/*****************************************************************************/
+
+int Collide::collide(Object *object) {
 	
-	static int next[3] = { 1, 2, 0 };
+	num_contacts = 0;
+	num_objects = 0;
 	
-	// collide Mesh-Mesh
-	if(object->type == Object::OBJECT_MESH) {
+	if(Bsp::num_sectors == 0) return 0;
+	const Position &pos = getPosition(object);
+	if(pos.sector == -1) return 0;
+	
+	if(object->type != Object::OBJECT_MESH) {
+		fprintf(stderr,"Collide::collide(): %d format isn`t supported\n",object->type);
+		return 0;
+	}
+	
+	int shape = object->rigidbody && object->rigidbody->collide_type == RigidBody::COLLIDE_SHAPE;
+	int hull = object->rigidbody && object->rigidbody->collide_type == RigidBody::COLLIDE_HULL;
+	
+	int num_sector_pairs = 0;
+	int num_pairs = 0;
+	for(int i = 0; i < pos.num_sectors; i++) {
+		Sector *s = &Bsp::sectors[pos.sectors[i]];
+		num_sector_pairs += s->num_node_objects + s->num_objects;
+	}
+	
+	vec3 bound_min,bound_max;
+	Broadphase::getBounds(object,bound_min,bound_max);
+	int num = findObjects(bound_min,bound_max);
+	
+	// static objects
+	for(int i = 0; i < num; i++) {
+		Object *o = candidates[i];
+		if(isIdentity(o) == 0) continue;
+		if((o->getCenter() - getPos(object) - object->getCenter()).length() >= o->getRadius() + object->getRadius()) continue;
+		if(shape && collideShape(object,o)) {
+			num_pairs++;
+			continue;
+		}
+		if(hull && collideHull(object,o)) {
+			num_pairs++;
+			continue;
+		}
+		if(transformObject(object,o) == 0) continue;
+		num_pairs++;
+		collideObjectMesh(o);
+	}
+	
+	// dynamic objects
+	for(int i = 0; i < num; i++) {
 		
-		Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+		Object *o = candidates[i];
+		if(object == o || isIdentity(o)) continue;
 		
-		for(int i = 0; i < mesh->getNumSurfaces(); i++) {
-			for(int j = 0; j < num_surfaces; j++) {
-				
-				if((mesh->getCenter(i) - surfaces[j].center).length() >= mesh->getRadius(i) + surfaces[j].radius) continue;
-				
-				const vec3 &min = mesh->getMin(i);
-				const vec3 &max = mesh->getMax(i);
-				
-				if(min.x >= surfaces[j].max.x) continue;
-				if(max.x <= surfaces[j].min.x) continue;
-				if(min.y >= surfaces[j].max.y) continue;
-				if(max.y <= surfaces[j].min.y) continue;
-				if(min.z >= surfaces[j].max.z) continue;
-				if(max.z <= surfaces[j].min.z) continue;
-				
-				Mesh::Triangle *triangles = mesh->getTriangles(i);
-				Surface *s = &surfaces[j];
-				
-				int num_triangles = mesh->getNumTriangles(i);
-				for(int k = 0; k < num_triangles; k++) {
-					
-					Mesh::Triangle *t = &triangles[k];
-					
-					for(int l = 0; l < s->num_triangles; l++) {
-						
-						Triangle *ct = &s->triangles[l];
-						
-						// fast triangle-triangle intersection test
-						float dist0[3];
-						int collide0 = 0;
-						for(int m = 0; m < 3; m++) {
-							dist0[m] = ct->v[m] * t->plane;
-							if(fabs(dist0[m]) > s->radius * 2) {
-								collide0 = 3;
-								break;
-							}
-							if(dist0[m] > 0.0) collide0++;
-							else if(dist0[m] < 0.0) collide0--;
-						}
-						if(collide0 == 3 || collide0 == -3) continue;
-						
-						for(int m = 0; m < 3; m++) {
-							if(!((dist0[m] <= 0.0) ^ (dist0[next[m]] <= 0.0))) continue;
-							
-							vec3 &v0 = ct->v[m];
-							vec3 &v1 = ct->v[next[m]];
-							vec3 edge = v1 - v0;
-							vec3 p = v0 - edge * dist0[m] / (dist0[next[m]] - dist0[m]);	// intersect ct edge with t plane
-							
-							int p_inside = p * t->c[0] > 0.0 && p * t->c[1] > 0.0 && p * t->c[2] > 0.0;
-							if(!p_inside) continue;
-							
-							int v0_inside = v0 * t->c[0] > 0.0 && v0 * t->c[1] > 0.0 && v0 * t->c[2] > 0.0;
-							int v1_inside = v1 * t->c[0] > 0.0 && v1 * t->c[1] > 0.0 && v1 * t->c[2] > 0.0;
-							
-							if(v0_inside && v1_inside) {
-								float length = edge.length() / 2.0f;
-								if(dist0[m] < 0.0 && dist0[m] > -length) {
-									if(!addContact(object,object->materials[i],v0,t->plane,-dist0[m],true)) return;
-								} else if(dist0[next[m]] < 0.0 && dist0[next[m]] > -length) {
-									if(!addContact(object,object->materials[i],v1,t->plane,-dist0[next[m]],true)) return;
-								}
-							}
-							
-							if(v0_inside != v1_inside) {
-								float dist = 1000000;
-								for(int n = 0; n < 3; n++) {
-									//float d = t->v[n] * t->c[n];
-									float d = p * t->c[n];
-									if(dist > d) dist = d;
-								}
-								if(dist0[m] < 0.0) {
-									float d = (v0 - p).length();
-									if(dist > d) dist = 0;
-									else dist = -dist0[m] * dist / d;
-								} else {
-									float d = (v1 - p).length();
-									if(dist > d) dist = 0;
-									else dist = -dist0[next[m]] * dist / d;
-								}
-								if(!addContact(object,object->materials[i],p,-ct->plane,dist)) return;
-							}
+		if((getPos(o) + o->getCenter() - getPos(object) - object->getCenter()).length() >= o->getRadius() + object->getRadius()) continue;
+		
+		if(object->rigidbody && object->rigidbody->num_joints > 0 && o->rigidbody) {
+			RigidBody *rb = object->rigidbody;
+			int j;
+			for(j = 0; j < rb->num_joints; j++) {
+				if(rb->joined_rigidbodies[j] == o->rigidbody) break;
+			}
+			if(j != rb->num_joints) continue;
+		}
+		
+		if(shape && collideShape(object,o)) {
+			num_pairs++;
+			continue;
+		}
+		if(hull && collideHull(object,o)) {
+			num_pairs++;
+			continue;
+		}
+		
+		if(transformObject(object,o) == 0) continue;
+		
+		// collide it
+		num_pairs++;
+		collideObjectMesh(o);
+	}
+	
+	Broadphase::addCounters(num_sector_pairs,num_pairs);
+	
+	return num_contacts;
+}
+
+/* bound box of the transformed box
+ */
+static void transform_box(const mat4 &m,const vec3 &min,const vec3 &max,vec3 &ret_min,vec3 &ret_max) {
+	vec3 center = m * ((min + max) / 2.0f);
+	vec3 size = (max - min) / 2.0f;
+	vec3 radius;
+	for(int i = 0; i < 3; i++) {
+		radius[i] = fabs(m[i]) * size.x + fabs(m[i + 4]) * size.y + fabs(m[i + 8]) * size.z;
+	}
+	ret_min = center - radius;
+	ret_max = center + radius;
+}
+
+/* copy the triangles of the object which are near the other object
+ * into the collide surfaces in the space of the other object
+ * only triangles from the bvh leaves overlapped with the other object are transformed
+ */
+int Collide::transformObject(Object *object,Object *other) {
+	
+	num_surfaces = 0;
+	
+	Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+	
+	// object space into other object space and back
+	mat4 transform,itransform;
+	if(isIdentity(other)) {
+		transform = getTransform(object);
+		itransform = getITransform(object);
+	} else {
+		transform = getITransform(other) * getTransform(object);
+		itransform = getITransform(object) * getTransform(other);
+	}
+	mat4 rotate = transform.rotation();
+	
+	// other object bound box in the object space
+	vec3 other_min,other_max;
+	transform_box(itransform,other->getMin(),other->getMax(),other_min,other_max);
+	
+	if(all_surfaces < mesh->getNumSurfaces()) {
+		Surface *old_surfaces = surfaces;
+		surfaces = new Surface[mesh->getNumSurfaces()];
+		for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+			if(i < all_surfaces) surfaces[i] = old_surfaces[i];
+			else {
+				surfaces[i].all_triangles = 0;
+				surfaces[i].triangles = NULL;
+			}
+		}
+		delete [] old_surfaces;
+		all_surfaces = mesh->getNumSurfaces();
+	}
+	
+	for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+		
+		if(mesh->getNumNodes(i) == 0) continue;
+		
+		Surface *s = &surfaces[num_surfaces];
+		if(s->all_triangles < mesh->getNumTriangles(i)) {
+			delete [] s->triangles;
+			s->all_triangles = mesh->getNumTriangles(i);
+			s->triangles = new Triangle[s->all_triangles];
+		}
+		s->num_triangles = 0;
+		
+		Mesh::Triangle *triangles = mesh->getTriangles(i);
+		Mesh::BVHNode *nodes = mesh->getNodes(i);
+		
+		vec3 min = vec3(1000000,1000000,1000000);	// calculate bound box
+		vec3 max = vec3(-1000000,-1000000,-1000000);
+		
+		int stack[Mesh::NUM_BVH_STACK];
+		int num_stack = 0;
+		stack[num_stack++] = 0;
+		while(num_stack) {
+			int id = stack[--num_stack];
+			Mesh::BVHNode *node = &nodes[id];
+			if(node->min.x > other_max.x || node->max.x < other_min.x) continue;
+			if(node->min.y > other_max.y || node->max.y < other_min.y) continue;
+			if(node->min.z > other_max.z || node->max.z < other_min.z) continue;
+			if(node->num_triangles == 0) {
+				stack[num_stack++] = node->right;
+				stack[num_stack++] = id + 1;
+				continue;
+			}
+			for(int j = node->first; j < node->first + node->num_triangles; j++) {
+				Mesh::Triangle *t = &triangles[j];
+				Triangle *ct = &s->triangles[s->num_triangles++];
+				ct->v[0] = transform * t->v[0];
+				ct->v[1] = transform * t->v[1];
+				ct->v[2] = transform * t->v[2];
+				vec3 normal = rotate * vec3(t->plane);
+				ct->plane = vec4(normal,-ct->v[0] * normal);
+				normal = rotate * vec3(t->c[0]);
+				ct->c[0] = vec4(normal,-ct->v[0] * normal);
+				normal = rotate * vec3(t->c[1]);
+				ct->c[1] = vec4(normal,-ct->v[1] * normal);
+				normal = rotate * vec3(t->c[2]);
+				ct->c[2] = vec4(normal,-ct->v[2] * normal);
+				for(int k = 0; k < 3; k++) {
+					if(min.x > ct->v[k].x) min.x = ct->v[k].x;
+					if(max.x < ct->v[k].x) max.x = ct->v[k].x;
+					if(min.y > ct->v[k].y) min.y = ct->v[k].y;
+					if(max.y < ct->v[k].y) max.y = ct->v[k].y;
+					if(min.z > ct->v[k].z) min.z = ct->v[k].z;
+					if(max.z < ct->v[k].z) max.z = ct->v[k].z;
+				}
+			}
+		}
+		if(s->num_triangles == 0) continue;
+		
+		// bound sphere
+		s->center = (max + min) / 2.0f;
+		s->radius = (max - min).length() / 2.0f;
+		// bound box
+		s->min = min;
+		s->max = max;
+		
+		// new surface
+		num_surfaces++;
+	}
+	
+	return num_surfaces;
+}
+
+/*
+ */
+void Collide::collideObjectMesh(Object *object) {
+	
+	static int next[3] = { 1, 2, 0 };
+	
+	// collide Mesh-Mesh
+	if(object->type == Object::OBJECT_MESH) {
+		
+		Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+		
+		for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+			for(int j = 0; j < num_surfaces; j++) {
+				
+				if((mesh->getCenter(i) - surfaces[j].center).length() >= mesh->getRadius(i) + surfaces[j].radius) continue;
+				
+				const vec3 &min = mesh->getMin(i);
+				const vec3 &max = mesh->getMax(i);
+				
+				if(min.x >= surfaces[j].max.x) continue;
+				if(max.x <= surfaces[j].min.x) continue;
+				if(min.y >= surfaces[j].max.y) continue;
+				if(max.y <= surfaces[j].min.y) continue;
+				if(min.z >= surfaces[j].max.z) continue;
+				if(max.z <= surfaces[j].min.z) continue;
+				
+				Mesh::Triangle *triangles = mesh->getTriangles(i);
+				Mesh::BVHNode *nodes = mesh->getNodes(i);
+				Mesh::TrianglePack *packs = mesh->getPacks(i);
+				Surface *s = &surfaces[j];
+				
+				if(mesh->getNumNodes(i) == 0) continue;
+				
+				for(int l = 0; l < s->num_triangles; l++) {
+					
+					Triangle *ct = &s->triangles[l];
+					
+					// triangle bound box
+					vec3 ct_min = ct->v[0];
+					vec3 ct_max = ct->v[0];
+					for(int m = 1; m < 3; m++) {
+						if(ct_min.x > ct->v[m].x) ct_min.x = ct->v[m].x;
+						if(ct_max.x < ct->v[m].x) ct_max.x = ct->v[m].x;
+						if(ct_min.y > ct->v[m].y) ct_min.y = ct->v[m].y;
+						if(ct_max.y < ct->v[m].y) ct_max.y = ct->v[m].y;
+						if(ct_min.z > ct->v[m].z) ct_min.z = ct->v[m].z;
+						if(ct_max.z < ct->v[m].z) ct_max.z = ct->v[m].z;
+					}
+					
+					// only the triangles from the overlapped bvh leaves
+					int stack[Mesh::NUM_BVH_STACK];
+					int num_stack = 0;
+					stack[num_stack++] = 0;
+					while(num_stack) {
+						int id = stack[--num_stack];
+						Mesh::BVHNode *node = &nodes[id];
+						if(node->min.x > ct_max.x || node->max.x < ct_min.x) continue;
+						if(node->min.y > ct_max.y || node->max.y < ct_min.y) continue;
+						if(node->min.z > ct_max.z || node->max.z < ct_min.z) continue;
+						if(node->num_triangles == 0) {
+							stack[num_stack++] = node->right;
+							stack[num_stack++] = id + 1;
+							continue;
 						}
 						
-						// collide with scene
-						if(!object->rigidbody) {
+						int mask = simd ? triangle_pack(&packs[node->right],ct->v,s->radius) : 0xf;
+						
+						for(int k = node->first; k < node->first + node->num_triangles; k++) {
+							if((mask & (1 << (k - node->first))) == 0) continue;
+							
+							Mesh::Triangle *t = &triangles[k];
 							
-							float dist1[3];
-							int collide1 = 0;
+							// fast triangle-triangle intersection test
+							float dist0[3];
+							int collide0 = 0;
 							for(int m = 0; m < 3; m++) {
-								dist1[m] = t->v[m] * ct->plane;
-								if(dist1[m] > 0.0) collide1++;
-								else if(dist1[m] < 0.0) collide1--;
+								dist0[m] = ct->v[m] * t->plane;
+								if(fabs(dist0[m]) > s->radius * 2) {
+									collide0 = 3;
+									break;
+								}
+								if(dist0[m] > 0.0) collide0++;
+								else if(dist0[m] < 0.0) collide0--;
 							}
-							if(collide1 == 3 || collide1 == -3) continue;
-						
+							if(collide0 == 3 || collide0 == -3) continue;
+							
 							for(int m = 0; m < 3; m++) {
-								if(dist1[m] >= 0) continue;
-								if(dist1[next[m]] <= 0) continue;
-
-								vec3 &v0 = t->v[m];
-								vec3 &v1 = t->v[next[m]];
+								if(!((dist0[m] <= 0.0) ^ (dist0[next[m]] <= 0.0))) continue;
+								
+								vec3 &v0 = ct->v[m];
+								vec3 &v1 = ct->v[next[m]];
 								vec3 edge = v1 - v0;
-								vec3 p = v0 - edge * dist1[m] / (dist1[next[m]] - dist1[m]);	// intersect ct edge with t plane
+								vec3 p = v0 - edge * dist0[m] / (dist0[next[m]] - dist0[m]);	// intersect ct edge with t plane
 								
-								int p_inside = p * ct->c[0] > 0.0 && p * ct->c[1] > 0.0 && p * ct->c[2] > 0.0;
+								int p_inside = p * t->c[0] > 0.0 && p * t->c[1] > 0.0 && p * t->c[2] > 0.0;
 								if(!p_inside) continue;
 								
-								int v0_inside = v0 * ct->c[0] > 0.0 && v0 * ct->c[1] > 0.0 && v0 * ct->c[2] > 0.0;
-								int v1_inside = v1 * ct->c[0] > 0.0 && v1 * ct->c[1] > 0.0 && v1 * ct->c[2] > 0.0;
+								int v0_inside = v0 * t->c[0] > 0.0 && v0 * t->c[1] > 0.0 && v0 * t->c[2] > 0.0;
+								int v1_inside = v1 * t->c[0] > 0.0 && v1 * t->c[1] > 0.0 && v1 * t->c[2] > 0.0;
+								
+								if(v0_inside && v1_inside) {
+									float length = edge.length() / 2.0f;
+									if(dist0[m] < 0.0 && dist0[m] > -length) {
+										if(!addContact(object,object->materials[i],v0,t->plane,-dist0[m],true)) return;
+									} else if(dist0[next[m]] < 0.0 && dist0[next[m]] > -length) {
+										if(!addContact(object,object->materials[i],v1,t->plane,-dist0[next[m]],true)) return;
+									}
+								}
 								
 								if(v0_inside != v1_inside) {
 									float dist = 1000000;
 									for(int n = 0; n < 3; n++) {
-										float d = p * ct->c[n];
+										//float d = t->v[n] * t->c[n];
+										float d = p * t->c[n];
 										if(dist > d) dist = d;
 									}
-									float d = (v0 - p).length();
-									if(dist > d) dist = 0;
-									else dist = -dist1[m] * dist / d;
-									if(!addContact(object,object->materials[i],p,t->plane,dist)) return;
+									if(dist0[m] < 0.0) {
+										float d = (v0 - p).length();
+										if(dist > d) dist = 0;
+										else dist = -dist0[m] * dist / d;
+									} else {
+										float d = (v1 - p).length();
+										if(dist > d) dist = 0;
+										else dist = -dist0[next[m]] * dist / d;
+									}
+									if(!addContact(object,object->materials[i],p,-ct->plane,dist)) return;
+								}
+							}
+							
+							// collide with scene
+							if(!object->rigidbody) {
+								
+								float dist1[3];
+								int collide1 = 0;
+								for(int m = 0; m < 3; m++) {
+									dist1[m] = t->v[m] * ct->plane;
+									if(dist1[m] > 0.0) collide1++;
+									else if(dist1[m] < 0.0) collide1--;
+								}
+								if(collide1 == 3 || collide1 == -3) continue;
+								
+								for(int m = 0; m < 3; m++) {
+									if(dist1[m] >= 0) continue;
+									if(dist1[next[m]] <= 0) continue;
+									
+									vec3 &v0 = t->v[m];
+									vec3 &v1 = t->v[next[m]];
+									vec3 edge = v1 - v0;
+									vec3 p = v0 - edge * dist1[m] / (dist1[next[m]] - dist1[m]);	// intersect ct edge with t plane
+									
+									int p_inside = p * ct->c[0] > 0.0 && p * ct->c[1] > 0.0 && p * ct->c[2] > 0.0;
+									if(!p_inside) continue;
+									
+									int v0_inside = v0 * ct->c[0] > 0.0 && v0 * ct->c[1] > 0.0 && v0 * ct->c[2] > 0.0;
+									int v1_inside = v1 * ct->c[0] > 0.0 && v1 * ct->c[1] > 0.0 && v1 * ct->c[2] > 0.0;
+									
+									if(v0_inside != v1_inside) {
+										float dist = 1000000;
+										for(int n = 0; n < 3; n++) {
+											float d = p * ct->c[n];
+											if(dist > d) dist = d;
+										}
+										float d = (v0 - p).length();
+										if(dist > d) dist = 0;
+										else dist = -dist1[m] * dist / d;
+										if(!addContact(object,object->materials[i],p,t->plane,dist)) return;
+									}
 								}
 							}
 						}
@@ -654,17 +1144,1238 @@ void Collide::collideObjectMesh(Object *object) {
 	}
 }
 
+/*****************************************************************************/
+/*                                                                           */
+/* collide with shapes                                                       */
+/*                                                                           */
+/*****************************************************************************/
+
+/* points on the rim of the cylinder cap
+ */
+#define NUM_CYLINDER_POINTS	8
+
+static inline float clamp_unit(float v) {
+	if(v < 0.0f) return 0.0f;
+	if(v > 1.0f) return 1.0f;
+	return v;
+}
+
+/* closest point of the segment
+ */
+static vec3 segment_point(const vec3 &p,const vec3 &p0,const vec3 &p1) {
+	vec3 d = p1 - p0;
+	float length = d * d;
+	if(length < EPSILON) return p0;
+	return p0 + d * clamp_unit((p - p0) * d / length);
+}
+
+/* closest points of two segments
+ */
+static void segment_closest(const vec3 &p0,const vec3 &p1,const vec3 &q0,const vec3 &q1,vec3 &p,vec3 &q) {
+	vec3 d0 = p1 - p0;
+	vec3 d1 = q1 - q0;
+	vec3 r = p0 - q0;
+	float a = d0 * d0;
+	float e = d1 * d1;
+	float f = d1 * r;
+	float s = 0.0f;
+	float t = 0.0f;
+	if(a > EPSILON && e > EPSILON) {
+		float b = d0 * d1;
+		float c = d0 * r;
+		float denom = a * e - b * b;
+		if(denom > EPSILON) s = clamp_unit((b * f - c * e) / denom);
+		t = (b * s + f) / e;
+		if(t < 0.0f) {
+			t = 0.0f;
+			s = clamp_unit(-c / a);
+		} else if(t > 1.0f) {
+			t = 1.0f;
+			s = clamp_unit((b - c) / a);
+		}
+	} else if(a > EPSILON) {
+		s = clamp_unit(-(d0 * r) / a);
+	} else if(e > EPSILON) {
+		t = clamp_unit(f / e);
+	}
+	p = p0 + d0 * s;
+	q = q0 + d1 * t;
+}
+
+/* vertexes of the box
+ */
+static void box_vertexes(const vec3 &center,const vec3 *axis,const vec3 &size,vec3 *v) {
+	for(int i = 0; i < 8; i++) {
+		v[i] = center;
+		v[i] += axis[0] * (i & 1 ? size.x : -size.x);
+		v[i] += axis[1] * (i & 2 ? size.y : -size.y);
+		v[i] += axis[2] * (i & 4 ? size.z : -size.z);
+	}
+}
+
+/* half size of the box along the direction
+ */
+static inline float box_radius(const vec3 *axis,const vec3 &size,const vec3 &dir) {
+	return fabs(axis[0] * dir) * size.x + fabs(axis[1] * dir) * size.y + fabs(axis[2] * dir) * size.z;
+}
+
+/* closest point of the box
+ */
+static vec3 box_closest(const vec3 &p,const vec3 &center,const vec3 *axis,const vec3 &size) {
+	vec3 d = p - center;
+	vec3 ret = center;
+	for(int i = 0; i < 3; i++) {
+		float dist = d * axis[i];
+		if(dist > size[i]) dist = size[i];
+		else if(dist < -size[i]) dist = -size[i];
+		ret += axis[i] * dist;
+	}
+	return ret;
+}
+
+static int box_inside(const vec3 &p,const vec3 &center,const vec3 *axis,const vec3 &size) {
+	vec3 d = p - center;
+	for(int i = 0; i < 3; i++) {
+		if(fabs(d * axis[i]) >= size[i]) return 0;
+	}
+	return 1;
+}
+
+/* nearest face of the box from the inside point
+ */
+static float box_face(const vec3 &p,const vec3 &center,const vec3 *axis,const vec3 &size,vec3 &normal) {
+	vec3 d = p - center;
+	float depth = 1000000.0f;
+	for(int i = 0; i < 3; i++) {
+		float dist = d * axis[i];
+		float face = size[i] - fabs(dist);
+		if(depth > face) {
+			depth = face;
+			normal = dist > 0.0f ? axis[i] : -axis[i];
+		}
+	}
+	return depth;
+}
+
+/* separating axis test of the box and the points
+ * the minimal overlap is kept in the normal directed from the points to the box
+ * returns 0 for the separating axis and 2 for the new minimal overlap
+ */
+static int box_overlap(vec3 dir,const vec3 &center,const vec3 *axis,const vec3 &size,const vec3 *v,int num,vec3 &normal,float &depth) {
+	if(dir.normalize() < 0.001f) return 1;	// parallel edges
+	float c = center * dir;
+	float r = box_radius(axis,size,dir);
+	float min = v[0] * dir;
+	float max = min;
+	for(int i = 1; i < num; i++) {
+		float d = v[i] * dir;
+		if(min > d) min = d;
+		else if(max < d) max = d;
+	}
+	float d0 = max - (c - r);
+	float d1 = (c + r) - min;
+	if(d0 <= 0.0f || d1 <= 0.0f) return 0;
+	if(d0 < d1) {
+		if(depth <= d0) return 1;
+		depth = d0;
+		normal = dir;
+	} else {
+		if(depth <= d1) return 1;
+		depth = d1;
+		normal = -dir;
+	}
+	return 2;
+}
+
+/* shape of the rigidbody in the space given by the transform
+ */
+void Collide::getShape(Object *object,const mat4 &transform,Shape &shape) {
+	RigidBody *rb = object->rigidbody;
+	shape.type = rb->body_type;
+	shape.center = transform * rb->body_center;
+	shape.axis[0] = vec3(transform[0],transform[1],transform[2]);
+	shape.axis[1] = vec3(transform[4],transform[5],transform[6]);
+	shape.axis[2] = vec3(transform[8],transform[9],transform[10]);
+	shape.size = rb->body_size;
+}
+
+/* core segment of the sphere and the capsule
+ */
+void Collide::getSegment(const Shape &shape,vec3 &p0,vec3 &p1) {
+	float height = shape.type == RigidBody::BODY_CAPSULE ? shape.size.z : 0.0f;
+	p0 = shape.center - shape.axis[2] * height;
+	p1 = shape.center + shape.axis[2] * height;
+}
+
+/* the rigidbody shape against the other object in the space of the other object
+ * returns 0 if the pair is collided by the meshes
+ */
+int Collide::collideShape(Object *object,Object *other) {
+	
+	if(other->type != Object::OBJECT_MESH) return 0;
+	
+	Shape shape;
+	if(isIdentity(other)) getShape(object,getTransform(object),shape);
+	else getShape(object,getITransform(other) * getTransform(object),shape);
+	
+	// shape against the triangles
+	RigidBody *rb = other->rigidbody;
+	if(rb == NULL || rb->collide_type == RigidBody::COLLIDE_MESH) {
+		collideShapeMesh(other,shape);
+		return 1;
+	}
+	
+	if(shape.type == RigidBody::BODY_CYLINDER) return 0;
+	
+	// shape against the sphere
+	if(rb->collide_type == RigidBody::COLLIDE_SPHERE) {
+		collideShapeSphere(other,shape,vec3(0,0,0),other->getRadius());
+		return 1;
+	}
+	
+	// shape against the hull as the hull against the shape, the normals are turned to the shape
+	if(rb->collide_type == RigidBody::COLLIDE_HULL) {
+		transformHull(other,mat4());
+		int num = num_contacts;
+		collideHullShape(other,shape);
+		for(int i = num; i < num_contacts; i++) contacts[i].normal = -contacts[i].normal;
+		return 1;
+	}
+	
+	Shape other_shape;
+	getShape(other,mat4(),other_shape);
+	if(other_shape.type == RigidBody::BODY_CYLINDER) return 0;
+	
+	if(shape.type == RigidBody::BODY_BOX && other_shape.type == RigidBody::BODY_BOX) {
+		collideBoxBox(other,shape,other_shape);
+		return 1;
+	}
+	
+	// ends of the capsules, the closest points if the ends don`t touch
+	int num = num_contacts;
+	vec3 p0,p1,q0,q1;
+	if(other_shape.type == RigidBody::BODY_BOX) {
+		getSegment(shape,p0,p1);
+		collideSphereBox(other,p0,shape.size.x,other_shape);
+		if(shape.type == RigidBody::BODY_CAPSULE) {
+			collideSphereBox(other,p1,shape.size.x,other_shape);
+			if(num == num_contacts) collideSphereBox(other,segment_point(other_shape.center,p0,p1),shape.size.x,other_shape);
+		}
+	} else if(shape.type == RigidBody::BODY_BOX) {
+		getSegment(other_shape,q0,q1);
+		collideBoxSphere(other,shape,q0,other_shape.size.x);
+		if(other_shape.type == RigidBody::BODY_CAPSULE) {
+			collideBoxSphere(other,shape,q1,other_shape.size.x);
+			if(num == num_contacts) collideBoxSphere(other,shape,segment_point(shape.center,q0,q1),other_shape.size.x);
+		}
+	} else {
+		getSegment(shape,p0,p1);
+		getSegment(other_shape,q0,q1);
+		collideSphereSphere(other,p0,shape.size.x,segment_point(p0,q0,q1),other_shape.size.x);
+		if(shape.type == RigidBody::BODY_CAPSULE) {
+			collideSphereSphere(other,p1,shape.size.x,segment_point(p1,q0,q1),other_shape.size.x);
+		}
+		if(num == num_contacts) {
+			vec3 p,q;
+			segment_closest(p0,p1,q0,q1,p,q);
+			collideSphereSphere(other,p,shape.size.x,q,other_shape.size.x);
+		}
+	}
+	
+	return 1;
+}
+
+/* the sphere against the shape of the object
+ */
+void Collide::collideSphereShape(Object *object,const vec3 &pos,float radius,const Shape &shape) {
+	if(shape.type == RigidBody::BODY_BOX) {
+		collideSphereBox(object,pos,radius,shape);
+	} else {
+		vec3 p0,p1;
+		getSegment(shape,p0,p1);
+		collideSphereSphere(object,pos,radius,segment_point(pos,p0,p1),shape.size.x);
+	}
+}
+
+/* the shape against the sphere of the object
+ */
+void Collide::collideShapeSphere(Object *object,const Shape &shape,const vec3 &pos,float radius) {
+	if(shape.type == RigidBody::BODY_BOX) {
+		collideBoxSphere(object,shape,pos,radius);
+	} else {
+		vec3 p0,p1;
+		getSegment(shape,p0,p1);
+		collideSphereSphere(object,segment_point(pos,p0,p1),shape.size.x,pos,radius);
+	}
+}
+
+/*
+ */
+void Collide::collideSphereSphere(Object *object,const vec3 &pos0,float radius0,const vec3 &pos1,float radius1) {
+	vec3 normal = pos0 - pos1;
+	float length = normal.length();
+	if(length >= radius0 + radius1) return;
+	if(length > EPSILON) normal /= length;
+	else normal = vec3(0,0,1);
+	addContact(object,NULL,pos0 - normal * radius0,normal,radius0 + radius1 - length);
+}
+
+void Collide::collideSphereBox(Object *object,const vec3 &pos,float radius,const Shape &box) {
+	vec3 normal = pos - box_closest(pos,box.center,box.axis,box.size);
+	float length = normal.length();
+	if(length >= radius) return;
+	if(length > EPSILON) {
+		normal /= length;
+		addContact(object,NULL,pos - normal * radius,normal,radius - length);
+	} else {	// the center is inside
+		float depth = box_face(pos,box.center,box.axis,box.size,normal);
+		addContact(object,NULL,pos - normal * radius,normal,radius + depth);
+	}
+}
+
+void Collide::collideBoxSphere(Object *object,const Shape &box,const vec3 &pos,float radius) {
+	vec3 point = box_closest(pos,box.center,box.axis,box.size);
+	vec3 normal = point - pos;
+	float length = normal.length();
+	if(length >= radius) return;
+	if(length > EPSILON) {
+		normal /= length;
+		addContact(object,NULL,point,normal,radius - length);
+	} else {	// the center is inside
+		float depth = box_face(pos,box.center,box.axis,box.size,normal);
+		addContact(object,NULL,pos,-normal,radius + depth);
+	}
+}
+
+/* separating axis test gives the normal of all contacts
+ * vertexes inside the other box or the closest points of the edges
+ */
+void Collide::collideBoxBox(Object *object,const Shape &box0,const Shape &box1) {
+	
+	vec3 v0[8],v1[8];
+	box_vertexes(box0.center,box0.axis,box0.size,v0);
+	box_vertexes(box1.center,box1.axis,box1.size,v1);
+	
+	// the normal is directed from the box1 to the box0
+	vec3 normal;
+	float depth = 1000000.0f;
+	int edge = -1;
+	for(int i = 0; i < 3; i++) {
+		if(box_overlap(box0.axis[i],box0.center,box0.axis,box0.size,v1,8,normal,depth) == 0) return;
+	}
+	for(int i = 0; i < 3; i++) {
+		if(box_overlap(box1.axis[i],box0.center,box0.axis,box0.size,v1,8,normal,depth) == 0) return;
+	}
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 3; j++) {
+			int ret = box_overlap(cross(box0.axis[i],box1.axis[j]),box0.center,box0.axis,box0.size,v1,8,normal,depth);
+			if(ret == 0) return;
+			if(ret == 2) edge = i * 3 + j;
+		}
+	}
+	
+	int num = num_contacts;
+	
+	float max1 = box1.center * normal + box_radius(box1.axis,box1.size,normal);
+	for(int i = 0; i < 8; i++) {
+		if(box_inside(v0[i],box1.center,box1.axis,box1.size) == 0) continue;
+		if(!addContact(object,NULL,v0[i],normal,max1 - v0[i] * normal)) return;
+	}
+	
+	float min0 = box0.center * normal - box_radius(box0.axis,box0.size,normal);
+	for(int i = 0; i < 8; i++) {
+		if(box_inside(v1[i],box0.center,box0.axis,box0.size) == 0) continue;
+		if(!addContact(object,NULL,v1[i],normal,v1[i] * normal - min0)) return;
+	}
+	
+	// edge against edge
+	if(num == num_contacts && edge != -1) {
+		int i = edge / 3;
+		int j = edge % 3;
+		vec3 p0 = box0.center;
+		vec3 p1 = box1.center;
+		for(int k = 0; k < 3; k++) {
+			if(k != i) p0 -= box0.axis[k] * (box0.axis[k] * normal > 0.0f ? box0.size[k] : -box0.size[k]);
+			if(k != j) p1 += box1.axis[k] * (box1.axis[k] * normal > 0.0f ? box1.size[k] : -box1.size[k]);
+		}
+		vec3 p,q;
+		segment_closest(p0 - box0.axis[i] * box0.size[i],p0 + box0.axis[i] * box0.size[i],
+			p1 - box1.axis[j] * box1.size[j],p1 + box1.axis[j] * box1.size[j],p,q);
+		addContact(object,NULL,p,normal,depth);
+	}
+}
+
+/* the shape against the triangles of the object
+ */
+void Collide::collideShapeMesh(Object *object,const Shape &shape) {
+	
+	// bound box and sphere of the shape
+	vec3 size;
+	float radius;
+	if(shape.type == RigidBody::BODY_BOX) {
+		for(int i = 0; i < 3; i++) {
+			size[i] = fabs(shape.axis[0][i]) * shape.size.x + fabs(shape.axis[1][i]) * shape.size.y + fabs(shape.axis[2][i]) * shape.size.z;
+		}
+		radius = shape.size.length();
+	} else if(shape.type == RigidBody::BODY_SPHERE) {
+		size = shape.size;
+		radius = shape.size.x;
+	} else {
+		for(int i = 0; i < 3; i++) {
+			size[i] = fabs(shape.axis[2][i]) * shape.size.z + shape.size.x;
+		}
+		if(shape.type == RigidBody::BODY_CAPSULE) radius = shape.size.z + shape.size.x;
+		else radius = sqrt(shape.size.x * shape.size.x + shape.size.z * shape.size.z);
+	}
+	vec3 min = shape.center - size;
+	vec3 max = shape.center + size;
+	
+	Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+	
+	for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+		if((mesh->getCenter(i) - shape.center).length() > mesh->getRadius(i) + radius) continue;
+		
+		if(mesh->getNumNodes(i) == 0) continue;
+		
+		Mesh::Triangle *triangles = mesh->getTriangles(i);
+		Mesh::BVHNode *nodes = mesh->getNodes(i);
+		
+		// only the triangles from the overlapped bvh leaves
+		int stack[Mesh::NUM_BVH_STACK];
+		int num_stack = 0;
+		stack[num_stack++] = 0;
+		while(num_stack) {
+			int id = stack[--num_stack];
+			Mesh::BVHNode *node = &nodes[id];
+			if(node->min.x > max.x || node->max.x < min.x) continue;
+			if(node->min.y > max.y || node->max.y < min.y) continue;
+			if(node->min.z > max.z || node->max.z < min.z) continue;
+			if(node->num_triangles == 0) {
+				stack[num_stack++] = node->right;
+				stack[num_stack++] = id + 1;
+				continue;
+			}
+			for(int j = node->first; j < node->first + node->num_triangles; j++) {
+				Mesh::Triangle *t = &triangles[j];
+				
+				// the center is over the triangle
+				float dist = vec4(shape.center,1) * t->plane;
+				if(dist >= radius || dist < 0) continue;
+				
+				collideShapeTriangle(object,object->materials[i],shape,t->v,t->plane,t->c);
+				if(max_contacts && num_contacts >= max_contacts) return;
+			}
+		}
+	}
+}
+
+/*
+ */
+void Collide::collideShapeTriangle(Object *object,Material *material,const Shape &shape,const vec3 *v,const vec4 &plane,const vec4 *c) {
+	
+	static int next[3] = { 1, 2, 0 };
+	
+	vec3 normal = vec3(plane);
+	
+	// collide box-triangle
+	if(shape.type == RigidBody::BODY_BOX) {
+		
+		// separating axes, the normal is directed from the triangle to the box
+		vec3 axis;
+		float depth = 1000000.0f;
+		int edge = -1;
+		if(box_overlap(normal,shape.center,shape.axis,shape.size,v,3,axis,depth) == 0) return;
+		for(int i = 0; i < 3; i++) {
+			if(box_overlap(shape.axis[i],shape.center,shape.axis,shape.size,v,3,axis,depth) == 0) return;
+		}
+		for(int i = 0; i < 3; i++) {
+			for(int j = 0; j < 3; j++) {
+				int ret = box_overlap(cross(shape.axis[i],v[next[j]] - v[j]),shape.center,shape.axis,shape.size,v,3,axis,depth);
+				if(ret == 0) return;
+				if(ret == 2) edge = i * 3 + j;
+			}
+		}
+		
+		int num = num_contacts;
+		
+		// vertexes of the box under the triangle
+		vec3 vertex[8];
+		box_vertexes(shape.center,shape.axis,shape.size,vertex);
+		for(int i = 0; i < 8; i++) {
+			float dist = vec4(vertex[i],1) * plane;
+			if(dist >= 0.0f) continue;
+			if(vertex[i] * c[0] < 0.0f || vertex[i] * c[1] < 0.0f || vertex[i] * c[2] < 0.0f) continue;
+			if(!addContact(object,material,vertex[i],normal,-dist)) return;
+		}
+		
+		// vertexes of the triangle inside the box
+		if(axis * normal > 0.0f) {
+			float min = shape.center * axis - box_radius(shape.axis,shape.size,axis);
+			for(int i = 0; i < 3; i++) {
+				if(box_inside(v[i],shape.center,shape.axis,shape.size) == 0) continue;
+				if(!addContact(object,material,v[i],axis,v[i] * axis - min)) return;
+			}
+		}
+		
+		// edge against edge
+		if(num == num_contacts && edge != -1) {
+			int i = edge / 3;
+			int j = edge % 3;
+			vec3 p = shape.center;
+			for(int k = 0; k < 3; k++) {
+				if(k != i) p -= shape.axis[k] * (shape.axis[k] * axis > 0.0f ? shape.size[k] : -shape.size[k]);
+			}
+			vec3 p0,p1;
+			segment_closest(p - shape.axis[i] * shape.size[i],p + shape.axis[i] * shape.size[i],v[j],v[next[j]],p0,p1);
+			addContact(object,material,p0,axis,depth);
+		}
+		return;
+	}
+	
+	// collide cylinder-triangle
+	if(shape.type == RigidBody::BODY_CYLINDER) {
+		
+		// points of the cap rims under the triangle
+		for(int i = 0; i < 2; i++) {
+			vec3 center = shape.center + shape.axis[2] * (i ? shape.size.z : -shape.size.z);
+			for(int j = 0; j < NUM_CYLINDER_POINTS; j++) {
+				float angle = PI * 2.0f * j / NUM_CYLINDER_POINTS;
+				vec3 p = center + (shape.axis[0] * cos(angle) + shape.axis[1] * sin(angle)) * shape.size.x;
+				float dist = vec4(p,1) * plane;
+				if(dist >= 0.0f) continue;
+				if(p * c[0] < 0.0f || p * c[1] < 0.0f || p * c[2] < 0.0f) continue;
+				if(!addContact(object,material,p,normal,-dist)) return;
+			}
+		}
+		
+		// vertexes of the triangle inside the cylinder
+		for(int i = 0; i < 3; i++) {
+			vec3 d = v[i] - shape.center;
+			float z = d * shape.axis[2];
+			vec3 r = d - shape.axis[2] * z;
+			float length = r.length();
+			float side = shape.size.x - length;
+			float cap = shape.size.z - fabs(z);
+			if(side <= 0.0f || cap <= 0.0f) continue;
+			vec3 n;
+			float depth;
+			if(cap < side || length < EPSILON) {
+				n = z > 0.0f ? -shape.axis[2] : shape.axis[2];
+				depth = cap;
+			} else {
+				n = -r / length;
+				depth = side;
+			}
+			if(n * normal <= 0.0f) continue;
+			if(!addContact(object,material,v[i],n,depth)) return;
+		}
+		return;
+	}
+	
+	// collide sphere-triangle and capsule-triangle
+	float radius = shape.size.x;
+	vec3 p0,p1;
+	getSegment(shape,p0,p1);
+	
+	int num = num_contacts;
+	
+	// ends of the capsule
+	for(int i = 0; i < (shape.type == RigidBody::BODY_CAPSULE ? 2 : 1); i++) {
+		const vec3 &p = i ? p1 : p0;
+		float dist = vec4(p,1) * plane;
+		if(dist >= radius) continue;
+		if(p * c[0] >= 0.0f && p * c[1] >= 0.0f && p * c[2] >= 0.0f) {
+			if(!addContact(object,material,p - normal * radius,normal,radius - dist)) return;
+			continue;
+		}
+		if(dist <= 0.0f) continue;
+		vec3 n = p - triangle_closest(p,v[0],v[1],v[2]);
+		float length = n.length();
+		if(length >= radius || length < EPSILON) continue;
+		n /= length;
+		if(!addContact(object,material,p - n * radius,n,radius - length)) return;
+	}
+	
+	// the middle of the capsule across the edge
+	if(num == num_contacts && shape.type == RigidBody::BODY_CAPSULE) {
+		float distance = radius;
+		vec3 point,n;
+		for(int i = 0; i < 3; i++) {
+			vec3 p,q;
+			segment_closest(p0,p1,v[i],v[next[i]],p,q);
+			if(vec4(p,1) * plane <= 0.0f) continue;
+			vec3 d = p - q;
+			float length = d.length();
+			if(length >= distance || length < EPSILON) continue;
+			distance = length;
+			point = p;
+			n = d / length;
+		}
+		if(distance < radius) addContact(object,material,point - n * radius,n,radius - distance);
+	}
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* collide with hulls                                                        */
+/*                                                                           */
+/*****************************************************************************/
+
+#define NUM_GJK_ITERATIONS	32
+#define NUM_EPA_ITERATIONS	32
+#define NUM_EPA_POINTS		(NUM_EPA_ITERATIONS + 4)
+#define NUM_EPA_FACES		(NUM_EPA_POINTS * 2)
+#define EPA_TOLERANCE		0.0001f
+
+/* point of the minkowski difference of the sets a - b
+ */
+struct GJKPoint {
+	vec3 v;
+	vec3 a;			// point of the set a
+};
+
+static void gjk_support(const vec3 *a,int num_a,const vec3 *b,int num_b,const vec3 &dir,GJKPoint &p) {
+	int ia = 0;
+	float da = a[0] * dir;
+	for(int i = 1; i < num_a; i++) {
+		float d = a[i] * dir;
+		if(da < d) {
+			da = d;
+			ia = i;
+		}
+	}
+	int ib = 0;
+	float db = b[0] * dir;
+	for(int i = 1; i < num_b; i++) {
+		float d = b[i] * dir;
+		if(db > d) {
+			db = d;
+			ib = i;
+		}
+	}
+	p.a = a[ia];
+	p.v = a[ia] - b[ib];
+}
+
+/* closest point of the triangle to the origin
+ * the simplex is reduced to the vertexes of the closest feature
+ */
+static vec3 gjk_triangle(GJKPoint *s,int &num,float *w) {
+	vec3 ab = s[1].v - s[0].v;
+	vec3 ac = s[2].v - s[0].v;
+	float d1 = -(ab * s[0].v);
+	float d2 = -(ac * s[0].v);
+	if(d1 <= 0.0f && d2 <= 0.0f) {
+		num = 1;
+		w[0] = 1.0f;
+		return s[0].v;
+	}
+	float d3 = -(ab * s[1].v);
+	float d4 = -(ac * s[1].v);
+	if(d3 >= 0.0f && d4 <= d3) {
+		s[0] = s[1];
+		num = 1;
+		w[0] = 1.0f;
+		return s[0].v;
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+		float t = d1 / (d1 - d3);
+		num = 2;
+		w[0] = 1.0f - t;
+		w[1] = t;
+		return s[0].v + ab * t;
+	}
+	float d5 = -(ab * s[2].v);
+	float d6 = -(ac * s[2].v);
+	if(d6 >= 0.0f && d5 <= d6) {
+		s[0] = s[2];
+		num = 1;
+		w[0] = 1.0f;
+		return s[0].v;
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+		float t = d2 / (d2 - d6);
+		s[1] = s[2];
+		num = 2;
+		w[0] = 1.0f - t;
+		w[1] = t;
+		return s[0].v + ac * t;
+	}
+	float va = d3 * d6 - d5 * d4;
+	if(va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+		float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		s[0] = s[1];
+		s[1] = s[2];
+		num = 2;
+		w[0] = 1.0f - t;
+		w[1] = t;
+		return s[0].v + (s[1].v - s[0].v) * t;
+	}
+	float denom = va + vb + vc;
+	if(denom < EPSILON) {	// degenerate triangle
+		num = 1;
+		w[0] = 1.0f;
+		return s[0].v;
+	}
+	w[1] = vb / denom;
+	w[2] = vc / denom;
+	w[0] = 1.0f - w[1] - w[2];
+	return s[0].v + ab * w[1] + ac * w[2];
+}
+
+/* closest point of the simplex to the origin
+ * returns 0 if the origin is inside of the tetrahedron
+ */
+static int gjk_closest(GJKPoint *s,int &num,float *w,vec3 &closest) {
+	if(num == 1) {
+		w[0] = 1.0f;
+		closest = s[0].v;
+	} else if(num == 2) {
+		vec3 d = s[1].v - s[0].v;
+		float length = d * d;
+		float t = length > EPSILON ? -(s[0].v * d) / length : 0.0f;
+		if(t <= 0.0f) {
+			num = 1;
+			w[0] = 1.0f;
+			closest = s[0].v;
+		} else if(t >= 1.0f) {
+			s[0] = s[1];
+			num = 1;
+			w[0] = 1.0f;
+			closest = s[0].v;
+		} else {
+			w[0] = 1.0f - t;
+			w[1] = t;
+			closest = s[0].v + d * t;
+		}
+	} else if(num == 3) {
+		closest = gjk_triangle(s,num,w);
+	} else {
+		// the closest of the faces separating the origin from the opposite vertex
+		static int faces[4][4] = { { 0, 1, 2, 3 }, { 0, 3, 1, 2 }, { 1, 3, 2, 0 }, { 2, 3, 0, 1 } };
+		float distance = 1000000.0f;
+		GJKPoint best[3];
+		int num_best = 0;
+		float best_w[3];
+		for(int i = 0; i < 4; i++) {
+			const int *f = faces[i];
+			vec3 normal;
+			normal.cross(s[f[1]].v - s[f[0]].v,s[f[2]].v - s[f[0]].v);
+			float d0 = -(normal * s[f[0]].v);
+			float d1 = normal * (s[f[3]].v - s[f[0]].v);
+			if(d0 * d1 >= 0.0f) continue;
+			GJKPoint t[3] = { s[f[0]], s[f[1]], s[f[2]] };
+			int num_t = 3;
+			float t_w[3];
+			vec3 c = gjk_triangle(t,num_t,t_w);
+			float d = c * c;
+			if(distance <= d) continue;
+			distance = d;
+			closest = c;
+			num_best = num_t;
+			for(int j = 0; j < num_t; j++) {
+				best[j] = t[j];
+				best_w[j] = t_w[j];
+			}
+		}
+		if(num_best == 0) return 0;
+		num = num_best;
+		for(int i = 0; i < num; i++) {
+			s[i] = best[i];
+			w[i] = best_w[i];
+		}
+	}
+	return 1;
+}
+
+/* expand the simplex with the origin into the tetrahedron
+ */
+static int gjk_tetrahedron(const vec3 *a,int num_a,const vec3 *b,int num_b,GJKPoint *s,int &num) {
+	static vec3 axes[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+	if(num == 1) {
+		for(int i = 0; i < 6 && num == 1; i++) {
+			gjk_support(a,num_a,b,num_b,axes[i],s[1]);
+			if((s[1].v - s[0].v).length() > EPA_TOLERANCE) num = 2;
+		}
+		if(num == 1) return 0;
+	}
+	if(num == 2) {
+		vec3 d = s[1].v - s[0].v;
+		d.normalize();
+		for(int i = 0; i < 6 && num == 2; i += 2) {
+			vec3 dir = cross(d,axes[i]);
+			if(dir.normalize() < 0.1f) continue;
+			for(int j = 0; j < 4 && num == 2; j++) {
+				gjk_support(a,num_a,b,num_b,dir,s[2]);
+				vec3 p = s[2].v - s[0].v;
+				if((p - d * (p * d)).length() > EPA_TOLERANCE) num = 3;
+				dir = cross(d,dir);
+			}
+		}
+		if(num == 2) return 0;
+	}
+	if(num == 3) {
+		vec3 normal;
+		normal.cross(s[1].v - s[0].v,s[2].v - s[0].v);
+		normal.normalize();
+		gjk_support(a,num_a,b,num_b,normal,s[3]);
+		if(fabs((s[3].v - s[0].v) * normal) > EPA_TOLERANCE) num = 4;
+		else {
+			gjk_support(a,num_a,b,num_b,-normal,s[3]);
+			if(fabs((s[3].v - s[0].v) * normal) > EPA_TOLERANCE) num = 4;
+		}
+		if(num == 3) return 0;
+	}
+	return 1;
+}
+
+/* distance between the convex hulls of two point sets
+ * returns 1 and the tetrahedron around the origin if the sets intersect
+ * returns 0 and the closest vector a - b with the point of the set a otherwise
+ */
+static int gjk(const vec3 *a,int num_a,const vec3 *b,int num_b,GJKPoint *s,int &num,vec3 &closest,vec3 &point) {
+	num = 1;
+	gjk_support(a,num_a,b,num_b,b[0] - a[0],s[0]);
+	float w[4];
+	for(int i = 0; i < NUM_GJK_ITERATIONS; i++) {
+		if(gjk_closest(s,num,w,closest) == 0) return 1;
+		float distance = closest * closest;
+		if(distance < EPSILON * EPSILON) return gjk_tetrahedron(a,num_a,b,num_b,s,num);
+		GJKPoint p;
+		gjk_support(a,num_a,b,num_b,-closest,p);
+		if(distance - closest * p.v <= distance * 0.00001f) break;
+		int j;
+		for(j = 0; j < num; j++) {
+			if(s[j].v == p.v) break;
+		}
+		if(j != num) break;
+		s[num++] = p;
+	}
+	point = vec3(0,0,0);
+	for(int i = 0; i < num; i++) point += s[i].a * w[i];
+	return 0;
+}
+
+/* penetration of the intersected sets by the expanding polytope
+ * the normal is directed from the set a to the set b, the point is the deepest point of the set a
+ */
+struct EPAFace {
+	int v[3];
+	vec3 normal;
+	float distance;
+};
+
+static int epa_face(EPAFace *f,const GJKPoint *points,const vec3 &center,int v0,int v1,int v2) {
+	vec3 normal;
+	normal.cross(points[v1].v - points[v0].v,points[v2].v - points[v0].v);
+	if(normal.normalize() < EPSILON) return 0;
+	if(normal * (points[v0].v - center) < 0.0f) {
+		int v = v1;
+		v1 = v2;
+		v2 = v;
+		normal = -normal;
+	}
+	f->v[0] = v0;
+	f->v[1] = v1;
+	f->v[2] = v2;
+	f->normal = normal;
+	f->distance = normal * points[v0].v;
+	return 1;
+}
+
+static int epa(const vec3 *a,int num_a,const vec3 *b,int num_b,const GJKPoint *s,vec3 &normal,float &depth,vec3 &point) {
+	
+	GJKPoint points[NUM_EPA_POINTS];
+	EPAFace faces[NUM_EPA_FACES];
+	int edges[NUM_EPA_FACES * 3][2];
+	
+	int num_points = 4;
+	for(int i = 0; i < 4; i++) points[i] = s[i];
+	vec3 center = (s[0].v + s[1].v + s[2].v + s[3].v) / 4.0f;
+	
+	int num_faces = 0;
+	num_faces += epa_face(&faces[num_faces],points,center,0,1,2);
+	num_faces += epa_face(&faces[num_faces],points,center,0,3,1);
+	num_faces += epa_face(&faces[num_faces],points,center,1,3,2);
+	num_faces += epa_face(&faces[num_faces],points,center,2,3,0);
+	if(num_faces != 4) return 0;
+	
+	EPAFace *f = NULL;
+	for(int i = 0; i < NUM_EPA_ITERATIONS; i++) {
+		
+		f = &faces[0];
+		for(int j = 1; j < num_faces; j++) {
+			if(f->distance > faces[j].distance) f = &faces[j];
+		}
+		
+		GJKPoint p;
+		gjk_support(a,num_a,b,num_b,f->normal,p);
+		if(p.v * f->normal - f->distance < EPA_TOLERANCE) break;
+		if(num_points == NUM_EPA_POINTS) break;
+		
+		// remove the faces visible from the new point
+		int num_edges = 0;
+		for(int j = 0; j < num_faces; j++) {
+			EPAFace *face = &faces[j];
+			if(face->normal * (p.v - points[face->v[0]].v) <= 0.0f) continue;
+			for(int k = 0; k < 3; k++) {
+				int e0 = face->v[k];
+				int e1 = face->v[(k + 1) % 3];
+				int l;
+				for(l = 0; l < num_edges; l++) {
+					if(edges[l][0] == e1 && edges[l][1] == e0) break;
+				}
+				if(l != num_edges) {
+					edges[l][0] = edges[num_edges - 1][0];
+					edges[l][1] = edges[num_edges - 1][1];
+					num_edges--;
+				} else {
+					edges[num_edges][0] = e0;
+					edges[num_edges][1] = e1;
+					num_edges++;
+				}
+			}
+			faces[j--] = faces[--num_faces];
+		}
+		if(num_faces + num_edges > NUM_EPA_FACES) return 0;
+		
+		// new faces from the horizon to the new point
+		points[num_points] = p;
+		for(int j = 0; j < num_edges; j++) {
+			num_faces += epa_face(&faces[num_faces],points,center,edges[j][0],edges[j][1],num_points);
+		}
+		num_points++;
+		if(num_faces == 0) return 0;
+		f = NULL;
+	}
+	if(f == NULL) {
+		f = &faces[0];
+		for(int j = 1; j < num_faces; j++) {
+			if(f->distance > faces[j].distance) f = &faces[j];
+		}
+	}
+	
+	normal = f->normal;
+	depth = f->distance;
+	
+	// barycentric coordinates of the origin projection
+	const GJKPoint &p0 = points[f->v[0]];
+	const GJKPoint &p1 = points[f->v[1]];
+	const GJKPoint &p2 = points[f->v[2]];
+	vec3 p = normal * depth;
+	vec3 n0,n1;
+	n0.cross(p1.v - p,p2.v - p);
+	n1.cross(p2.v - p,p0.v - p);
+	vec3 n;
+	n.cross(p1.v - p0.v,p2.v - p0.v);
+	float area = n * n;
+	if(area < EPSILON * EPSILON) {
+		point = p0.a;
+		return 1;
+	}
+	float w0 = (n0 * n) / area;
+	float w1 = (n1 * n) / area;
+	point = p0.a * w0 + p1.a * w1 + p2.a * (1.0f - w0 - w1);
+	return 1;
+}
+
+/* the point is inside of the hull planes
+ */
+static int hull_inside(const vec3 &p,const vec4 *planes,int num_planes) {
+	for(int i = 0; i < num_planes; i++) {
+		if(p * planes[i] >= 0.0f) return 0;
+	}
+	return 1;
+}
+
+/* convex hull of the object in the given space
+ */
+void Collide::transformHull(Object *object,const mat4 &transform) {
+	Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+	num_hull_vertex = mesh->getNumHullVertex();
+	num_hull_planes = mesh->getNumHullPlanes();
+	if(all_hull_vertex < num_hull_vertex) {
+		all_hull_vertex = num_hull_vertex;
+		delete [] hull_vertex;
+		hull_vertex = new vec3[all_hull_vertex];
+	}
+	if(all_hull_planes < num_hull_planes) {
+		all_hull_planes = num_hull_planes;
+		delete [] hull_planes;
+		hull_planes = new vec4[all_hull_planes];
+	}
+	const vec3 *vertex = mesh->getHullVertex();
+	for(int i = 0; i < num_hull_vertex; i++) {
+		hull_vertex[i] = transform * vertex[i];
+	}
+	mat4 rotate = transform.rotation();
+	vec3 offset = transform * vec3(0,0,0);
+	const vec4 *planes = mesh->getHullPlanes();
+	for(int i = 0; i < num_hull_planes; i++) {
+		vec3 normal = rotate * vec3(planes[i]);
+		hull_planes[i] = vec4(normal,planes[i].w - normal * offset);
+	}
+	hull_center = transform * mesh->getCenter();
+	hull_radius = mesh->getRadius();
+}
+
+/* the rigidbody hull against the other object in the space of the other object
+ * returns 0 if the pair is collided by the meshes
+ */
+int Collide::collideHull(Object *object,Object *other) {
+	
+	if(other->type != Object::OBJECT_MESH) return 0;
+	
+	RigidBody *rb = other->rigidbody;
+	Shape shape;
+	if(rb && rb->collide_type == RigidBody::COLLIDE_SHAPE) {
+		getShape(other,mat4(),shape);
+		if(shape.type == RigidBody::BODY_CYLINDER) return 0;
+	}
+	
+	if(isIdentity(other)) transformHull(object,getTransform(object));
+	else transformHull(object,getITransform(other) * getTransform(object));
+	
+	if(rb && rb->collide_type == RigidBody::COLLIDE_HULL) collideHullHull(other);
+	else if(rb && rb->collide_type == RigidBody::COLLIDE_SHAPE) collideHullShape(other,shape);
+	else if(rb && rb->collide_type == RigidBody::COLLIDE_SPHERE) collideHullSphere(other,vec3(0,0,0),other->getRadius());
+	else collideHullMesh(other);
+	
+	return 1;
+}
+
+/* vertexes inside the other hull or the deepest point
+ */
+void Collide::collideHullHull(Object *object) {
+	
+	Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+	const vec3 *vertex = mesh->getHullVertex();
+	int num_vertex = mesh->getNumHullVertex();
+	const vec4 *planes = mesh->getHullPlanes();
+	int num_planes = mesh->getNumHullPlanes();
+	
+	GJKPoint simplex[4];
+	int num;
+	vec3 closest,point;
+	if(gjk(hull_vertex,num_hull_vertex,vertex,num_vertex,simplex,num,closest,point) == 0) return;
+	
+	vec3 normal;
+	float depth;
+	if(epa(hull_vertex,num_hull_vertex,vertex,num_vertex,simplex,normal,depth,point) == 0) return;
+	if(depth <= 0.0f) return;
+	normal = -normal;
+	
+	int num_contacts_old = num_contacts;
+	
+	float max = -1000000.0f;
+	for(int i = 0; i < num_vertex; i++) {
+		float d = vertex[i] * normal;
+		if(max < d) max = d;
+	}
+	for(int i = 0; i < num_hull_vertex; i++) {
+		if(hull_inside(hull_vertex[i],planes,num_planes) == 0) continue;
+		if(!addContact(object,NULL,hull_vertex[i],normal,max - hull_vertex[i] * normal)) return;
+	}
+	
+	float min = 1000000.0f;
+	for(int i = 0; i < num_hull_vertex; i++) {
+		float d = hull_vertex[i] * normal;
+		if(min > d) min = d;
+	}
+	for(int i = 0; i < num_vertex; i++) {
+		if(hull_inside(vertex[i],hull_planes,num_hull_planes) == 0) continue;
+		if(!addContact(object,NULL,vertex[i],normal,vertex[i] * normal - min)) return;
+	}
+	
+	if(num_contacts_old == num_contacts) addContact(object,NULL,point,normal,depth);
+}
+
+/*
+ */
+void Collide::collideHullSphere(Object *object,const vec3 &pos,float radius) {
+	GJKPoint simplex[4];
+	int num;
+	vec3 closest,point;
+	if(gjk(hull_vertex,num_hull_vertex,&pos,1,simplex,num,closest,point) == 0) {
+		float length = closest.length();
+		if(length >= radius || length < EPSILON) return;
+		addContact(object,NULL,point,closest / length,radius - length);
+		return;
+	}
+	vec3 normal;
+	float depth;
+	if(epa(hull_vertex,num_hull_vertex,&pos,1,simplex,normal,depth,point) == 0) return;
+	addContact(object,NULL,point,-normal,depth + radius);
+}
+
+/* the hull against the shape of the object
+ * the capsule ends or the point closest to the hull if the ends don`t touch
+ */
+void Collide::collideHullShape(Object *object,const Shape &shape) {
+	
+	if(shape.type == RigidBody::BODY_BOX) {
+		collideHullBox(object,shape);
+		return;
+	}
+	
+	int num = num_contacts;
+	vec3 p0,p1;
+	getSegment(shape,p0,p1);
+	collideHullSphere(object,p0,shape.size.x);
+	if(shape.type == RigidBody::BODY_CAPSULE) {
+		collideHullSphere(object,p1,shape.size.x);
+		if(num == num_contacts) collideHullSphere(object,segment_point(hull_center,p0,p1),shape.size.x);
+	}
+}
+
+/* vertexes inside the box, box vertexes inside the hull or the deepest point
+ */
+void Collide::collideHullBox(Object *object,const Shape &box) {
+	
+	vec3 vertex[8];
+	box_vertexes(box.center,box.axis,box.size,vertex);
+	
+	GJKPoint simplex[4];
+	int num;
+	vec3 closest,point;
+	if(gjk(hull_vertex,num_hull_vertex,vertex,8,simplex,num,closest,point) == 0) return;
+	
+	vec3 normal;
+	float depth;
+	if(epa(hull_vertex,num_hull_vertex,vertex,8,simplex,normal,depth,point) == 0) return;
+	if(depth <= 0.0f) return;
+	normal = -normal;
+	
+	int num_contacts_old = num_contacts;
+	
+	float max = box.center * normal + box_radius(box.axis,box.size,normal);
+	for(int i = 0; i < num_hull_vertex; i++) {
+		if(box_inside(hull_vertex[i],box.center,box.axis,box.size) == 0) continue;
+		if(!addContact(object,NULL,hull_vertex[i],normal,max - hull_vertex[i] * normal)) return;
+	}
+	
+	float min = 1000000.0f;
+	for(int i = 0; i < num_hull_vertex; i++) {
+		float d = hull_vertex[i] * normal;
+		if(min > d) min = d;
+	}
+	for(int i = 0; i < 8; i++) {
+		if(hull_inside(vertex[i],hull_planes,num_hull_planes) == 0) continue;
+		if(!addContact(object,NULL,vertex[i],normal,vertex[i] * normal - min)) return;
+	}
+	
+	if(num_contacts_old == num_contacts) addContact(object,NULL,point,normal,depth);
+}
+
+/* the hull against the triangles of the object
+ */
+void Collide::collideHullMesh(Object *object) {
+	
+	vec3 min = vec3(1000000,1000000,1000000);
+	vec3 max = vec3(-1000000,-1000000,-1000000);
+	for(int i = 0; i < num_hull_vertex; i++) {
+		for(int j = 0; j < 3; j++) {
+			if(min[j] > hull_vertex[i][j]) min[j] = hull_vertex[i][j];
+			if(max[j] < hull_vertex[i][j]) max[j] = hull_vertex[i][j];
+		}
+	}
+	
+	Mesh *mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+	
+	for(int i = 0; i < mesh->getNumSurfaces(); i++) {
+		if((mesh->getCenter(i) - hull_center).length() > mesh->getRadius(i) + hull_radius) continue;
+		
+		if(mesh->getNumNodes(i) == 0) continue;
+		
+		Mesh::Triangle *triangles = mesh->getTriangles(i);
+		Mesh::BVHNode *nodes = mesh->getNodes(i);
+		
+		// only the triangles from the overlapped bvh leaves
+		int stack[Mesh::NUM_BVH_STACK];
+		int num_stack = 0;
+		stack[num_stack++] = 0;
+		while(num_stack) {
+			int id = stack[--num_stack];
+			Mesh::BVHNode *node = &nodes[id];
+			if(node->min.x > max.x || node->max.x < min.x) continue;
+			if(node->min.y > max.y || node->max.y < min.y) continue;
+			if(node->min.z > max.z || node->max.z < min.z) continue;
+			if(node->num_triangles == 0) {
+				stack[num_stack++] = node->right;
+				stack[num_stack++] = id + 1;
+				continue;
+			}
+			for(int j = node->first; j < node->first + node->num_triangles; j++) {
+				Mesh::Triangle *t = &triangles[j];
+				
+				// the center is over the triangle
+				float dist = vec4(hull_center,1) * t->plane;
+				if(dist >= hull_radius || dist < 0) continue;
+				
+				collideHullTriangle(object,object->materials[i],t->v,t->plane,t->c);
+				if(max_contacts && num_contacts >= max_contacts) return;
+			}
+		}
+	}
+}
+
+/* vertexes of the hull under the triangle, vertexes of the triangle inside the hull
+ * or the deepest point
+ */
+void Collide::collideHullTriangle(Object *object,Material *material,const vec3 *v,const vec4 &plane,const vec4 *c) {
+	
+	GJKPoint simplex[4];
+	int num;
+	vec3 closest,point;
+	if(gjk(hull_vertex,num_hull_vertex,v,3,simplex,num,closest,point) == 0) return;
+	
+	vec3 normal;
+	float depth;
+	if(epa(hull_vertex,num_hull_vertex,v,3,simplex,normal,depth,point) == 0) return;
+	if(depth <= 0.0f) return;
+	normal = -normal;
+	
+	// back side of the triangle
+	if(normal * vec3(plane) <= 0.0f) return;
+	
+	int num_contacts_old = num_contacts;
+	
+	for(int i = 0; i < num_hull_vertex; i++) {
+		const vec3 &p = hull_vertex[i];
+		float dist = vec4(p,1) * plane;
+		if(dist >= 0.0f) continue;
+		if(p * c[0] < 0.0f || p * c[1] < 0.0f || p * c[2] < 0.0f) continue;
+		if(!addContact(object,material,p,vec3(plane),-dist)) return;
+	}
+	
+	float min = 1000000.0f;
+	for(int i = 0; i < num_hull_vertex; i++) {
+		float d = hull_vertex[i] * normal;
+		if(min > d) min = d;
+	}
+	for(int i = 0; i < 3; i++) {
+		if(hull_inside(v[i],hull_planes,num_hull_planes) == 0) continue;
+		if(!addContact(object,material,v[i],normal,v[i] * normal - min)) return;
+	}
+	
+	if(num_contacts_old == num_contacts) addContact(object,material,point,normal,depth);
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* sorting contacts                                                          */
 /*                                                                           */
 /*****************************************************************************/
 
-static int contact_cmp(const void *a,const void *b) {
+int Collide::contact_cmp(const void *a,const void *b) {
 	Collide::Contact *c0 = (Collide::Contact*)a;
 	Collide::Contact *c1 = (Collide::Contact*)b;
-	if(c0->object->pos.z > c1->object->pos.z) return 1;
-	if(c0->object->pos.z < c1->object->pos.z) return -1;
+	float z0 = getPos(c0->object).z;
+	float z1 = getPos(c1->object).z;
+	if(z0 > z1) return 1;
+	if(z0 < z1) return -1;
 	if(c0->point.z > c1->point.z) return 1;
 	if(c0->point.z < c1->point.z) return -1;
 	return 0;
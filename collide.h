@@ -34,14 +34,20 @@ public:
 	
 	int collide(Object *object,const vec3 &pos,float radius);
 	int collide(Object *object,const Position &pos,float radius);
+	int collide(Object *object,const Position &pos,const vec3 &center,float radius);
 	
 	int collide(Object *object);
 	
+	float sweep(Object *object,const vec3 &pos0,const vec3 &pos1,float radius);
+	
 	void sort();
 	
+	static int isSIMD();
+	
+	static int simd;			// SIMD narrowphase kernels
+	
 	enum {
-		NUM_CONTACTS = 32,
-		NUM_OBJECTS = 16,
+		NUM_SWEEP_ITERATIONS = 16,
 	};
 	
 	struct Contact {
@@ -52,23 +58,80 @@ public:
 		float depth;
 	};
 	
+	// sphere query, it is swept from pos0 to pos1 when they are different
+	// contacts are found at the end of the sweep
+	struct Query {
+		Object *object;			// ignored object
+		vec3 pos0;
+		vec3 pos1;
+		float radius;
+		float fraction;			// end of the sweep
+		int first_contact;		// contacts in the buffer
+		int num_contacts;
+	};
+	
+	// returns the number of all contacts, only num of them are written into the buffer
+	int collide(Query *queries,int num_queries,Contact *buffer,int num);
+	
 	int num_contacts;
+	int all_contacts;
 	Contact *contacts;
+	int max_contacts;			// zero is unlimited
 	
-	int num_objects;
+	int num_objects;			// objects of the contacts
+	int all_objects;
 	Object **objects;
-	
+
 protected:
 	
+	int findObjects(const vec3 &min,const vec3 &max);
+	int collideObjects(Object *object,const vec3 &center,float radius,int num);
+	float sweepObjects(Object *object,const vec3 &pos0,const vec3 &pos1,float radius,int num);
+	
 	int addContact(Object *object,Material *material,const vec3 &point,const vec3 &normal,float depth,int min_depth = 0);
 	void collideObjectSphere(Object *object,const vec3 &pos,float radius);
 	void collideObjectMesh(Object *object);
 	
-	enum {
-		NUM_TRIANGLES = 1024,
-		NUM_SURFACES = 16,
+	int transformObject(Object *object,Object *other);
+	
+	static int isIdentity(Object *object);
+	static const mat4 &getTransform(Object *object);
+	static const mat4 &getITransform(Object *object);
+	static vec3 getPos(Object *object);
+	static const Position &getPosition(Object *object);
+	
+	static int contact_cmp(const void *a,const void *b);
+	static int order_cmp(const void *a,const void *b);
+	
+	struct Shape {
+		int type;				// RigidBody::BODY_* type
+		vec3 center;
+		vec3 axis[3];			// orthonormal axes
+		vec3 size;				// half sizes or radius and half height along the z axis
 	};
 	
+	static void getShape(Object *object,const mat4 &transform,Shape &shape);
+	static void getSegment(const Shape &shape,vec3 &p0,vec3 &p1);
+	
+	int collideShape(Object *object,Object *other);
+	void collideShapeMesh(Object *object,const Shape &shape);
+	void collideShapeTriangle(Object *object,Material *material,const Shape &shape,const vec3 *v,const vec4 &plane,const vec4 *c);
+	void collideSphereShape(Object *object,const vec3 &pos,float radius,const Shape &shape);
+	void collideShapeSphere(Object *object,const Shape &shape,const vec3 &pos,float radius);
+	void collideSphereSphere(Object *object,const vec3 &pos0,float radius0,const vec3 &pos1,float radius1);
+	void collideSphereBox(Object *object,const vec3 &pos,float radius,const Shape &box);
+	void collideBoxSphere(Object *object,const Shape &box,const vec3 &pos,float radius);
+	void collideBoxBox(Object *object,const Shape &box0,const Shape &box1);
+	
+	void transformHull(Object *object,const mat4 &transform);
+	int collideHull(Object *object,Object *other);
+	void collideHullHull(Object *object);
+	void collideHullSphere(Object *object,const vec3 &pos,float radius);
+	void collideHullShape(Object *object,const Shape &shape);
+	void collideHullBox(Object *object,const Shape &box);
+	void collideHullMesh(Object *object);
+	void collideHullTriangle(Object *object,Material *material,const vec3 *v,const vec4 &plane,const vec4 *c);
+	
 	struct Triangle {
 		vec3 v[3];			// vertexes
 		vec4 plane;			// plane
@@ -77,6 +140,7 @@ protected:
 	
 	struct Surface {
 		int num_triangles;		// triangles
+		int all_triangles;
 		Triangle *triangles;
 		vec3 center;			// bound sphere
 		float radius;
@@ -84,12 +148,39 @@ protected:
 		vec3 max;
 	};
 	
-	static int counter;
+	int all_candidates;			// broadphase objects
+	Object **candidates;
+	
+	int all_found;				// broadphase objects of the queries
+	Object **found;
+	int *found_masks;
+	
+	struct Order {
+		int key;
+		int query;
+	};
+	
+	int all_orders;				// queries grouped by the position
+	Order *orders;
+	
+	int num_sweep_triangles;	// triangles crossed by the sweep
+	int all_sweep_triangles;
+	Triangle *sweep_triangles;
+	
+	Position position;			// sectors of the sphere
 	
-	static Position position;
+	int num_surfaces;			// surfaces of the object in the space of the other object
+	int all_surfaces;
+	Surface *surfaces;
 	
-	static int num_surfaces;
-	static Surface *surfaces;
+	int num_hull_vertex;		// hull of the object in the space of the other object
+	int all_hull_vertex;
+	vec3 *hull_vertex;
+	int num_hull_planes;
+	int all_hull_planes;
+	vec4 *hull_planes;
+	vec3 hull_center;			// bound sphere of the hull
+	float hull_radius;
 };
 
 #endif /* __COLLIDE_H__ */
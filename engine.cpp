@@ -20,6 +20,7 @@
 #include "pbuffer.h"
 #include "console.h"
 #include "frustum.h"
+#include "occlusion.h"
 #include "meshvbo.h"
 #include "bsp.h"
 #include "position.h"
@@ -31,6 +32,9 @@
 #include "texture.h"
 #include "material.h"
 #include "physic.h"
+#include "thread.h"
+#include "broadphase.h"
+#include "collide.h"
 #include "map.h"
 #include "engine.h"
 
@@ -50,6 +54,7 @@ Console *Engine::console;
 
 Position Engine::camera;
 Frustum *Engine::frustum;
+Occlusion *Engine::occlusion;
 
 Bsp *Engine::bsp;
 
@@ -105,8 +110,11 @@ int Engine::shadows_toggle;
 int Engine::show_shadows_toggle;
 int Engine::fog_toggle;
 int Engine::mirror_toggle;
+int Engine::occlusion_toggle;
 int Engine::physic_toggle;
 
+int Engine::headless;
+
 std::vector<char*> Engine::path;
 std::vector<char*> Engine::defines;
 
@@ -171,6 +179,63 @@ static void extensions(int,char**,void*) {
 	Engine::console->printf("%s\n",Engine::extensions);
 }
 
+static void broadphase(int,char**,void*) {
+	int skipped = Broadphase::num_sector_pairs - Broadphase::num_pairs;
+	Engine::console->printf("objects: %d\nsector pairs: %d\nbroadphase pairs: %d\nskipped: %d (%.1f%%)\n",
+		Broadphase::getNumObjects(),Broadphase::num_sector_pairs,Broadphase::num_pairs,skipped,
+		Broadphase::num_sector_pairs ? skipped * 100.0f / Broadphase::num_sector_pairs : 0.0f);
+	Broadphase::resetCounters();
+}
+
+/* scalar against SIMD narrowphase on the current scene
+ */
+static void collide_benchmark(int argc,char **argv,void*) {
+	int num = 100;
+	if(argc > 1) num = atoi(argv[1]);
+	Physic::wait();
+	Collide *collide = new Collide();
+	int simd = Collide::simd;
+	double time[2][2];
+	float sum[2][2];
+	for(int i = 0; i < 2; i++) {
+		Collide::simd = i ? simd : 0;
+		for(int j = 0; j < 2; j++) {	// sphere-mesh and mesh-mesh
+			sum[i][j] = 0.0;
+			time[i][j] = Thread::getTime();
+			for(int k = 0; k < num; k++) {
+				for(int l = 0; l < Engine::num_objects; l++) {
+					Object *o = Engine::objects[l];
+					if(o->type != Object::OBJECT_MESH || o->is_identity) continue;
+					if(j == 0) collide->collide(o,o->pos + o->getCenter(),o->getRadius());
+					else collide->collide(o);
+					for(int m = 0; m < collide->num_contacts; m++) {
+						sum[i][j] += collide->contacts[m].depth + collide->contacts[m].point * collide->contacts[m].normal;
+					}
+				}
+			}
+			time[i][j] = Thread::getTime() - time[i][j];
+		}
+	}
+	Collide::simd = simd;
+	delete collide;
+	Engine::console->printf("simd: %s\n",simd ? "sse" : "none");
+	Engine::console->printf("sphere-mesh: scalar %.2fms simd %.2fms %s\n",time[0][0] * 1000.0,time[1][0] * 1000.0,sum[0][0] == sum[1][0] ? "same" : "different");
+	Engine::console->printf("mesh-mesh: scalar %.2fms simd %.2fms %s\n",time[0][1] * 1000.0,time[1][1] * 1000.0,sum[0][1] == sum[1][1] ? "same" : "different");
+}
+
+static void physic_solver(int,char**,void*) {
+	Engine::console->printf("iterations: %d residual: %f contacts: %d (%.3fms) frozen: %d\n",Physic::getNumIterations(),Physic::getResidual(),
+		Physic::getNumContacts(),Physic::getContactsTime() * 1000.0f,Physic::getNumFrozenRigidBodies());
+}
+
+static void physic_islands(int,char**,void*) {
+	Engine::console->printf("islands: %d threads: %d\n",Physic::getNumIslands(),Thread::getNumThreads());
+	for(int i = 0; i < Physic::getNumIslands(); i++) {
+		Engine::console->printf("%d: rigidbodies: %d joints: %d time: %.3fms\n",i,
+			Physic::getIslandNumRigidBodies(i),Physic::getIslandNumJoints(i),Physic::getIslandTime(i) * 1000.0f);
+	}
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* Engine                                                                    */
@@ -182,32 +247,34 @@ static void extensions(int,char**,void*) {
 int Engine::init(const char *config) {
 	
 	// bind system stderr to Engine::console
+	if(headless == 0) {
 #ifndef _WIN32
-	int fd[2];
-	pipe(fd);
-	stderr_fd = fd[0];
-	fcntl(stderr_fd,F_SETFL,O_NONBLOCK);
-	stderr = fdopen(fd[1],"w");
-	setbuf(stderr,NULL);
+		int fd[2];
+		pipe(fd);
+		stderr_fd = fd[0];
+		fcntl(stderr_fd,F_SETFL,O_NONBLOCK);
+		stderr = fdopen(fd[1],"w");
+		setbuf(stderr,NULL);
 #else
-	HANDLE read,write;
-	SECURITY_ATTRIBUTES security;
-	
-	security.nLength = sizeof(security);
-	security.bInheritHandle = TRUE;
-	security.lpSecurityDescriptor = NULL;
-	
-	CreatePipe(&read,&write,&security,1024 - 1);
-	
-	DWORD mode = PIPE_READMODE_BYTE | PIPE_NOWAIT;
-	SetNamedPipeHandleState(read,&mode,NULL,NULL);
-	SetNamedPipeHandleState(write,&mode,NULL,NULL);
-	
-	stderr_fd = _open_osfhandle((long)read,O_RDONLY | O_BINARY);
-	FILE *file = fdopen(_open_osfhandle((long)write,O_WRONLY | O_BINARY),"w");
-	*stderr = *file;
-	setbuf(stderr,NULL);
+		HANDLE read,write;
+		SECURITY_ATTRIBUTES security;
+		
+		security.nLength = sizeof(security);
+		security.bInheritHandle = TRUE;
+		security.lpSecurityDescriptor = NULL;
+		
+		CreatePipe(&read,&write,&security,1024 - 1);
+		
+		DWORD mode = PIPE_READMODE_BYTE | PIPE_NOWAIT;
+		SetNamedPipeHandleState(read,&mode,NULL,NULL);
+		SetNamedPipeHandleState(write,&mode,NULL,NULL);
+		
+		stderr_fd = _open_osfhandle((long)read,O_RDONLY | O_BINARY);
+		FILE *file = fdopen(_open_osfhandle((long)write,O_WRONLY | O_BINARY),"w");
+		*stderr = *file;
+		setbuf(stderr,NULL);
 #endif
+	}
 	
 	// load config
 	if(config) {
@@ -260,18 +327,10 @@ int Engine::init(const char *config) {
 	
 	// console
 	FILE *log = fopen(ENGINE_LOG_NAME,"wb");
-	console = new Console(findFile(ENGINE_FONT_NAME),log);
+	console = new Console(headless ? NULL : findFile(ENGINE_FONT_NAME),log);
 	
 	console->printf(1,1,1,"3D Engine\nhttp://frustum.org\n\n");
 	
-	// renderer abilities
-	vendor = (char*)glGetString(GL_VENDOR);
-	renderer = (char*)glGetString(GL_RENDERER);
-	version = (char*)glGetString(GL_VERSION);
-	extensions = (char*)glGetString(GL_EXTENSIONS);
-	
-	console->printf("vendor: %s\nrenderer: %s\nversion: %s\n\n",vendor,renderer,version);
-	
 	have_occlusion = 0;
 	have_stencil_two_side = 0;
 	
@@ -281,49 +340,63 @@ int Engine::init(const char *config) {
 	show_shadows_toggle = 0;
 	fog_toggle = 1;
 	mirror_toggle = 1;
+	occlusion_toggle = 1;
 	physic_toggle = 1;
 	
-	if(!strstr(extensions,"GL_ARB_vertex_program")) {	// fatal error
-		console->printf("can`t find GL_ARB_vertex_program extension");
-		return 0;
-	}
+	Physic::threaded = Thread::getNumCPUs() > 1;
+	Physic::num_threads = Thread::getNumCPUs();
 	
-	if(strstr(extensions,"GL_ARB_occlusion_query")) {
-		have_occlusion = 1;
-		console->printf("find GL_ARB_occlusion_query extension\n");
-	}
-	// if(strstr(extensions,"GL_EXT_stencil_two_side")) {
-	// 	have_stencil_two_side = 1;
-	// 	console->printf("find GL_EXT_stencil_two_side extension\n");
-	// }
-	if(strstr(extensions,"GL_NV_depth_clamp")) {
-		define("DEPTH_CLAMP");
-		console->printf("find GL_NV_depth_clamp extension\n");
-	}
-	
-	if(strstr(extensions,"GL_NV_fragment_program")) {			// nv3x cards
-		define("NV3X");
-		define("TEYLOR");
-		define("OFFSET");
-		define("HORIZON");
-		console->printf("using GL_NV_fragment_program shaders code\n");
-	}
-	else if(strstr(extensions,"GL_ARB_fragment_program")) {		// radeons
-		define("RADEON");
-		define("TEYLOR");
-		define("OFFSET");
-		define("HORIZON");
-		console->printf("using GL_ARB_fragment_program shaders code\n");
-	}
-	else if(strstr(extensions,"GL_ARB_texture_env_combine")) {	// hm
-		define("VERTEX");
-		if(!isDefine("DEPTH_CLAMP")) shadows_toggle = 0;
-		fog_toggle = 0;
-		mirror_toggle = 0;
-		console->printf("using GL_ARB_texture_env_combine \"shaders\" code\n");
-	} else {
-		console->printf("pls upgrade you video card...\n");
-		return 0;
+	// renderer abilities
+	if(headless == 0) {
+		vendor = (char*)glGetString(GL_VENDOR);
+		renderer = (char*)glGetString(GL_RENDERER);
+		version = (char*)glGetString(GL_VERSION);
+		extensions = (char*)glGetString(GL_EXTENSIONS);
+		
+		console->printf("vendor: %s\nrenderer: %s\nversion: %s\n\n",vendor,renderer,version);
+		
+		if(!strstr(extensions,"GL_ARB_vertex_program")) {	// fatal error
+			console->printf("can`t find GL_ARB_vertex_program extension");
+			return 0;
+		}
+		
+		if(strstr(extensions,"GL_ARB_occlusion_query")) {
+			have_occlusion = 1;
+			console->printf("find GL_ARB_occlusion_query extension\n");
+		}
+		// if(strstr(extensions,"GL_EXT_stencil_two_side")) {
+		// 	have_stencil_two_side = 1;
+		// 	console->printf("find GL_EXT_stencil_two_side extension\n");
+		// }
+		if(strstr(extensions,"GL_NV_depth_clamp")) {
+			define("DEPTH_CLAMP");
+			console->printf("find GL_NV_depth_clamp extension\n");
+		}
+		
+		if(strstr(extensions,"GL_NV_fragment_program")) {			// nv3x cards
+			define("NV3X");
+			define("TEYLOR");
+			define("OFFSET");
+			define("HORIZON");
+			console->printf("using GL_NV_fragment_program shaders code\n");
+		}
+		else if(strstr(extensions,"GL_ARB_fragment_program")) {		// radeons
+			define("RADEON");
+			define("TEYLOR");
+			define("OFFSET");
+			define("HORIZON");
+			console->printf("using GL_ARB_fragment_program shaders code\n");
+		}
+		else if(strstr(extensions,"GL_ARB_texture_env_combine")) {	// hm
+			define("VERTEX");
+			if(!isDefine("DEPTH_CLAMP")) shadows_toggle = 0;
+			fog_toggle = 0;
+			mirror_toggle = 0;
+			console->printf("using GL_ARB_texture_env_combine \"shaders\" code\n");
+		} else {
+			console->printf("pls upgrade you video card...\n");
+			return 0;
+		}
 	}
 	
 	console->addBool("wareframe",&wareframe_toggle);
@@ -332,27 +405,47 @@ int Engine::init(const char *config) {
 	console->addBool("show_shadows",&show_shadows_toggle);
 	console->addBool("fog",&fog_toggle);
 	console->addBool("mirror",&mirror_toggle);
+	console->addBool("occlusion",&occlusion_toggle);
+	console->addFloat("occlusion_area",&Occlusion::min_area);
 	console->addBool("physic",&physic_toggle);	
+	console->addBool("physic_thread",&Physic::threaded);
+	console->addInt("physic_threads",&Physic::num_threads);
+	console->addInt("physic_first_iterations",&Physic::num_first_iterations);
+	console->addInt("physic_second_iterations",&Physic::num_second_iterations);
+	console->addFloat("physic_time_step",&Physic::time_step);
+	console->addFloat("physic_velocity_max",&Physic::velocity_max);
+	console->addBool("physic_continuous",&Physic::continuous);
+	console->addBool("physic_joint_chains",&Physic::joint_chains);
+	console->addInt("physic_max_contacts",&Physic::max_contacts);
+	console->addBool("physic_incremental_sort",&Physic::incremental_sort);
+	console->addBool("collide_simd",&Collide::simd);
 	
 	console->addCommand("define",::define,NULL);
 	console->addCommand("undef",::undef,NULL);
 	console->addCommand("load",::load,NULL);
 	console->addCommand("reload",::reload,NULL);
 	console->addCommand("extensions",::extensions,NULL);
+	console->addCommand("physic_solver",::physic_solver,NULL);
+	console->addCommand("physic_islands",::physic_islands,NULL);
+	console->addCommand("broadphase",::broadphase,NULL);
+	console->addCommand("collide_benchmark",::collide_benchmark,NULL);
 	
 	// screen
-	if(screen_multisample == 1) screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL | PBuffer::MULTISAMPLE_2);
-	else if(screen_multisample == 2) screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL | PBuffer::MULTISAMPLE_4);
-	else screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL);
-	screen->enable();
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	screen->disable();	
-	screen_texture = new Texture(screen_width,screen_height,Texture::TEXTURE_2D,Texture::RGB | Texture::CLAMP | Texture::LINEAR);
+	if(headless == 0) {
+		if(screen_multisample == 1) screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL | PBuffer::MULTISAMPLE_2);
+		else if(screen_multisample == 2) screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL | PBuffer::MULTISAMPLE_4);
+		else screen = new PBuffer(screen_width,screen_height,PBuffer::RGB | PBuffer::DEPTH | PBuffer::STENCIL);
+		screen->enable();
+		glEnable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		screen->disable();	
+		screen_texture = new Texture(screen_width,screen_height,Texture::TEXTURE_2D,Texture::RGB | Texture::CLAMP | Texture::LINEAR);
+	}
 	screen_material = loadMaterial(ENGINE_SCREEN_MATERIAL);
 	
 	// create new objects
 	if(!frustum) frustum = new Frustum;
+	if(!occlusion) occlusion = new Occlusion;
 	
 	bsp = NULL;
 	
@@ -374,7 +467,7 @@ int Engine::init(const char *config) {
 	num_visible_mirrors = 0;
 	visible_mirrors = NULL;
 	
-	glGenQueriesARB(1,&query_id);
+	if(headless == 0) glGenQueriesARB(1,&query_id);
 	sphere_mesh = loadMesh(ENGINE_SPHERE_MESH);
 	
 	shadow_volume_shader = loadShader(ENGINE_SHADOW_VOLUME_SHADER);
@@ -391,6 +484,8 @@ int Engine::init(const char *config) {
  */
 void Engine::clear() {
 	
+	Physic::shutdown();
+	
 	// objects
 	if(num_objects) {
 		for(int i = 0; i < num_objects; i++) delete objects[i];
@@ -575,6 +670,7 @@ void Engine::load(const char *name) {
 /*
  */
 Shader *Engine::loadShader(const char *name) {
+	if(headless) return NULL;
 	std::map<std::string,Shader*>::iterator it = shaders.find(name);
 	if(it == shaders.end()) {
 		Shader *shader = new Shader(findFile(name));
@@ -585,6 +681,7 @@ Shader *Engine::loadShader(const char *name) {
 }
 
 Texture *Engine::loadTexture(const char *name,GLuint target,int flag) {
+	if(headless) return NULL;
 	std::map<std::string,Texture*>::iterator it = textures.find(name);
 	if(it == textures.end()) {
 		Texture *texture = new Texture(findFile(name),target,flag);
@@ -607,7 +704,7 @@ Material *Engine::loadMaterial(const char *name) {
 Mesh *Engine::loadMesh(const char *name) {
 	std::map<std::string,Mesh*>::iterator it = meshes.find(name);
 	if(it == meshes.end()) {
-		Mesh *mesh = new MeshVBO(findFile(name));
+		Mesh *mesh = headless ? new Mesh(findFile(name)) : new MeshVBO(findFile(name));
 		meshes[name] = mesh;
 		return mesh;
 	}
@@ -654,6 +751,7 @@ void Engine::setExternLoad(void (*func)(void*),void *data) {
 /* objects managment
  */
 void Engine::addObject(Object *object) {
+	Physic::wait();
 	if(num_objects % ENGINE_GAP_SIZE == 0) {
 		Object **objects = new Object*[num_objects + ENGINE_GAP_SIZE];
 		for(int i = 0; i < num_objects; i++) objects[i] = Engine::objects[i];
@@ -661,6 +759,7 @@ void Engine::addObject(Object *object) {
 		Engine::objects = objects;
 	}
 	object->update(0.0);
+	Physic::copyObject(object);
 	objects[num_objects++] = object;
 }
 
@@ -781,9 +880,15 @@ void Engine::update(float ifps) {
 	}
 	
 	// update objects
-	Object *objects[Sector::NUM_OBJECTS];
+	static int all_objects = 0;
+	static Object **objects = NULL;
 	for(int i = 0; i < Bsp::num_visible_sectors; i++) {
 		Sector *s = Bsp::visible_sectors[i];
+		if(all_objects < s->num_objects) {
+			delete [] objects;
+			all_objects = s->num_objects * 2;
+			objects = new Object*[all_objects];
+		}
 		for(int j = 0; j < s->num_objects; j++) objects[j] = s->objects[j];
 		int num_objects = s->num_objects;
 		for(int j = 0; j < num_objects; j++) {
@@ -821,6 +926,8 @@ void Engine::render_light() {
 			
 			if(frustum->inside(l->pos,l->radius) == 0) continue;
 			
+			if(occlusion->inside(l->pos,l->radius) == 0) continue;
+			
 			if(have_occlusion && (l->pos - camera).length() > l->radius) {
 				glPushMatrix();
 				glTranslatef(l->pos.x,l->pos.y,l->pos.z);
@@ -1191,6 +1298,16 @@ void Engine::render(float ifps) {
 	// global triangle counter
 	num_triangles = 0;
 	
+	// culling counters
+	Frustum::num_visible = 0;
+	Frustum::num_culled = 0;
+	Frustum::num_tests = 0;
+	Frustum::num_saved_tests = 0;
+	Frustum::num_inside = 0;
+	Occlusion::num_triangles = 0;
+	Occlusion::num_tests = 0;
+	Occlusion::num_culled = 0;
+	
 	/* render to pbuffer
 	 */
 	screen->enable();
@@ -1213,6 +1330,15 @@ void Engine::render(float ifps) {
 	// zero - ambient shader
 	num_visible_lights = 0;
 	
+	// big occluders are drawn on the cpu before the bsp
+	if(bsp && occlusion_toggle) {
+		occlusion->clear(projection * modelview);
+		bsp->addOccluders();
+		occlusion->rasterize();
+	} else {
+		occlusion->disable();
+	}
+	
 	// render bsp
 	if(bsp) bsp->render();
 	
@@ -1266,6 +1392,9 @@ void Engine::render(float ifps) {
 		int save_num_visible_mirrors = num_visible_mirrors;
 		num_visible_mirrors = 0;
 		
+		// the occlusion buffer is only for the camera
+		occlusion->disable();
+		
 		for(int i = 0; i < save_num_visible_mirrors; i++) {
 			
 			frame++;	// new frame
@@ -1294,6 +1423,8 @@ void Engine::render(float ifps) {
 		
 		num_visible_mirrors = save_num_visible_mirrors;
 		
+		if(bsp && occlusion_toggle) occlusion->enable();
+		
 		// restore state
 		if(bsp) bsp->restoreState(++frame);
 	}
@@ -1336,8 +1467,10 @@ void Engine::render(float ifps) {
 	glFlush();
 	
 	/* calculate physics
+	 * the step runs in the physic thread until the next frame
 	 */
-	if(physic_toggle) Physic::update(Engine::ifps);	
+	if(physic_toggle) Physic::begin(Engine::ifps);
+	else Physic::wait();
 	
 	/* render light flares
 	 */
@@ -1382,32 +1515,158 @@ void Engine::render(float ifps) {
 /*                                                                           */
 /*****************************************************************************/
 
+/* nearest intersection with the surfaces of the object before the point
+ * surfaces of the meshes are tested by their own trees
+ */
+static int intersection_object(Object *object,const vec3 &line0,vec3 &point,vec3 &normal,int &surface) {
+	vec3 l0 = object->is_identity ? line0 : object->itransform * line0;
+	vec3 l1 = object->is_identity ? point : object->itransform * point;
+	vec3 p,n,hit_normal;
+	int s = -1;
+	for(int i = 0; i < object->getNumSurfaces(); i++) {
+		if(object->intersection(l0,l1,p,n,i) == 0) continue;
+		l1 = p;
+		hit_normal = n;
+		s = i;
+	}
+	if(s == -1) return 0;
+	if(object->is_identity) {
+		point = l1;
+		normal = hit_normal;
+	} else {
+		point = object->transform * l1;
+		normal = object->transform.rotation() * hit_normal;
+	}
+	surface = s;
+	return 1;
+}
+
 /*
  */
 Object *Engine::intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &normal) {
-	vec3 p,n;
+	int surface;
+	Material *material;
+	return intersection(line0,line1,point,normal,surface,material);
+}
+
+/* objects are found by the broadphase tree and tested from the nearest box
+ */
+Object *Engine::intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &normal,int &surface,Material *&material) {
+	
+	// buffers of the call, the intersection is reentrant
+	Object *stack_objects[ENGINE_NUM_CANDIDATES];
+	float stack_fractions[ENGINE_NUM_CANDIDATES];
+	int all_objects = ENGINE_NUM_CANDIDATES;
+	Object **objects = stack_objects;
+	float *fractions = stack_fractions;
+	
+	int num_objects = Broadphase::intersection(line0,line1,objects,fractions,all_objects);
+	if(num_objects > all_objects) {
+		all_objects = num_objects * 2;
+		objects = new Object*[all_objects];
+		fractions = new float[all_objects];
+		num_objects = Broadphase::intersection(line0,line1,objects,fractions,all_objects);
+		if(num_objects > all_objects) num_objects = all_objects;	// the physic thread
+	}
+	
+	// nearest boxes are the first
+	for(int i = 1; i < num_objects; i++) {
+		Object *o = objects[i];
+		float f = fractions[i];
+		int j = i;
+		for(; j > 0 && fractions[j - 1] > f; j--) {
+			objects[j] = objects[j - 1];
+			fractions[j] = fractions[j - 1];
+		}
+		objects[j] = o;
+		fractions[j] = f;
+	}
+	
+	vec3 dir = line1 - line0;
+	float nearest = 1.0f;
 	point = line1;
+	surface = -1;
+	material = NULL;
 	Object *object = NULL;
-	for(int i = 0; i < Bsp::num_visible_sectors; i++) {
-		Sector *s = Bsp::visible_sectors[i];
-		for(int j = 0; j < s->num_visible_objects; j++) {
-			Object *o = s->visible_objects[j];
-			if(o->is_identity) {
-				if(o->intersection(line0,point,p,n)) {
-					point = p;
-					normal = n;
-					object = o;
-				}
-			} else {
-				vec3 l0 = o->itransform * line0;
-				vec3 l1 = o->itransform * point;
-				if(o->intersection(l0,l1,p,n)) {
-					point = o->transform * p;
-					normal = o->transform.rotation() * n;
-					object = o;
-				}
+	for(int i = 0; i < num_objects && fractions[i] <= nearest; i++) {
+		Object *o = objects[i];
+		if(intersection_object(o,line0,point,normal,surface) == 0) continue;
+		nearest = (point - line0) * dir / (dir * dir);
+		material = o->materials[surface];
+		object = o;
+	}
+	
+	if(objects != stack_objects) {
+		delete [] objects;
+		delete [] fractions;
+	}
+	
+	return object;
+}
+
+/* segments are traced by the packets through the broadphase tree
+ */
+int Engine::intersection(const vec3 *line0,const vec3 *line1,int num,Object **objects,vec3 *points,int any) {
+	
+	// buffers of the call, the intersection is reentrant
+	Object *stack_candidates[ENGINE_NUM_CANDIDATES];
+	int stack_masks[ENGINE_NUM_CANDIDATES];
+	float stack_fractions[ENGINE_NUM_CANDIDATES * Broadphase::NUM_PACKET];
+	int all_candidates = ENGINE_NUM_CANDIDATES;
+	Object **candidates = stack_candidates;
+	int *masks = stack_masks;
+	float *fractions = stack_fractions;
+	
+	int num_hits = 0;
+	for(int i = 0; i < num; i += Broadphase::NUM_PACKET) {
+		
+		int num_lines = num - i < Broadphase::NUM_PACKET ? num - i : Broadphase::NUM_PACKET;
+		int mask = (1 << num_lines) - 1;
+		
+		int num_candidates = Broadphase::intersection(line0 + i,line1 + i,mask,candidates,masks,fractions,all_candidates);
+		if(num_candidates > all_candidates) {
+			if(candidates != stack_candidates) {
+				delete [] candidates;
+				delete [] masks;
+				delete [] fractions;
+			}
+			all_candidates = num_candidates * 2;
+			candidates = new Object*[all_candidates];
+			masks = new int[all_candidates];
+			fractions = new float[all_candidates * Broadphase::NUM_PACKET];
+			num_candidates = Broadphase::intersection(line0 + i,line1 + i,mask,candidates,masks,fractions,all_candidates);
+			if(num_candidates > all_candidates) num_candidates = all_candidates;	// the physic thread
+		}
+		
+		float nearest[Broadphase::NUM_PACKET];
+		for(int j = 0; j < num_lines; j++) {
+			objects[i + j] = NULL;
+			points[i + j] = line1[i + j];
+			nearest[j] = 1.0f;
+		}
+		
+		for(int j = 0; j < num_candidates && mask; j++) {
+			Object *o = candidates[j];
+			int m = masks[j] & mask;
+			for(int k = 0; k < num_lines; k++) {
+				if((m & (1 << k)) == 0 || fractions[j * Broadphase::NUM_PACKET + k] > nearest[k]) continue;
+				vec3 normal;
+				int surface;
+				if(intersection_object(o,line0[i + k],points[i + k],normal,surface) == 0) continue;
+				vec3 dir = line1[i + k] - line0[i + k];
+				nearest[k] = (points[i + k] - line0[i + k]) * dir / (dir * dir);
+				if(objects[i + k] == NULL) num_hits++;
+				objects[i + k] = o;
+				if(any) mask &= ~(1 << k);	// the segment is done
 			}
 		}
 	}
-	return object;
+	
+	if(candidates != stack_candidates) {
+		delete [] candidates;
+		delete [] masks;
+		delete [] fractions;
+	}
+	
+	return num_hits;
 }
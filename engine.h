@@ -48,6 +48,7 @@
 class PBuffer;
 class Console;
 class Frustum;
+class Occlusion;
 class Bsp;
 class Mesh;
 class Light;
@@ -68,6 +69,7 @@ class Material;
 #define ENGINE_SHADOW_VOLUME_SHADER	"shadow_volume.shader"
 #define ENGINE_LOG_NAME				"Engine.log"
 #define ENGINE_GAP_SIZE				256
+#define ENGINE_NUM_CANDIDATES		256		// intersection candidates on the stack
 
 class Engine {
 public:
@@ -119,6 +121,12 @@ public:
 	
 	// intersection line with scene
 	static Object *intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &normal);
+	static Object *intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &normal,int &surface,Material *&material);
+	
+	// batch of segments, returns the number of the crossed segments
+	// objects are NULL and points are the ends for the segments without the intersection
+	// any intersection is enough for the visibility and the segment isn`t traced further
+	static int intersection(const vec3 *line0,const vec3 *line1,int num,Object **objects,vec3 *points,int any = 0);
 	
 	// renderer info
 	static char *vendor;
@@ -140,6 +148,7 @@ public:
 	// objects
 	static Position camera;
 	static Frustum *frustum;
+	static Occlusion *occlusion;
 	
 	static Bsp *bsp;
 	
@@ -206,8 +215,12 @@ public:
 	static int show_shadows_toggle;
 	static int fog_toggle;
 	static int mirror_toggle;
+	static int occlusion_toggle;
 	static int physic_toggle;
 	
+	// physic only mode without OpenGL context
+	static int headless;
+	
 	// path
 	static std::vector<char*> path;
 	
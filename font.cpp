@@ -22,7 +22,9 @@
 #include "texture.h"
 #include "font.h"
 
-Font::Font(const char *name) {
+Font::Font(const char *name) : tex_id(0), list_id(0) {
+	
+	if(!name) return;	// headless console
 	
 	int width,height;
 	unsigned char *data = Texture::load(name,width,height);
@@ -97,8 +99,8 @@ Font::Font(const char *name) {
 }
 
 Font::~Font() {
-	glDeleteTextures(1,&tex_id);
-	glDeleteLists(256,list_id);
+	if(tex_id) glDeleteTextures(1,&tex_id);
+	if(list_id) glDeleteLists(256,list_id);
 }
 
 /*
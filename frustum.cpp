@@ -17,16 +17,28 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#define USE_SSE
+#include <xmmintrin.h>
 #include "engine.h"
+#include "collide.h"
 #include "bsp.h"
 #include "frustum.h"
 
-Frustum::Frustum() : num_planes(6), depth(0) {
-	planes = new vec4[6 + DEPTH * 5];
+int Frustum::num_visible;
+int Frustum::num_culled;
+int Frustum::num_tests;
+int Frustum::num_saved_tests;
+int Frustum::num_inside;
+
+Frustum::Frustum() : num_planes(6), depth(0), all_depth(8) {
+	windows = new Window[all_depth];
+	windows[0].num_planes = 6;
+	windows[0].num_edges = 0;
+	planes = windows[0].planes;
 }
 
 Frustum::~Frustum() {
-	delete planes;
+	delete [] windows;
 }
 
 /*
@@ -48,69 +60,223 @@ void Frustum::set(const mat4 &m) {
 	PLANE(5,m[3]+m[2],m[7]+m[6],m[11]+m[10],m[15]+m[14])
 #undef PLANE
 	num_planes = 6;
+	windows[depth].num_planes = 6;
+	windows[depth].num_edges = 0;
 }
 
-/*
+/* the part of the polygon in front of the plane
  */
-void Frustum::addPortal(const vec3 &point,const vec3 *points) {
-	depth++;
-	if(depth > DEPTH) {
-		fprintf(stderr,"Frustum::addPortal(): stack overflow\n");
-		return;
+int Frustum::clip(vec3 *polygon,int num,const vec4 &plane) {
+	vec3 points[NUM_WINDOW_POINTS];
+	int ret = 0;
+	for(int i = 0; i < num; i++) {
+		int j = (i + 1) % num;
+		float d0 = plane * polygon[i];
+		float d1 = plane * polygon[j];
+		if(d0 >= 0.0f) points[ret++] = polygon[i];
+		if((d0 >= 0.0f) != (d1 >= 0.0f)) points[ret++] = polygon[i] + (polygon[j] - polygon[i]) * (d0 / (d0 - d1));
 	}
-#define PLANE(n,v0,v1,v2) { \
-	vec3 normal; \
-	normal.cross(v1 - v0,v2 - v0); \
-	normal.normalize(); \
-	planes[n] = vec4(normal,-normal * v0); \
-}
-	if((Engine::camera - points[0]) * cross(points[1] - points[0],points[2] - points[0]) < 0.0) {
-		PLANE(num_planes + 0,point,points[0],points[1]);
-		PLANE(num_planes + 1,point,points[1],points[2]);
-		PLANE(num_planes + 2,point,points[2],points[3]);
-		PLANE(num_planes + 3,point,points[3],points[0]);
-		PLANE(num_planes + 4,points[0],points[1],points[2]);
-	} else {
-		PLANE(num_planes + 0,point,points[0],points[3]);
-		PLANE(num_planes + 1,point,points[3],points[2]);
-		PLANE(num_planes + 2,point,points[2],points[1]);
-		PLANE(num_planes + 3,point,points[1],points[0]);
-		PLANE(num_planes + 4,points[2],points[1],points[0]);
+	if(ret < 3) return 0;
+	for(int i = 0; i < ret; i++) polygon[i] = points[i];
+	return ret;
+}
+
+/* the portal is clipped by the near plane and by the edges of the current window,
+ * the new window keeps the edges of the clipped portal instead of adding them
+ */
+int Frustum::addPortal(const vec3 &point,const vec3 *points) {
+	if(depth + 1 == all_depth) {
+		Window *w = new Window[all_depth * 2];
+		for(int i = 0; i < all_depth; i++) w[i] = windows[i];
+		delete [] windows;
+		windows = w;
+		all_depth *= 2;
 	}
-#undef PLANE
-	num_planes += 5;
+	Window *parent = &windows[depth];
+	Window *window = &windows[++depth];
+	planes = window->planes;
+	
+	for(int i = 0; i < 6; i++) window->planes[i] = parent->planes[i];
+	num_planes = 6;
+	
+	vec3 polygon[NUM_WINDOW_POINTS];
+	for(int i = 0; i < 4; i++) polygon[i] = points[i];
+	int num_points = clip(polygon,4,parent->planes[5]);
+	for(int i = 0; i < parent->num_edges && num_points; i++) {
+		if(num_points == NUM_WINDOW_POINTS) {
+			num_points = -1;
+			break;
+		}
+		num_points = clip(polygon,num_points,parent->planes[6 + i]);
+	}
+	
+	if(num_points > 0) {
+		vec3 center = polygon[0];
+		for(int i = 1; i < num_points; i++) center += polygon[i];
+		center /= (float)num_points;
+		for(int i = 0; i < num_points; i++) {
+			vec3 normal = cross(polygon[i] - point,polygon[(i + 1) % num_points] - point);
+			if(normal.normalize() < EPSILON) continue;
+			vec4 &plane = window->planes[num_planes++];
+			plane = vec4(normal,-(normal * point));
+			if(plane * center < 0.0f) plane = -plane;
+		}
+	} else if(num_points < 0) {
+		// too many points, the portal is inside the previous window
+		for(int i = 0; i < parent->num_edges; i++) window->planes[num_planes++] = parent->planes[6 + i];
+	}
+	window->num_edges = num_planes - 6;
+	
+	if(window->num_edges == 0) {
+		// nothing is inside
+		window->planes[num_planes++] = vec4(0,0,0,-1);
+		window->num_planes = num_planes;
+		return 0;
+	}
+	
+	vec3 normal = cross(points[1] - points[0],points[2] - points[0]);
+	normal.normalize();
+	vec4 &plane = window->planes[num_planes++];
+	plane = vec4(normal,-(normal * points[0]));
+	if(plane * point > 0.0f) plane = -plane;
+	
+	window->num_planes = num_planes;
+	return 1;
 }
 
 void Frustum::removePortal() {
 	if(depth > 0) {
 		depth--;
-		num_planes -= 5;
+		planes = windows[depth].planes;
+		num_planes = windows[depth].num_planes;
 	}
 }
 
+/*
+ */
+int Frustum::getNumPlanes() {
+	return num_planes;
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* inside                                                                    */
 /*                                                                           */
 /*****************************************************************************/
 
-/*
+/* the p-vertex is the corner farthest along the plane normal, the n-vertex is the nearest one
  */
 int Frustum::inside(const vec3 &min,const vec3 &max) {
 	for(int i = 0; i < num_planes; i++) {
-		if(planes[i] * vec4(min[0],min[1],min[2],1) > 0) continue;
-		if(planes[i] * vec4(min[0],min[1],max[2],1) > 0) continue;
-		if(planes[i] * vec4(min[0],max[1],min[2],1) > 0) continue;
-		if(planes[i] * vec4(min[0],max[1],max[2],1) > 0) continue;
-		if(planes[i] * vec4(max[0],min[1],min[2],1) > 0) continue;
-		if(planes[i] * vec4(max[0],min[1],max[2],1) > 0) continue;
-		if(planes[i] * vec4(max[0],max[1],min[2],1) > 0) continue;
-		if(planes[i] * vec4(max[0],max[1],max[2],1) > 0) continue;
-		return 0;
+		const vec4 &p = planes[i];
+		vec3 v(p.x > 0 ? max.x : min.x,p.y > 0 ? max.y : min.y,p.z > 0 ? max.z : min.z);
+		if(p * v <= 0) return 0;
 	}
 	return 1;
 }
 
+/* the planes which the box is fully inside are removed from the mask
+ * the bits without planes are cleared, so the mask is zero for the box inside the frustum
+ */
+int Frustum::inside(const vec3 &min,const vec3 &max,int &mask) {
+	if(num_planes < 32) mask &= (1 << num_planes) - 1;
+	for(int i = 0; i < num_planes; i++) {
+		int bit = i < 32 ? 1 << i : 0;
+		if(bit && (mask & bit) == 0) {
+			num_saved_tests++;
+			continue;
+		}
+		num_tests++;
+		const vec4 &p = planes[i];
+		vec3 v(p.x > 0 ? max.x : min.x,p.y > 0 ? max.y : min.y,p.z > 0 ? max.z : min.z);
+		if(p * v <= 0) {
+			num_culled++;
+			return 0;
+		}
+		v = vec3(p.x > 0 ? min.x : max.x,p.y > 0 ? min.y : max.y,p.z > 0 ? min.z : max.z);
+		if(p * v >= 0) mask &= ~bit;
+	}
+	num_visible++;
+	return 1;
+}
+
+/* the boxes are tested by four, the visible ones are returned with their masks
+ */
+int Frustum::inside(const Bounds *bounds,int num,int mask,int *indices,int *masks) {
+	
+	if(num_planes < 32) mask &= (1 << num_planes) - 1;
+	
+	// the p and n vertexes of the planes are offsets in the bounds
+	int num_tested = 0;
+	int bits[NUM_PLANES];
+	int offsets[NUM_PLANES][6];
+	const vec4 *tested[NUM_PLANES];
+	for(int i = 0; i < num_planes; i++) {
+		int bit = i < 32 ? 1 << i : 0;
+		if(bit && (mask & bit) == 0) continue;
+		const vec4 &p = planes[i];
+		for(int j = 0; j < 3; j++) {
+			offsets[num_tested][j] = (p[j] > 0 ? 12 : 0) + j * 4;
+			offsets[num_tested][j + 3] = (p[j] > 0 ? 0 : 12) + j * 4;
+		}
+		bits[num_tested] = bit;
+		tested[num_tested++] = &p;
+	}
+	
+	int simd = Collide::simd;
+	int ret = 0;
+	for(int i = 0; i < num; i += 4) {
+		const float *b = (const float*)&bounds[i / 4];
+		int num_lanes = num - i < 4 ? num - i : 4;
+		int lanes = (1 << num_lanes) - 1;
+		int outside = 0;
+		int m[4] = { mask, mask, mask, mask };
+		for(int j = 0; j < num_tested && (outside & lanes) != lanes; j++) {
+			num_tests += num_lanes;
+			const vec4 &p = *tested[j];
+			const int *o = offsets[j];
+			int in = 0;
+#ifdef USE_SSE
+			if(simd) {
+				__m128 x = _mm_set1_ps(p.x);
+				__m128 y = _mm_set1_ps(p.y);
+				__m128 z = _mm_set1_ps(p.z);
+				__m128 w = _mm_set1_ps(p.w);
+				__m128 zero = _mm_setzero_ps();
+				__m128 dp = _mm_mul_ps(x,_mm_loadu_ps(b + o[0]));
+				dp = _mm_add_ps(dp,_mm_mul_ps(y,_mm_loadu_ps(b + o[1])));
+				dp = _mm_add_ps(dp,_mm_mul_ps(z,_mm_loadu_ps(b + o[2])));
+				outside |= _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(dp,w),zero));
+				if(bits[j] == 0) continue;
+				__m128 dn = _mm_mul_ps(x,_mm_loadu_ps(b + o[3]));
+				dn = _mm_add_ps(dn,_mm_mul_ps(y,_mm_loadu_ps(b + o[4])));
+				dn = _mm_add_ps(dn,_mm_mul_ps(z,_mm_loadu_ps(b + o[5])));
+				in = _mm_movemask_ps(_mm_cmpge_ps(_mm_add_ps(dn,w),zero));
+			} else
+#endif
+			{
+				for(int k = 0; k < 4; k++) {
+					if(p.x * b[o[0] + k] + p.y * b[o[1] + k] + p.z * b[o[2] + k] + p.w <= 0) outside |= 1 << k;
+					if(p.x * b[o[3] + k] + p.y * b[o[4] + k] + p.z * b[o[5] + k] + p.w >= 0) in |= 1 << k;
+				}
+			}
+			for(int k = 0; k < 4; k++) {
+				m[k] &= ~(bits[j] & -((in >> k) & 1));
+			}
+		}
+		int visible = lanes & ~outside;
+		for(int k = 0; k < 4 && ret < num; k++) {
+			indices[ret] = i + k;
+			masks[ret] = m[k];
+			ret += (visible >> k) & 1;
+		}
+	}
+	num_visible += ret;
+	num_culled += num - ret;
+	num_saved_tests += (num_planes - num_tested) * num;
+	return ret;
+}
+
 int Frustum::inside(const vec3 &center,float radius) {
 	for(int i = 0; i < num_planes; i++) {
 		if(planes[i] * vec4(center,1) < -radius) return 0;
@@ -168,14 +334,9 @@ int Frustum::inside(const vec3 &light,float light_radius,const vec3 &center,floa
  */
 int Frustum::inside_all(const vec3 &min,const vec3 &max) {
 	for(int i = 0; i < num_planes; i++) {
-		if(planes[i] * vec4(min[0],min[1],min[2],1) < 0) return 0;
-		if(planes[i] * vec4(min[0],min[1],max[2],1) < 0) return 0;
-		if(planes[i] * vec4(min[0],max[1],min[2],1) < 0) return 0;
-		if(planes[i] * vec4(min[0],max[1],max[2],1) < 0) return 0;
-		if(planes[i] * vec4(max[0],min[1],min[2],1) < 0) return 0;
-		if(planes[i] * vec4(max[0],min[1],max[2],1) < 0) return 0;
-		if(planes[i] * vec4(max[0],max[1],min[2],1) < 0) return 0;
-		if(planes[i] * vec4(max[0],max[1],max[2],1) < 0) return 0;
+		const vec4 &p = planes[i];
+		vec3 v(p.x > 0 ? min.x : max.x,p.y > 0 ? min.y : max.y,p.z > 0 ? min.z : max.z);
+		if(p * v < 0) return 0;
 	}
 	return 1;
 }
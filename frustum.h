@@ -33,9 +33,12 @@ public:
 	void get();
 	void set(const mat4 &m);
 	
-	void addPortal(const vec3 &point,const vec3 *points);
+	// zero if nothing can be seen through the portal
+	int addPortal(const vec3 &point,const vec3 *points);
 	void removePortal();
 	
+	int getNumPlanes();
+	
 	int inside(const vec3 &min,const vec3 &max);
 	int inside(const vec3 &center,float radius);
 	int inside(const vec3 *points,int num);
@@ -43,15 +46,44 @@ public:
 	int inside_all(const vec3 &min,const vec3 &max);
 	int inside_all(const vec3 &center,float radius);
 	
+	struct Bounds {				// four boxes in the SIMD layout
+		float min[3][4];
+		float max[3][4];
+	};
+	
+	// bit i of the mask is the i-th plane, planes after the 32-th are always tested
+	int inside(const vec3 &min,const vec3 &max,int &mask);
+	int inside(const Bounds *bounds,int num,int mask,int *indices,int *masks);
+	
+	static int num_visible;		// boxes tested for the frame
+	static int num_culled;
+	static int num_tests;		// plane tests done and skipped by the masks
+	static int num_saved_tests;
+	static int num_inside;		// boxes inside all planes, their subtrees aren`t tested
+
 protected:
 	
 	enum {
-		DEPTH = 16,
+		NUM_WINDOW_POINTS = 16,	// points of the clipped portal
+		NUM_PLANES = 6 + NUM_WINDOW_POINTS + 1,
 	};
 	
+	// the visible part of the portal is a cone from the camera
+	// inside the cone of the previous portal
+	struct Window {
+		int num_planes;			// the screen planes, the edges and the portal plane
+		int num_edges;			// the edge planes are after the screen planes
+		vec4 planes[NUM_PLANES];
+	};
+	
+	static int clip(vec3 *polygon,int num,const vec4 &plane);
+	
 	int num_planes;
 	vec4 *planes;
-	int depth;
+	
+	int depth;					// stack of the windows
+	int all_depth;
+	Window *windows;
 };
 
 #endif /* __FRUSTUM_H__ */
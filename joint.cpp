@@ -23,7 +23,10 @@
 #include "rigidbody.h"
 #include "joint.h"
 
-Joint::Joint(RigidBody *rigidbody_0,RigidBody *rigidbody_1) : rigidbody_0(rigidbody_0), rigidbody_1(rigidbody_1) {
+Joint::Joint(RigidBody *rigidbody_0,RigidBody *rigidbody_1) : rigidbody_0(rigidbody_0), rigidbody_1(rigidbody_1), chain(NULL),
+	restriction_min_dist(JOINT_DIST * 2.0f) {
+	
+	Physic::wait();
 	
 	if(rigidbody_0->num_joints == RigidBody::NUM_JOINTS || rigidbody_1->num_joints == RigidBody::NUM_JOINTS) {
 		rigidbody_0 = NULL;
@@ -38,16 +41,43 @@ Joint::Joint(RigidBody *rigidbody_0,RigidBody *rigidbody_1) : rigidbody_0(rigidb
 	rigidbody_1->joints[rigidbody_1->num_joints] = this;
 	rigidbody_1->joined_rigidbodies[rigidbody_1->num_joints++] = rigidbody_0;
 	
+	rigidbody_0->wake();
+	rigidbody_1->wake();
+	
 	Joint **j = new Joint*[++Physic::all_joints];
 	memcpy(j,Physic::joints,sizeof(Joint*) * (Physic::all_joints - 1));
 	if(Physic::joints) delete Physic::joints;
 	Physic::joints = j;
+	
+	j = new Joint*[Physic::all_joints];
+	memcpy(j,Physic::next_joints,sizeof(Joint*) * (Physic::all_joints - 1));
+	if(Physic::next_joints) delete Physic::next_joints;
+	Physic::next_joints = j;
 }
 
 Joint::~Joint() {
 	
+	if(chain) chain->removeJoint(this);
+	
 	if(!rigidbody_0 || !rigidbody_1) return;
 	
+	Physic::wait();
+	
+	// the joint isn`t solved anymore
+	int num = 0;
+	for(int i = 0; i < Physic::num_joints; i++) {
+		if(Physic::joints[i] != this) Physic::joints[num++] = Physic::joints[i];
+	}
+	Physic::num_joints = num;
+	num = 0;
+	for(int i = 0; i < Physic::num_next_joints; i++) {
+		if(Physic::next_joints[i] != this) Physic::next_joints[num++] = Physic::next_joints[i];
+	}
+	Physic::num_next_joints = num;
+	
+	rigidbody_0->wake();
+	rigidbody_1->wake();
+	
 	for(int i = 0, j = 0; i < rigidbody_0->num_joints; i++) {
 		if(i != j) {
 			rigidbody_0->joints[j] = rigidbody_0->joints[i];
@@ -70,6 +100,8 @@ Joint::~Joint() {
 	else {
 		delete Physic::joints;
 		Physic::joints = NULL;
+		delete Physic::next_joints;
+		Physic::next_joints = NULL;
 	}
 }
 
@@ -82,6 +114,12 @@ int Joint::response(float) {
 
 /*
  */
+int Joint::chain_rows(vec3*,vec3*,vec3*) {
+	return 0;
+}
+
+/* returns 1 when the restriction is satisfied
+ */
 int Joint::restriction_response(float ifps,const vec3 &point_0,const vec3 &point_1,float min_dist) {
 	
 	if(min_dist == JOINT_DIST * 2.0f) return 1;
@@ -109,13 +147,13 @@ int Joint::restriction_response(float ifps,const vec3 &point_0,const vec3 &point
 		+ normal * cross(rigidbody_0->iWorldInertiaTensor * cross(r0,normal),r0)
 		+ normal * cross(rigidbody_1->iWorldInertiaTensor * cross(r1,normal),r1);
 	
-	if(rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
-	if(rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
 	
-	if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
-	if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
 	
-	return 0;
+	return fabs(impulse_numerator) < Physic::residual_threshold;
 }
 
 /*****************************************************************************/
@@ -171,11 +209,11 @@ int JointBall::response(float ifps) {
 		+ normal * cross(rigidbody_0->iWorldInertiaTensor * cross(r0,normal),r0)
 		+ normal * cross(rigidbody_1->iWorldInertiaTensor * cross(r1,normal),r1);
 	
-	if(rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
-	if(rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
 	
-	if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
-	if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+	if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
 	
 	// angle restriction
 	restriction_response(ifps,restriction_point_0,restriction_point_1,restriction_min_dist);
@@ -183,6 +221,24 @@ int JointBall::response(float ifps) {
 	return 0;
 }
 
+/*
+ */
+int JointBall::chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals) {
+	
+	vec3 p0 = rigidbody_0->transform * point_0;
+	vec3 p1 = rigidbody_1->transform * point_1;
+	
+	for(int i = 0; i < 3; i++) {
+		points_0[i] = p0;
+		points_1[i] = p1;
+	}
+	normals[0] = vec3(1,0,0);
+	normals[1] = vec3(0,1,0);
+	normals[2] = vec3(0,0,1);
+	
+	return 3;
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* JointHinge                                                                 */
@@ -282,11 +338,11 @@ int JointHinge::response(float ifps) {
 			+ normal * cross(rigidbody_0->iWorldInertiaTensor * cross(r0,normal),r0)
 			+ normal * cross(rigidbody_1->iWorldInertiaTensor * cross(r1,normal),r1);
 		
-		if(rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
-		if(rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
 		
-		if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
-		if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
 	}
 	
 	// angle restriction
@@ -295,6 +351,35 @@ int JointHinge::response(float ifps) {
 	return 0;
 }
 
+/* the second points are bound only across the hinge axis,
+ * the rotation around the axis is free
+ */
+int JointHinge::chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals) {
+	
+	vec3 p0 = rigidbody_0->transform * point_00;
+	vec3 p1 = rigidbody_1->transform * point_01;
+	
+	for(int i = 0; i < 3; i++) {
+		points_0[i] = p0;
+		points_1[i] = p1;
+	}
+	normals[0] = vec3(1,0,0);
+	normals[1] = vec3(0,1,0);
+	normals[2] = vec3(0,0,1);
+	
+	vec3 axis = rigidbody_0->transform * point_10 - p0;
+	axis.normalize();
+	vec3 tangent = cross(axis,fabs(axis.x) < 0.7f ? vec3(1,0,0) : vec3(0,1,0));
+	tangent.normalize();
+	
+	points_0[3] = points_0[4] = rigidbody_0->transform * point_10;
+	points_1[3] = points_1[4] = rigidbody_1->transform * point_11;
+	normals[3] = tangent;
+	normals[4] = cross(axis,tangent);
+	
+	return 5;
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /* JointUniversal                                                            */
@@ -380,11 +465,11 @@ int JointUniversal::response(float ifps) {
 			+ normal * cross(rigidbody_0->iWorldInertiaTensor * cross(r0,normal),r0)
 			+ normal * cross(rigidbody_1->iWorldInertiaTensor * cross(r1,normal),r1);
 		
-		if(rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
-		if(rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
 		
-		if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->addImpulse(p1,-normal * impulse_numerator / impulse_denominator);
-		if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->addImpulse(p0,normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_0->immovable && rigidbody_1->immovable == 0) rigidbody_1->applyImpulse(p1,-normal * impulse_numerator / impulse_denominator);
+		if(rigidbody_1->immovable && rigidbody_0->immovable == 0) rigidbody_0->applyImpulse(p0,normal * impulse_numerator / impulse_denominator);
 	}
 	
 	// angle restriction
@@ -392,3 +477,249 @@ int JointUniversal::response(float ifps) {
 	
 	return 0;
 }
+
+/*
+ */
+int JointUniversal::chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals) {
+	
+	vec3 p0 = rigidbody_0->transform * point_00;
+	vec3 p1 = rigidbody_1->transform * point_01;
+	
+	for(int i = 0; i < 3; i++) {
+		points_0[i] = p0;
+		points_1[i] = p1;
+	}
+	normals[0] = vec3(1,0,0);
+	normals[1] = vec3(0,1,0);
+	normals[2] = vec3(0,0,1);
+	
+	vec3 ax0 = rigidbody_0->transform.rotation() * axis_1;
+	vec3 ax1 = rigidbody_1->transform.rotation() * axis_1;
+	
+	vec3 a = ax0 + ax1;
+	if(a.normalize() < EPSILON) return 3;
+	
+	points_0[3] = rigidbody_0->transform * point_10;
+	points_1[3] = rigidbody_1->transform * point_11;
+	normals[3] = a;
+	
+	return 4;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* JointChain                                                                */
+/*                                                                           */
+/*****************************************************************************/
+
+JointChain::JointChain() : num_joints(0), joints(NULL), all_rows(0), num_rows(0), rows(NULL),
+	matrix(NULL), idiagonal(NULL), lambda(NULL), residual(0.0f) {
+
+}
+
+JointChain::~JointChain() {
+	
+	Physic::wait();
+	
+	for(int i = 0; i < num_joints; i++) {
+		joints[i]->chain = NULL;
+	}
+	
+	delete [] joints;
+	delete [] rows;
+	delete [] matrix;
+	delete [] idiagonal;
+	delete [] lambda;
+}
+
+/*
+ */
+void JointChain::addJoint(Joint *joint) {
+	
+	if(joint->chain == this) return;
+	if(joint->chain) joint->chain->removeJoint(joint);
+	
+	Physic::wait();
+	
+	Joint **j = new Joint*[num_joints + 1];
+	memcpy(j,joints,sizeof(Joint*) * num_joints);
+	delete [] joints;
+	joints = j;
+	joints[num_joints++] = joint;
+	joint->chain = this;
+	
+	if(all_rows < num_joints * JOINT_ROWS) {
+		delete [] rows;
+		delete [] matrix;
+		delete [] idiagonal;
+		delete [] lambda;
+		all_rows = num_joints * JOINT_ROWS;
+		rows = new Row[all_rows];
+		matrix = new float[all_rows * all_rows];
+		idiagonal = new float[all_rows];
+		lambda = new float[all_rows];
+	}
+}
+
+/*
+ */
+void JointChain::removeJoint(Joint *joint) {
+	
+	if(joint->chain != this) return;
+	
+	Physic::wait();
+	
+	for(int i = 0, j = 0; i < num_joints; i++) {
+		if(i != j) joints[j] = joints[i];
+		if(joints[i] != joint) j++;
+	}
+	num_joints--;
+	joint->chain = NULL;
+}
+
+/*
+ */
+int JointChain::getNumJoints() const {
+	return num_joints;
+}
+
+Joint *JointChain::getJoint(int num) const {
+	return joints[num];
+}
+
+/* rows and the effective mass matrix don`t change while the positions are the same,
+ * so the matrix is factorized once per solver pass
+ */
+void JointChain::factorize(float ifps) {
+	
+	num_rows = 0;
+	for(int i = 0; i < num_joints; i++) {
+		Joint *joint = joints[i];
+		
+		RigidBody *rb0 = joint->rigidbody_0;
+		RigidBody *rb1 = joint->rigidbody_1;
+		
+		vec3 points_0[JOINT_ROWS];
+		vec3 points_1[JOINT_ROWS];
+		vec3 normals[JOINT_ROWS];
+		float velocities[JOINT_ROWS];
+		int num = joint->chain_rows(points_0,points_1,normals);
+		
+		// drift of the joint is corrected with the penetration speed
+		for(int j = 0; j < num; j++) {
+			velocities[j] = -((points_0[j] - points_1[j]) * normals[j]) * Physic::penetration_speed / ifps;
+		}
+		
+		for(int j = 0; j < num; j++) {
+			Row *row = &rows[num_rows++];
+			
+			row->rigidbody_0 = (rb0->frozen || rb0->immovable) ? NULL : rb0;
+			row->rigidbody_1 = (rb1->frozen || rb1->immovable) ? NULL : rb1;
+			row->point_0 = points_0[j];
+			row->point_1 = points_1[j];
+			row->normal = normals[j];
+			row->angular_0 = cross(points_0[j] - rb0->pos,normals[j]);
+			row->angular_1 = cross(points_1[j] - rb1->pos,normals[j]);
+			row->iangular_0 = row->rigidbody_0 ? rb0->iWorldInertiaTensor * row->angular_0 : vec3(0,0,0);
+			row->iangular_1 = row->rigidbody_1 ? rb1->iWorldInertiaTensor * row->angular_1 : vec3(0,0,0);
+			
+			float velocity = velocities[j];
+			if(velocity > Physic::velocity_max) velocity = Physic::velocity_max;
+			else if(velocity < -Physic::velocity_max) velocity = -Physic::velocity_max;
+			row->velocity = velocity;
+		}
+	}
+	
+	// lower triangle of the effective mass matrix
+	for(int i = 0; i < num_rows; i++) {
+		Row *ri = &rows[i];
+		float *m = &matrix[num_rows * i];
+		for(int j = 0; j <= i; j++) {
+			Row *rj = &rows[j];
+			float k = 0.0f;
+			if(ri->rigidbody_0) {
+				float imass = 1.0f / ri->rigidbody_0->mass;
+				if(ri->rigidbody_0 == rj->rigidbody_0) k += ri->normal * rj->normal * imass + ri->iangular_0 * rj->angular_0;
+				if(ri->rigidbody_0 == rj->rigidbody_1) k -= ri->normal * rj->normal * imass + ri->iangular_0 * rj->angular_1;
+			}
+			if(ri->rigidbody_1) {
+				float imass = 1.0f / ri->rigidbody_1->mass;
+				if(ri->rigidbody_1 == rj->rigidbody_0) k -= ri->normal * rj->normal * imass + ri->iangular_1 * rj->angular_0;
+				if(ri->rigidbody_1 == rj->rigidbody_1) k += ri->normal * rj->normal * imass + ri->iangular_1 * rj->angular_1;
+			}
+			m[j] = k;
+		}
+	}
+	
+	// cholesky factorization, the dependent rows are left out
+	for(int i = 0; i < num_rows; i++) {
+		float *mi = &matrix[num_rows * i];
+		for(int j = 0; j < i; j++) {
+			float *mj = &matrix[num_rows * j];
+			float sum = mi[j];
+			for(int k = 0; k < j; k++) sum -= mi[k] * mj[k];
+			mi[j] = sum * idiagonal[j];
+		}
+		float sum = mi[i];
+		for(int k = 0; k < i; k++) sum -= mi[k] * mi[k];
+		if(sum > mi[i] * 1e-4f && sum > EPSILON * EPSILON) {
+			mi[i] = sqrt(sum);
+			idiagonal[i] = 1.0f / mi[i];
+		} else {
+			mi[i] = 0.0f;
+			idiagonal[i] = 0.0f;
+		}
+	}
+}
+
+/* the relative velocities of all rows are set at once,
+ * returns 1 when the chain doesn`t need more iterations
+ */
+int JointChain::response(float ifps,int update) {
+	
+	if(update) factorize(ifps);
+	
+	int done = 1;
+	
+	// the angle restrictions are one-sided, they aren`t in the rows
+	for(int i = 0; i < num_joints; i++) {
+		Joint *joint = joints[i];
+		if(joint->restriction_response(ifps,joint->restriction_point_0,joint->restriction_point_1,joint->restriction_min_dist) == 0) done = 0;
+	}
+	
+	// velocity errors of the rows
+	residual = 0.0f;
+	for(int i = 0; i < num_rows; i++) {
+		Row *row = &rows[i];
+		float velocity = 0.0f;
+		if(row->rigidbody_0) velocity += row->normal * row->rigidbody_0->velocity + row->angular_0 * row->rigidbody_0->angularVelocity;
+		if(row->rigidbody_1) velocity -= row->normal * row->rigidbody_1->velocity + row->angular_1 * row->rigidbody_1->angularVelocity;
+		lambda[i] = row->velocity - velocity;
+		if(idiagonal[i] != 0.0f && residual < fabs(lambda[i])) residual = fabs(lambda[i]);
+	}
+	if(residual < EPSILON) return done;
+	
+	// forward and back substitution
+	for(int i = 0; i < num_rows; i++) {
+		float *mi = &matrix[num_rows * i];
+		float sum = lambda[i];
+		for(int k = 0; k < i; k++) sum -= mi[k] * lambda[k];
+		lambda[i] = sum * idiagonal[i];
+	}
+	for(int i = num_rows - 1; i >= 0; i--) {
+		float sum = lambda[i];
+		for(int k = i + 1; k < num_rows; k++) sum -= matrix[num_rows * k + i] * lambda[k];
+		lambda[i] = sum * idiagonal[i];
+	}
+	
+	// impulses
+	for(int i = 0; i < num_rows; i++) {
+		if(lambda[i] == 0.0f) continue;
+		Row *row = &rows[i];
+		vec3 impulse = row->normal * lambda[i];
+		if(row->rigidbody_0) row->rigidbody_0->applyImpulse(row->point_0,impulse);
+		if(row->rigidbody_1) row->rigidbody_1->applyImpulse(row->point_1,-impulse);
+	}
+	
+	return done && residual < Physic::residual_threshold;
+}
@@ -23,9 +23,11 @@
 #include "mathlib.h"
 
 #define JOINT_DIST 10.0f
+#define JOINT_ROWS 5		// equality rows of the joint
 
 class Physic;
 class RigidBody;
+class JointChain;
 
 /*
  */
@@ -38,13 +40,23 @@ public:
 protected:
 	
 	friend class Physic;
+	friend class JointChain;
 	
 	virtual int response(float ifps);
 	
+	// equality rows of the joint for the chain solver
+	virtual int chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals);
+	
 	int restriction_response(float ifps,const vec3 &point_0,const vec3 &point_1,float min_dist);
 	
 	RigidBody *rigidbody_0;
 	RigidBody *rigidbody_1;
+	
+	JointChain *chain;
+	
+	vec3 restriction_point_0;
+	vec3 restriction_point_1;
+	float restriction_min_dist;
 };
 
 /*
@@ -58,13 +70,10 @@ public:
 protected:
 	
 	virtual int response(float ifps);
+	virtual int chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals);
 	
 	vec3 point_0;
 	vec3 point_1;
-
-	vec3 restriction_point_0;
-	vec3 restriction_point_1;
-	float restriction_min_dist;
 };
 
 /*
@@ -83,6 +92,7 @@ public:
 protected:
 	
 	virtual int response(float ifps);
+	virtual int chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals);
 	
 	vec3 point_00;
 	vec3 point_01;
@@ -95,10 +105,6 @@ protected:
 	vec3 axis_1;
 	mat4 itransform_0;
 	mat4 itransform_1;
-	
-	vec3 restriction_point_0;
-	vec3 restriction_point_1;
-	float restriction_min_dist;	
 };
 
 /*
@@ -112,6 +118,7 @@ public:
 protected:
 	
 	virtual int response(float ifps);
+	virtual int chain_rows(vec3 *points_0,vec3 *points_1,vec3 *normals);
 	
 	vec3 point_00;
 	vec3 point_01;
@@ -122,10 +129,56 @@ protected:
 	vec3 point;
 	vec3 axis_0;
 	vec3 axis_1;
+};
+
+/* joints of the articulated body are solved together
+ * the rows of all joints are solved directly,
+ * the one-sided angle restrictions are left to the iterations
+ */
+class JointChain {
+public:
 	
-	vec3 restriction_point_0;
-	vec3 restriction_point_1;
-	float restriction_min_dist;
+	JointChain();
+	~JointChain();
+	
+	void addJoint(Joint *joint);
+	void removeJoint(Joint *joint);
+	
+	int getNumJoints() const;
+	Joint *getJoint(int num) const;
+
+protected:
+	
+	friend class Physic;
+	
+	int response(float ifps,int update);
+	
+	void factorize(float ifps);
+	
+	int num_joints;
+	Joint **joints;
+	
+	struct Row {
+		RigidBody *rigidbody_0;		// NULL for the immovable rigidbody
+		RigidBody *rigidbody_1;
+		vec3 point_0;				// world space
+		vec3 point_1;
+		vec3 normal;
+		vec3 angular_0;				// cross(r,normal) of both rigidbodies
+		vec3 angular_1;
+		vec3 iangular_0;			// iWorldInertiaTensor * angular
+		vec3 iangular_1;
+		float velocity;				// target relative velocity along the normal
+	};
+	
+	int all_rows;
+	int num_rows;
+	Row *rows;
+	float *matrix;					// cholesky factor of the rows
+	float *idiagonal;				// inverse diagonal of the factor, zero for the dependent rows
+	float *lambda;
+	
+	float residual;
 };
 
 #endif /* __JOINT_H__ */
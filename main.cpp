@@ -36,6 +36,8 @@
 #include "rigidbody.h"
 #include "collide.h"
 #include "joint.h"
+#include "frustum.h"
+#include "occlusion.h"
 
 
 #ifdef GRAB
@@ -361,11 +363,11 @@ void GLAppMain::render() {
 			Engine::console->enable(1024,768);
 			vec3 c = modelview.inverse() * vec3(0,0,0);
 			glColor3f(0.19,0.0,0.82);
-			Engine::console->printf(13,35,"triangles: %d\nsectors %d\nlights %d\nrun \"help\" for more information\n%f %f %f",
-				Engine::num_triangles,Bsp::num_visible_sectors,Engine::num_visible_lights,c.x,c.y,c.z);
+			Engine::console->printf(13,35,"triangles: %d\nsectors %d\nlights %d\nboxes %d visible %d culled\nplanes %d tested %d saved\nocclusion %d triangles %d tested %d culled\nrun \"help\" for more information\n%f %f %f",
+				Engine::num_triangles,Bsp::num_visible_sectors,Engine::num_visible_lights,Frustum::num_visible,Frustum::num_culled,Frustum::num_tests,Frustum::num_saved_tests,Occlusion::num_triangles,Occlusion::num_tests,Occlusion::num_culled,c.x,c.y,c.z);
 			glColor3f(0.77,1.0,0.15);
-			Engine::console->printf(12,34,"triangles: %d\nsectors %d\nlights %d\nrun \"help\" for more information\n%f %f %f",
-				Engine::num_triangles,Bsp::num_visible_sectors,Engine::num_visible_lights,c.x,c.y,c.z);
+			Engine::console->printf(12,34,"triangles: %d\nsectors %d\nlights %d\nboxes %d visible %d culled\nplanes %d tested %d saved\nocclusion %d triangles %d tested %d culled\nrun \"help\" for more information\n%f %f %f",
+				Engine::num_triangles,Bsp::num_visible_sectors,Engine::num_visible_lights,Frustum::num_visible,Frustum::num_culled,Frustum::num_tests,Frustum::num_saved_tests,Occlusion::num_triangles,Occlusion::num_tests,Occlusion::num_culled,c.x,c.y,c.z);
 			Engine::console->disable();
 		}
 		
@@ -313,6 +313,7 @@ void Map::load_fog() {
 		else if(!strcmp(token,"color")) color = read_vec4();
 		else throw(error("unknown token \"%s\" in fog block",token));
 	}
+	if(Engine::headless) return;	// fogs are rendered only
 	if(mesh) Engine::addFog(new Fog(mesh,color));
 	else fprintf(stderr,"Map::load_fog(): can`t find mesh\n");
 }
@@ -325,15 +326,19 @@ void Map::load_mirror() {
 	while(1) {
 		const char *token = read_token();
 		if(!token || !strcmp(token,"}")) break;
-		else if(!strcmp(token,"mesh")) mirror = new Mirror(Engine::loadMesh(read_string()));
-		else if(mirror && !strcmp(token,"material")) {
+		else if(!strcmp(token,"mesh")) {
+			Mesh *mesh = Engine::loadMesh(read_string());
+			if(Engine::headless == 0) mirror = new Mirror(mesh);	// mirrors are rendered only
+		}
+		else if(!strcmp(token,"material")) {
 			const char *name = read_string();
-			mirror->bindMaterial(name,Engine::loadMaterial(read_string()));
+			Material *material = Engine::loadMaterial(read_string());
+			if(mirror) mirror->bindMaterial(name,material);
 		}
 		else throw(error("unknown token \"%s\" in mirror block",token));
 	}
 	if(mirror) Engine::addMirror(mirror);
-	else fprintf(stderr,"Map::load_mirror(): can`t find mesh\n");
+	else if(Engine::headless == 0) fprintf(stderr,"Map::load_mirror(): can`t find mesh\n");
 }
 
 /*
@@ -374,12 +379,15 @@ void Map::load_mesh() {
 					const char *collide = read_string();
 					if(!strcmp(collide,"mesh")) flag |= RigidBody::COLLIDE_MESH;
 					else if(!strcmp(collide,"sphere")) flag |= RigidBody::COLLIDE_SPHERE;
+					else if(!strcmp(collide,"shape")) flag |= RigidBody::COLLIDE_SHAPE;
+					else if(!strcmp(collide,"hull")) flag |= RigidBody::COLLIDE_HULL;
 					else throw(error("unknown collide \"%s\" in rigidbody block",collide));
 				} else if(!strcmp(token,"body")) {
 					const char *body = read_string();
 					if(!strcmp(body,"box")) flag |= RigidBody::BODY_BOX;
 					else if(!strcmp(body,"sphere")) flag |= RigidBody::BODY_SPHERE;
 					else if(!strcmp(body,"cylinder")) flag |= RigidBody::BODY_CYLINDER;
+					else if(!strcmp(body,"capsule")) flag |= RigidBody::BODY_CAPSULE;
 					else throw(error("unknown body \"%s\" in rigidbody block",body));
 				} else throw(error("unknown token \"%s\" in rigidbody block",token));
 			}
@@ -19,22 +19,33 @@
 
 #include "mesh.h"
 
-Mesh::Mesh() : num_surfaces(0) {
+Mesh::Mesh() : num_hull_vertex(0), hull_vertex(NULL), num_hull_planes(0), hull_planes(NULL), hull_failed(0), num_surfaces(0) {
 	min = vec3(1000000,1000000,1000000);
 	max = vec3(-1000000,-1000000,-1000000);
 	center = vec3(0,0,0);
 	radius = 1000000;
 }
 
-Mesh::Mesh(const char *name) : num_surfaces(0) {
+Mesh::Mesh(const char *name) : num_hull_vertex(0), hull_vertex(NULL), num_hull_planes(0), hull_planes(NULL), hull_failed(0), num_surfaces(0) {
 	load(name);
 }
 
-Mesh::Mesh(const Mesh *mesh) : num_surfaces(0) {
+Mesh::Mesh(const Mesh *mesh) : num_hull_vertex(0), hull_vertex(NULL), num_hull_planes(0), hull_planes(NULL), hull_failed(0), num_surfaces(0) {
 	min = mesh->min;
 	max = mesh->max;
 	center = mesh->center;
 	radius = mesh->radius;
+	hull_failed = mesh->hull_failed;
+	if(mesh->hull_vertex) {
+		num_hull_vertex = mesh->num_hull_vertex;
+		hull_vertex = new vec3[num_hull_vertex];
+		memcpy(hull_vertex,mesh->hull_vertex,sizeof(vec3) * num_hull_vertex);
+	}
+	if(mesh->hull_planes) {
+		num_hull_planes = mesh->num_hull_planes;
+		hull_planes = new vec4[num_hull_planes];
+		memcpy(hull_planes,mesh->hull_planes,sizeof(vec4) * num_hull_planes);
+	}
 	for(int i = 0; i < mesh->num_surfaces; i++) {
 		Surface *s = new Surface;
 		memcpy(s,mesh->surfaces[i],sizeof(Surface));
@@ -48,6 +59,14 @@ Mesh::Mesh(const Mesh *mesh) : num_surfaces(0) {
 			s->triangles = new Triangle[s->num_triangles];
 			memcpy(s->triangles,mesh->surfaces[i]->triangles,sizeof(Triangle) * s->num_triangles);
 		}
+		if(mesh->surfaces[i]->nodes) {
+			s->nodes = new BVHNode[s->num_nodes];
+			for(int j = 0; j < s->num_nodes; j++) s->nodes[j] = mesh->surfaces[i]->nodes[j];
+		}
+		if(mesh->surfaces[i]->packs) {
+			s->packs = new TrianglePack[s->num_packs];
+			memcpy(s->packs,mesh->surfaces[i]->packs,sizeof(TrianglePack) * s->num_packs);
+		}
 		if(mesh->surfaces[i]->indices) {
 			s->indices = new int[s->num_indices];
 			memcpy(s->indices,mesh->surfaces[i]->indices,sizeof(int) * s->num_indices);
@@ -73,6 +92,8 @@ Mesh::~Mesh() {
 		if(s->indices) delete s->indices;
 		if(s->edges) delete s->edges;
 		if(s->triangles) delete s->triangles;
+		if(s->nodes) delete s->nodes;
+		if(s->packs) delete s->packs;
 		if(s->silhouettes[0].vertex) {
 			for(int j = 0; j < NUM_SILHOUETTES; j++) {
 				delete s->silhouettes[j].vertex;
@@ -82,6 +103,8 @@ Mesh::~Mesh() {
 		delete s;
 	}
 	num_surfaces = 0;
+	if(hull_vertex) delete [] hull_vertex;
+	if(hull_planes) delete [] hull_planes;
 }
 
 /*****************************************************************************/
@@ -196,6 +219,31 @@ void Mesh::findSilhouette(const vec4 &light,int s) {
 	}
 }
 
+/* segment from line0 to line0 + dir * length with bvh node
+ */
+static int bvh_segment(const vec3 &min,const vec3 &max,const vec3 &line0,const vec3 &dir,float length) {
+	float t0 = 0.0;
+	float t1 = length;
+	for(int i = 0; i < 3; i++) {
+		if(fabs(dir[i]) < EPSILON) {
+			if(line0[i] < min[i] || line0[i] > max[i]) return 0;
+			continue;
+		}
+		float idir = 1.0f / dir[i];
+		float d0 = (min[i] - line0[i]) * idir;
+		float d1 = (max[i] - line0[i]) * idir;
+		if(d0 > d1) {
+			float d = d0;
+			d0 = d1;
+			d1 = d;
+		}
+		if(t0 < d0) t0 = d0;
+		if(t1 > d1) t1 = d1;
+		if(t0 > t1) return 0;
+	}
+	return 1;
+}
+
 int Mesh::getNumIntersections(const vec3 &line0,const vec3 &line1,int s) {
 	int num_intersections = 0;
 	if(s < 0) {
@@ -210,14 +258,7 @@ int Mesh::getNumIntersections(const vec3 &line0,const vec3 &line1,int s) {
 			if(dot < 0.0 && (line0 - s->center).length() > s->radius) continue;
 			else if(dot > 1.0 && (line1 - s->center).length() > s->radius) continue;
 			else if((line0 + dir * dot - s->center).length() > s->radius) continue;
-			for(int j = 0; j < s->num_triangles; j++) {
-				if(s->silhouette->flags[j] == 0) continue;
-				Triangle *t = &s->triangles[j];
-				float dot = -(t->plane * vec4(line0,1)) / (vec3(t->plane) * dir);
-				if(dot < 0.0 || dot > 1.0) continue;
-				vec3 p = line0 + dir * dot;
-				if(p * t->c[0] > 0.0 && p * t->c[1] > 0.0 && p * t->c[2] > 0.0) num_intersections++;
-			}
+			num_intersections += num_intersections_surface(s,line0,dir);
 		}
 		return num_intersections;
 	} else {
@@ -228,7 +269,28 @@ int Mesh::getNumIntersections(const vec3 &line0,const vec3 &line1,int s) {
 		if(dot < 0.0 && (line0 - s->center).length() > s->radius) return 0;
 		else if(dot > 1.0 && (line1 - s->center).length() > s->radius) return 0;
 		else if((line0 + dir * dot - s->center).length() > s->radius) return 0;
-		for(int i = 0; i < s->num_triangles; i++) {
+		return num_intersections_surface(s,line0,dir);
+	}
+}
+
+/*
+ */
+int Mesh::num_intersections_surface(Surface *s,const vec3 &line0,const vec3 &dir) {
+	if(s->num_nodes == 0) return 0;
+	int num_intersections = 0;
+	int stack[NUM_BVH_STACK];
+	int num_stack = 0;
+	stack[num_stack++] = 0;
+	while(num_stack) {
+		int id = stack[--num_stack];
+		BVHNode *node = &s->nodes[id];
+		if(bvh_segment(node->min,node->max,line0,dir,1.0) == 0) continue;
+		if(node->num_triangles == 0) {
+			stack[num_stack++] = node->right;
+			stack[num_stack++] = id + 1;
+			continue;
+		}
+		for(int i = node->first; i < node->first + node->num_triangles; i++) {
 			if(s->silhouette->flags[i] == 0) continue;
 			Triangle *t = &s->triangles[i];
 			float dot = -(t->plane * vec4(line0,1)) / (vec3(t->plane) * dir);
@@ -236,8 +298,8 @@ int Mesh::getNumIntersections(const vec3 &line0,const vec3 &line1,int s) {
 			vec3 p = line0 + dir * dot;
 			if(p * t->c[0] > 0.0 && p * t->c[1] > 0.0 && p * t->c[2] > 0.0) num_intersections++;
 		}
-		return num_intersections;
 	}
+	return num_intersections;
 }
 
 int Mesh::renderShadowVolume(int) {
@@ -265,17 +327,7 @@ int Mesh::intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &nor
 			if(dot < 0.0 && (line0 - s->center).length() > s->radius) continue;
 			else if(dot > 1.0 && (line1 - s->center).length() > s->radius) continue;
 			else if((line0 + dir * dot - s->center).length() > s->radius) continue;
-			for(int j = 0; j < s->num_triangles; j++) {
-				Triangle *t = &s->triangles[j];
-				float dot = -(t->plane * vec4(line0,1)) / (vec3(t->plane) * dir);
-				if(dot < 0.0 || dot > 1.0) continue;
-				vec3 p = line0 + dir * dot;
-				if(nearest > dot && p * t->c[0] > 0.0 && p * t->c[1] > 0.0 && p * t->c[2] > 0.0) {
-					nearest = dot;
-					point = p;
-					normal = t->plane;
-				}
-			}
+			intersection_surface(s,line0,dir,nearest,point,normal);
 		}
 		return nearest < 2.0 ? 1 : 0;
 	} else {
@@ -286,7 +338,35 @@ int Mesh::intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &nor
 		if(dot < 0.0 && (line0 - s->center).length() > s->radius) return 0;
 		else if(dot > 1.0 && (line1 - s->center).length() > s->radius) return 0;
 		else if((line0 + dir * dot - s->center).length() > s->radius) return 0;
-		for(int i = 0; i < s->num_triangles; i++) {
+		intersection_surface(s,line0,dir,nearest,point,normal);
+		return nearest < 2.0 ? 1 : 0;
+	}
+}
+
+/*
+ */
+void Mesh::intersection_surface(Surface *s,const vec3 &line0,const vec3 &dir,float &nearest,vec3 &point,vec3 &normal) {
+	if(s->num_nodes == 0) return;
+	int stack[NUM_BVH_STACK];
+	int num_stack = 0;
+	stack[num_stack++] = 0;
+	while(num_stack) {
+		int id = stack[--num_stack];
+		BVHNode *node = &s->nodes[id];
+		if(bvh_segment(node->min,node->max,line0,dir,nearest < 1.0 ? nearest : 1.0) == 0) continue;
+		if(node->num_triangles == 0) {
+			BVHNode *left = &s->nodes[id + 1];	// the nearest child is the first
+			BVHNode *right = &s->nodes[node->right];
+			if((left->min + left->max - right->min - right->max) * dir > 0.0) {
+				stack[num_stack++] = id + 1;
+				stack[num_stack++] = node->right;
+			} else {
+				stack[num_stack++] = node->right;
+				stack[num_stack++] = id + 1;
+			}
+			continue;
+		}
+		for(int i = node->first; i < node->first + node->num_triangles; i++) {
 			Triangle *t = &s->triangles[i];
 			float dot = -(t->plane * vec4(line0,1)) / (vec3(t->plane) * dir);
 			if(dot < 0.0 || dot > 1.0) continue;
@@ -297,7 +377,6 @@ int Mesh::intersection(const vec3 &line0,const vec3 &line1,vec3 &point,vec3 &nor
 				normal = t->plane;
 			}
 		}
-		return nearest < 2.0 ? 1 : 0;
 	}
 }
 
@@ -385,7 +464,9 @@ void Mesh::transform(const mat4 &m,int s) {
 			t->c[2] = vec4(normal,-t->v[2] * normal);
 		}
 	}
+	create_bvh();
 	calculate_bounds();
+	if(hull_vertex) create_hull();
 }
 
 /*****************************************************************************/
@@ -444,6 +525,18 @@ Mesh::Triangle *Mesh::getTriangles(int s) {
 	return surfaces[s]->triangles;
 }
 
+int Mesh::getNumNodes(int s) {
+	return surfaces[s]->num_nodes;
+}
+
+Mesh::BVHNode *Mesh::getNodes(int s) {
+	return surfaces[s]->nodes;
+}
+
+Mesh::TrianglePack *Mesh::getPacks(int s) {
+	return surfaces[s]->packs;
+}
+
 /*
  */
 const vec3 &Mesh::getMin(int s) {
@@ -466,6 +559,24 @@ float Mesh::getRadius(int s) {
 	return surfaces[s]->radius;
 }
 
+/*
+ */
+int Mesh::getNumHullVertex() {
+	return num_hull_vertex;
+}
+
+vec3 *Mesh::getHullVertex() {
+	return hull_vertex;
+}
+
+int Mesh::getNumHullPlanes() {
+	return num_hull_planes;
+}
+
+vec4 *Mesh::getHullPlanes() {
+	return hull_planes;
+}
+
 /* add surface
  */
 void Mesh::addSurface(Mesh *mesh,int surface) {
@@ -481,6 +592,14 @@ void Mesh::addSurface(Mesh *mesh,int surface) {
 		s->triangles = new Triangle[s->num_triangles];
 		memcpy(s->triangles,mesh->surfaces[surface]->triangles,sizeof(Triangle) * s->num_triangles);
 	}
+	if(mesh->surfaces[surface]->nodes) {
+		s->nodes = new BVHNode[s->num_nodes];
+		for(int i = 0; i < s->num_nodes; i++) s->nodes[i] = mesh->surfaces[surface]->nodes[i];
+	}
+	if(mesh->surfaces[surface]->packs) {
+		s->packs = new TrianglePack[s->num_packs];
+		memcpy(s->packs,mesh->surfaces[surface]->packs,sizeof(TrianglePack) * s->num_packs);
+	}
 	if(mesh->surfaces[surface]->indices) {
 		s->indices = new int[s->num_indices];
 		memcpy(s->indices,mesh->surfaces[surface]->indices,sizeof(int) * s->num_indices);
@@ -522,6 +641,8 @@ int Mesh::load(const char *name) {
 		if(s->vertex) delete s->vertex;
 		if(s->edges) delete s->edges;
 		if(s->triangles) delete s->triangles;
+		if(s->nodes) delete s->nodes;
+		if(s->packs) delete s->packs;
 		if(s->indices) delete s->indices;
 		delete s;
 	}
@@ -533,8 +654,8 @@ int Mesh::load(const char *name) {
 		}
 		int magic;
 		fread(&magic,sizeof(int),1,file);
-		if(magic == MESH_STRIP_MAGIC) {	// load mesh file
-			load(file);
+		if(magic == MESH_STRIP_MAGIC || magic == MESH_STRIP_BVH_MAGIC) {	// load mesh file
+			load(file,magic == MESH_STRIP_BVH_MAGIC);
 			fclose(file);
 			return 1;
 		}
@@ -561,16 +682,16 @@ int Mesh::save(const char *name) {
 		fprintf(stderr,"Mesh::load(): error create \"%s\" file\n",name);
 		return 0;
 	}
-	int magic = MESH_STRIP_MAGIC;
+	int magic = MESH_STRIP_BVH_MAGIC;
 	fwrite(&magic,sizeof(int),1,file);
-	save(file);
+	save(file,1);
 	fclose(file);
 	return 1;
 }
 
 /* strip mesh loader
  */
-void Mesh::load(FILE *file) {
+void Mesh::load(FILE *file,int bvh) {
 	// number of surfaces
 	int num_surfaces;
 	fread(&num_surfaces,sizeof(int),1,file);
@@ -628,6 +749,13 @@ void Mesh::load(FILE *file) {
 			for(int j = 0; j < s->num_indices; j++) s->indices[j] = buf[j];
 			delete buf;
 		} else fread(s->indices,sizeof(int),s->num_indices,file);
+		// triangle bvh
+		if(bvh) {
+			fread(&s->num_nodes,sizeof(int),1,file);
+			s->nodes = new BVHNode[s->num_nodes];
+			fread(s->nodes,sizeof(BVHNode),s->num_nodes,file);
+			create_packs(s);
+		} else create_bvh(s);
 		// shadow volume vertexes
 		for(int j = 0; j < NUM_SILHOUETTES; j++) {
 			s->silhouettes[j].vertex = new vec4[s->num_edges * 4];
@@ -644,7 +772,7 @@ void Mesh::load(FILE *file) {
 
 /* strip mesh saver
  */
-void Mesh::save(FILE *file) {
+void Mesh::save(FILE *file,int bvh) {
 	fwrite(&num_surfaces,sizeof(int),1,file);
 	for(int i = 0; i < num_surfaces; i++) {
 		Surface *s = surfaces[i];
@@ -674,6 +802,11 @@ void Mesh::save(FILE *file) {
 			fwrite(buf,sizeof(unsigned short),s->num_indices,file);
 			delete buf;
 		} else fwrite(s->indices,sizeof(int),s->num_indices,file);
+		// triangle bvh
+		if(bvh) {
+			fwrite(&s->num_nodes,sizeof(int),1,file);
+			fwrite(s->nodes,sizeof(BVHNode),s->num_nodes,file);
+		}
 	}
 }
 
@@ -1267,6 +1400,8 @@ void Mesh::create_shadow_volumes() {
 		delete ebuf;
 		delete e;
 		delete v;
+		// triangle bvh
+		create_bvh(s);
 	}
 }
 
@@ -1457,3 +1592,475 @@ void Mesh::create_triangle_strips() {
 		s->indices = indices;
 	}
 }
+
+/*****************************************************************************/
+/*                                                                           */
+/* create triangle bvh                                                       */
+/*                                                                           */
+/*****************************************************************************/
+
+static int cb_axis;
+
+static int cb_triangle_cmp(const void *a,const void *b) {
+	Mesh::Triangle *t0 = (Mesh::Triangle*)a;
+	Mesh::Triangle *t1 = (Mesh::Triangle*)b;
+	float c0 = t0->v[0][cb_axis] + t0->v[1][cb_axis] + t0->v[2][cb_axis];
+	float c1 = t1->v[0][cb_axis] + t1->v[1][cb_axis] + t1->v[2][cb_axis];
+	if(c0 > c1) return 1;
+	if(c0 < c1) return -1;
+	return 0;
+}
+
+/* median split by the longest axis of the triangle centers
+ * nodes are stored in depth first order, the left child is the next node
+ */
+static int cb_build(Mesh::BVHNode *nodes,int &num_nodes,Mesh::Triangle *triangles,int first,int num,int num_leaf) {
+	int id = num_nodes++;
+	Mesh::BVHNode *node = &nodes[id];
+	vec3 min = vec3(1000000,1000000,1000000);
+	vec3 max = vec3(-1000000,-1000000,-1000000);
+	vec3 center_min = vec3(1000000,1000000,1000000);
+	vec3 center_max = vec3(-1000000,-1000000,-1000000);
+	for(int i = first; i < first + num; i++) {
+		Mesh::Triangle *t = &triangles[i];
+		for(int j = 0; j < 3; j++) {
+			for(int k = 0; k < 3; k++) {
+				if(min[k] > t->v[j][k]) min[k] = t->v[j][k];
+				if(max[k] < t->v[j][k]) max[k] = t->v[j][k];
+			}
+		}
+		vec3 center = (t->v[0] + t->v[1] + t->v[2]) / 3.0f;
+		for(int j = 0; j < 3; j++) {
+			if(center_min[j] > center[j]) center_min[j] = center[j];
+			if(center_max[j] < center[j]) center_max[j] = center[j];
+		}
+	}
+	node->min = min - vec3(0.001f,0.001f,0.001f);	// flat triangles and float errors
+	node->max = max + vec3(0.001f,0.001f,0.001f);
+	node->right = -1;
+	node->first = first;
+	node->num_triangles = num;
+	if(num <= num_leaf) return id;
+	// split
+	vec3 size = center_max - center_min;
+	cb_axis = 0;
+	if(size[cb_axis] < size[1]) cb_axis = 1;
+	if(size[cb_axis] < size[2]) cb_axis = 2;
+	qsort(triangles + first,num,sizeof(Mesh::Triangle),cb_triangle_cmp);
+	node->first = 0;
+	node->num_triangles = 0;
+	cb_build(nodes,num_nodes,triangles,first,num / 2,num_leaf);
+	int right = cb_build(nodes,num_nodes,triangles,first + num / 2,num - num / 2,num_leaf);
+	nodes[id].right = right;
+	return id;
+}
+
+/*
+ */
+void Mesh::create_bvh(Surface *s) {
+	if(s->nodes) delete s->nodes;
+	s->nodes = NULL;
+	s->num_nodes = 0;
+	if(s->num_triangles == 0) return;
+	s->nodes = new BVHNode[s->num_triangles * 2];
+	cb_build(s->nodes,s->num_nodes,s->triangles,0,s->num_triangles,NUM_BVH_TRIANGLES);
+	create_packs(s);
+}
+
+/* copy triangles of each leaf into the pack
+ * unused triangles have far planes and are rejected by all tests
+ */
+void Mesh::create_packs(Surface *s) {
+	if(s->packs) delete s->packs;
+	s->packs = NULL;
+	s->num_packs = 0;
+	for(int i = 0; i < s->num_nodes; i++) {
+		if(s->nodes[i].num_triangles) s->num_packs++;
+	}
+	if(s->num_packs == 0) return;
+	s->packs = new TrianglePack[s->num_packs];
+	TrianglePack *pack = s->packs;
+	for(int i = 0; i < s->num_nodes; i++) {
+		BVHNode *node = &s->nodes[i];
+		if(node->num_triangles == 0) continue;
+		node->right = pack - s->packs;
+		for(int j = 0; j < NUM_PACK_TRIANGLES; j++) {
+			if(j < node->num_triangles) {
+				Triangle *t = &s->triangles[node->first + j];
+				for(int k = 0; k < 4; k++) {
+					pack->plane[k][j] = t->plane[k];
+					pack->c[0][k][j] = t->c[0][k];
+					pack->c[1][k][j] = t->c[1][k];
+					pack->c[2][k][j] = t->c[2][k];
+				}
+			} else {
+				for(int k = 0; k < 4; k++) {
+					pack->plane[k][j] = (k == 3) ? -1000000.0f : 0.0f;
+					pack->c[0][k][j] = (k == 3) ? -1000000.0f : 0.0f;
+					pack->c[1][k][j] = (k == 3) ? -1000000.0f : 0.0f;
+					pack->c[2][k][j] = (k == 3) ? -1000000.0f : 0.0f;
+				}
+			}
+		}
+		pack++;
+	}
+}
+
+void Mesh::create_bvh() {
+	for(int i = 0; i < num_surfaces; i++) {
+		create_bvh(surfaces[i]);
+	}
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* create convex hull                                                        */
+/*                                                                           */
+/*****************************************************************************/
+
+/* the vertexes of the face are counterclockwise from the outside
+ * face[k] is the neighbour over the edge from the v[k] to the v[k + 1]
+ * removed faces are linked into the free list by the face[0]
+ */
+struct HullFace {
+	int v[3];
+	int face[3];
+	vec4 plane;
+	int visible;
+	int points;		// list of the points above the face
+};
+
+/* the points are sorted by x for the search of the duplicates
+ */
+static int ch_point_cmp(const void *a,const void *b) {
+	const vec3 *p0 = (const vec3*)a;
+	const vec3 *p1 = (const vec3*)b;
+	for(int i = 0; i < 3; i++) {
+		if(p0->v[i] > p1->v[i]) return 1;
+		if(p0->v[i] < p1->v[i]) return -1;
+	}
+	return 0;
+}
+
+/* degenerated faces are never visible, they are left to close the hull
+ */
+static int ch_plane(HullFace *f,const vec3 *points) {
+	vec3 normal;
+	normal.cross(points[f->v[1]] - points[f->v[0]],points[f->v[2]] - points[f->v[0]]);
+	if(normal.normalize() < EPSILON) {
+		f->plane = vec4(0,0,0,-1);
+		return 0;
+	}
+	f->plane = vec4(normal,-points[f->v[0]] * normal);
+	return 1;
+}
+
+/* the point is given to the face which it is the farthest above
+ * the points within eps of all faces are inside of the hull
+ */
+static void ch_assign(int point,HullFace *faces,const int *list,int num,const vec3 *points,int *next,float eps) {
+	int face = -1;
+	float dist = eps;
+	for(int i = 0; i < num; i++) {
+		float d = vec4(points[point],1) * faces[list[i]].plane;
+		if(dist < d) {
+			dist = d;
+			face = list[i];
+		}
+	}
+	if(face == -1) return;
+	next[point] = faces[face].points;
+	faces[face].points = point;
+}
+
+/* quickhull of the vertexes of all surfaces, the farthest point is added first
+ * returns the number of the hull vertexes, zero if the hull can`t be created
+ * the failure is kept, so the hull isn`t created again
+ */
+int Mesh::create_hull() {
+	if(hull_failed) return 0;
+	if(hull_vertex) delete [] hull_vertex;
+	if(hull_planes) delete [] hull_planes;
+	hull_vertex = NULL;
+	hull_planes = NULL;
+	num_hull_vertex = 0;
+	num_hull_planes = 0;
+	
+	float eps = (max - min).length() * 0.00001f;
+	
+	// unique vertexes, the duplicates are found among the sorted ones
+	int num_points = 0;
+	for(int i = 0; i < num_surfaces; i++) num_points += surfaces[i]->num_vertex;
+	if(num_points == 0) {
+		hull_failed = 1;
+		return 0;
+	}
+	vec3 *points = new vec3[num_points];
+	num_points = 0;
+	for(int i = 0; i < num_surfaces; i++) {
+		Surface *s = surfaces[i];
+		for(int j = 0; j < s->num_vertex; j++) {
+			points[num_points++] = s->vertex[j].xyz;
+		}
+	}
+	qsort(points,num_points,sizeof(vec3),ch_point_cmp);
+	int num = 0;
+	for(int i = 0; i < num_points; i++) {
+		int k;
+		for(k = num - 1; k >= 0 && points[i].x - points[k].x < eps; k--) {
+			if((points[k] - points[i]).length() < eps) break;
+		}
+		if(k < 0 || points[i].x - points[k].x >= eps) points[num++] = points[i];
+	}
+	num_points = num;
+	
+	// initial tetrahedron from the extreme points
+	int v0 = 0;
+	int v1 = 0;
+	for(int i = 1; i < num_points; i++) {
+		if(points[v0].x > points[i].x) v0 = i;
+		if(points[v1].x < points[i].x) v1 = i;
+	}
+	if(v0 == v1) v1 = num_points > 1 ? 1 : 0;
+	vec3 dir = points[v1] - points[v0];
+	dir.normalize();
+	int v2 = v0;
+	float dist = 0.0f;
+	for(int i = 0; i < num_points; i++) {
+		vec3 d = points[i] - points[v0];
+		float l = (d - dir * (d * dir)).length();
+		if(dist < l) {
+			dist = l;
+			v2 = i;
+		}
+	}
+	int v3 = v0;
+	vec3 normal;
+	normal.cross(points[v1] - points[v0],points[v2] - points[v0]);
+	normal.normalize();
+	dist = 0.0f;
+	for(int i = 0; i < num_points; i++) {
+		float l = fabs((points[i] - points[v0]) * normal);
+		if(dist < l) {
+			dist = l;
+			v3 = i;
+		}
+	}
+	
+	// flat meshes have only vertexes
+	if(dist < eps) {
+		num_hull_vertex = num_points;
+		hull_vertex = points;
+		return num_hull_vertex;
+	}
+	
+	// the closed hull of n vertexes has 2 * n - 4 faces
+	int all_faces = num_points * 2 + 4;
+	HullFace *faces = new HullFace[all_faces];
+	int *visible = new int[all_faces];
+	int *horizon = new int[all_faces * 3];
+	int *new_faces = new int[all_faces];
+	int *next = new int[num_points];
+	int *edge_face = new int[num_points];
+	char *used = new char[num_points];
+	for(int i = 0; i < num_points; i++) edge_face[i] = -1;
+	memset(used,0,sizeof(char) * num_points);
+	
+	if((points[v3] - points[v0]) * normal > 0.0f) {
+		int i = v1;
+		v1 = v2;
+		v2 = i;
+	}
+	int tetrahedron[4][3] = { { v0, v1, v2 }, { v0, v3, v1 }, { v1, v3, v2 }, { v2, v3, v0 } };
+	int num_faces = 4;
+	int num_alive = 4;
+	for(int i = 0; i < 4; i++) {
+		HullFace *f = &faces[i];
+		for(int j = 0; j < 3; j++) f->v[j] = tetrahedron[i][j];
+		f->visible = 0;
+		f->points = -1;
+		ch_plane(f,points);
+		new_faces[i] = i;
+	}
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 3; j++) {
+			int e0 = faces[i].v[j];
+			int e1 = faces[i].v[(j + 1) % 3];
+			for(int k = 0; k < 4; k++) {
+				HullFace *f = &faces[k];
+				if((f->v[0] == e1 && f->v[1] == e0) || (f->v[1] == e1 && f->v[2] == e0) || (f->v[2] == e1 && f->v[0] == e0)) faces[i].face[j] = k;
+			}
+		}
+	}
+	used[v0] = used[v1] = used[v2] = used[v3] = 1;
+	for(int i = 0; i < num_points; i++) {
+		if(used[i] == 0) ch_assign(i,faces,new_faces,4,points,next,eps);
+	}
+	
+	// the farthest point above the face is added
+	int free_face = -1;
+	for(int current = 0; current < num_faces; current++) {
+		HullFace *f = &faces[current];
+		if(f->v[0] == -1 || f->points == -1) continue;
+		
+		int point = f->points;
+		dist = vec4(points[point],1) * f->plane;
+		for(int i = next[point]; i != -1; i = next[i]) {
+			float d = vec4(points[i],1) * f->plane;
+			if(dist < d) {
+				dist = d;
+				point = i;
+			}
+		}
+		
+		// connected faces which see the point
+		int num_visible = 0;
+		visible[num_visible++] = current;
+		f->visible = 1;
+		for(int i = 0; i < num_visible; i++) {
+			HullFace *v = &faces[visible[i]];
+			for(int j = 0; j < 3; j++) {
+				HullFace *n = &faces[v->face[j]];
+				if(n->visible || vec4(points[point],1) * n->plane <= eps) continue;
+				n->visible = 1;
+				visible[num_visible++] = v->face[j];
+			}
+		}
+		
+		// edges between the visible and the hidden faces
+		// the pinched horizon is given by the float errors, the point is inside then
+		int num_horizon = 0;
+		int pinched = 0;
+		for(int i = 0; i < num_visible; i++) {
+			HullFace *v = &faces[visible[i]];
+			for(int j = 0; j < 3; j++) {
+				if(faces[v->face[j]].visible) continue;
+				if(edge_face[v->v[j]] != -1) pinched = 1;
+				edge_face[v->v[j]] = 0;
+				horizon[num_horizon++] = v->v[j];
+				horizon[num_horizon++] = v->v[(j + 1) % 3];
+				horizon[num_horizon++] = v->face[j];
+			}
+		}
+		for(int i = 0; i < num_horizon; i += 3) edge_face[horizon[i]] = -1;
+		if(pinched || num_alive - num_visible + num_horizon / 3 > all_faces) {
+			for(int i = 0; i < num_visible; i++) faces[visible[i]].visible = 0;
+			int *p = &f->points;
+			while(*p != point) p = &next[*p];
+			*p = next[point];
+			current--;
+			continue;
+		}
+		
+		// the points of the visible faces are given to the new ones
+		int points_list = -1;
+		for(int i = 0; i < num_visible; i++) {
+			HullFace *v = &faces[visible[i]];
+			for(int j = v->points; j != -1;) {
+				int k = next[j];
+				if(j != point) {
+					next[j] = points_list;
+					points_list = j;
+				}
+				j = k;
+			}
+			v->v[0] = -1;
+			v->face[0] = free_face;
+			v->visible = 0;
+			v->points = -1;
+			free_face = visible[i];
+		}
+		
+		// faces from the horizon edges to the point
+		int first_face = current;
+		for(int i = 0; i < num_horizon; i += 3) {
+			int face = free_face;
+			if(face != -1) free_face = faces[face].face[0];
+			else face = num_faces++;
+			if(first_face > face) first_face = face;
+			HullFace *n = &faces[face];
+			n->v[0] = horizon[i + 0];
+			n->v[1] = horizon[i + 1];
+			n->v[2] = point;
+			n->face[0] = horizon[i + 2];
+			n->visible = 0;
+			n->points = -1;
+			ch_plane(n,points);
+			HullFace *h = &faces[horizon[i + 2]];
+			for(int j = 0; j < 3; j++) {
+				if(h->v[j] == horizon[i + 1] && h->v[(j + 1) % 3] == horizon[i + 0]) h->face[j] = face;
+			}
+			edge_face[horizon[i]] = face;
+			new_faces[i / 3] = face;
+		}
+		for(int i = 0; i < num_horizon / 3; i++) {
+			HullFace *n = &faces[new_faces[i]];
+			int face = edge_face[n->v[1]];
+			n->face[1] = face;
+			faces[face].face[2] = new_faces[i];
+		}
+		for(int i = 0; i < num_horizon; i += 3) edge_face[horizon[i]] = -1;
+		num_alive += num_horizon / 3 - num_visible;
+		used[point] = 1;
+		
+		for(int i = points_list; i != -1;) {
+			int j = next[i];
+			ch_assign(i,faces,new_faces,num_horizon / 3,points,next,eps);
+			i = j;
+		}
+		
+		current = first_face - 1;
+	}
+	
+	// vertexes of the faces and the planes without coplanar duplicates
+	for(int i = 0; i < num_faces; i++) {
+		if(faces[i].v[0] == -1) continue;
+		for(int j = 0; j < 3; j++) used[faces[i].v[j]] = 2;
+	}
+	for(int i = 0; i < num_points; i++) num_hull_vertex += (used[i] == 2);
+	hull_vertex = new vec3[num_hull_vertex];
+	num_hull_vertex = 0;
+	for(int i = 0; i < num_points; i++) {
+		if(used[i] == 2) hull_vertex[num_hull_vertex++] = points[i];
+	}
+	hull_planes = new vec4[num_faces];
+	for(int i = 0; i < num_faces; i++) {
+		if(faces[i].v[0] == -1) continue;
+		const vec4 &plane = faces[i].plane;
+		if(plane.w == -1.0f && vec3(plane) == vec3(0,0,0)) continue;
+		int j;
+		for(j = 0; j < num_hull_planes; j++) {
+			if(vec3(plane) * vec3(hull_planes[j]) > 1.0f - 0.0001f && fabs(plane.w - hull_planes[j].w) < eps) break;
+		}
+		if(j == num_hull_planes) hull_planes[num_hull_planes++] = plane;
+	}
+	
+	// float errors can break the hull of the large meshes
+	for(int i = 0; i < num_points; i++) {
+		int j;
+		for(j = 0; j < num_hull_planes; j++) {
+			if(vec4(points[i],1) * hull_planes[j] > eps * 100.0f) break;
+		}
+		if(j == num_hull_planes) continue;
+		fprintf(stderr,"Mesh::create_hull(): bad convex hull of the %d vertexes\n",num_points);
+		delete [] hull_vertex;
+		delete [] hull_planes;
+		hull_vertex = NULL;
+		hull_planes = NULL;
+		num_hull_vertex = 0;
+		num_hull_planes = 0;
+		hull_failed = 1;
+		break;
+	}
+	
+	delete [] points;
+	delete [] faces;
+	delete [] visible;
+	delete [] horizon;
+	delete [] new_faces;
+	delete [] next;
+	delete [] edge_face;
+	delete [] used;
+	
+	return num_hull_vertex;
+}
@@ -29,6 +29,7 @@
 
 
 #define MESH_STRIP_MAGIC ('m' | 's' << 8 | '0' << 16 | '2' << 24)
+#define MESH_STRIP_BVH_MAGIC ('m' | 's' << 8 | '0' << 16 | '3' << 24)
 #define MESH_RAW_MAGIC ('m' | 'r' << 8 | '0' << 16 | '2' << 24)
 
 class Mesh {
@@ -71,6 +72,25 @@ public:
 		vec4 c[3];			// fast point in triangle
 	};
 	
+	struct BVHNode {
+		vec3 min;			// bound box
+		vec3 max;
+		int right;			// right child, the left child is the next node, pack for leaves
+		int first;			// first triangle of the leaf
+		int num_triangles;	// zero for inner nodes
+	};
+	
+	// triangles of the bvh leaf in the SoA layout for SIMD tests
+	struct TrianglePack {
+		float plane[4][4];	// x, y, z, w components of 4 planes
+		float c[3][4][4];	// fast point in triangle
+	};
+	
+	enum {
+		NUM_BVH_STACK = 64,	// traversal stack
+		NUM_PACK_TRIANGLES = 4,
+	};
+	
 	int getNumSurfaces();
 	const char *getSurfaceName(int s);
 	int getSurface(const char *name);
@@ -87,6 +107,16 @@ public:
 	int getNumTriangles(int s);
 	Triangle *getTriangles(int s);
 	
+	int getNumNodes(int s);
+	BVHNode *getNodes(int s);
+	TrianglePack *getPacks(int s);
+	
+	// convex hull of all surfaces, it is created by the create_hull() once, the failure is kept
+	int getNumHullVertex();
+	vec3 *getHullVertex();
+	int getNumHullPlanes();
+	vec4 *getHullPlanes();
+	
 	const vec3 &getMin(int s = -1);
 	const vec3 &getMax(int s = -1);
 	const vec3 &getCenter(int s = -1);
@@ -99,9 +129,9 @@ public:
 	int load(const char *name);
 	int save(const char *name);
 	
-	// strip mesh format without header
-	void load(FILE *file);
-	void save(FILE *file);
+	// strip mesh format without header, bvh is stored after each surface
+	void load(FILE *file,int bvh = 0);
+	void save(FILE *file,int bvh = 0);
 	
 	int load_mesh(const char *name);
 	int load_3ds(const char *name);
@@ -110,7 +140,9 @@ public:
 	void calculate_bounds();
 	void create_shadow_volumes();
 	void create_triangle_strips();
-	
+	void create_bvh();
+	int create_hull();
+
 protected:
 	
 	vec3 min;
@@ -118,6 +150,12 @@ protected:
 	vec3 center;
 	float radius;
 	
+	int num_hull_vertex;	// convex hull
+	vec3 *hull_vertex;
+	int num_hull_planes;	// outward planes, zero for the flat hull
+	vec4 *hull_planes;
+	int hull_failed;		// the hull isn`t created again
+	
 	struct Silhouette {
 		vec4 light;
 		vec4 *vertex;
@@ -128,6 +166,7 @@ protected:
 	enum {
 		NUM_SURFACES = 512,
 		NUM_SILHOUETTES = 4,
+		NUM_BVH_TRIANGLES = NUM_PACK_TRIANGLES,
 	};
 	
 	struct Surface {
@@ -138,6 +177,10 @@ protected:
 		Edge *edges;
 		int num_triangles;							// number of triangles
 		Triangle *triangles;
+		int num_nodes;								// triangle bvh
+		BVHNode *nodes;
+		int num_packs;
+		TrianglePack *packs;
 		int num_indices;							// number of indices
 		int num_strips;								// number of triangle strips
 		int *indices;
@@ -150,6 +193,12 @@ protected:
 		float radius;
 	};
 	
+	void intersection_surface(Surface *s,const vec3 &line0,const vec3 &dir,float &nearest,vec3 &point,vec3 &normal);
+	int num_intersections_surface(Surface *s,const vec3 &line0,const vec3 &dir);
+	
+	void create_bvh(Surface *s);
+	void create_packs(Surface *s);
+	
 	int num_surfaces;
 	Surface *surfaces[NUM_SURFACES];
 };
@@ -24,15 +24,21 @@
 #include "shader.h"
 #include "material.h"
 #include "rigidbody.h"
+#include "physic.h"
+#include "broadphase.h"
 #include "object.h"
 
-Object::Object(int type) : type(type), rigidbody(NULL), is_identity(1),
+static int num_ids = 0;
+
+Object::Object(int type) : type(type), rigidbody(NULL), proxy(-1), id(num_ids++), is_identity(1), physic_identity(1),
 	num_opacities(0), opacities(NULL), num_transparents(0), transparents(NULL),
 	shadows(1), time(0), frame(0) {
 }
 
 Object::~Object() {
+	Physic::wait();
 	for(int i = 0; i < pos.num_sectors; i++) Bsp::sectors[pos.sectors[i]].removeObject(this);
+	Broadphase::removeObject(this);
 	if(rigidbody) delete rigidbody;
 }
 
@@ -49,11 +55,14 @@ void Object::update(float ifps) {
 
 /*
  */
-void Object::updatePos(const vec3 &p) {
+void Object::updatePos(const vec3 &p,int broadphase) {
 	for(int i = 0; i < pos.num_sectors; i++) Bsp::sectors[pos.sectors[i]].removeObject(this);
 	pos.radius = getRadius();
 	pos = p;
 	for(int i = 0; i < pos.num_sectors; i++) Bsp::sectors[pos.sectors[i]].addObject(this);
+	if(broadphase == 0) return;
+	if(pos.num_sectors) Broadphase::updateObject(this);
+	else Broadphase::removeObject(this);
 }
 
 /*
@@ -105,19 +114,21 @@ void Object::setShadows(int shadows) {
 /*
  */
 void Object::set(const vec3 &p) {
+	if(rigidbody) Physic::wait();
 	is_identity = 0;
 	transform.translate(p);
 	itransform = transform.inverse();
-	updatePos(p);
 	if(rigidbody) rigidbody->set(p);
+	updatePos(p);
 }
 
 void Object::set(const mat4 &m) {
+	if(rigidbody) Physic::wait();
 	is_identity = 0;
 	transform = m;
 	itransform = transform.inverse();
-	updatePos(m * vec3(0,0,0));
 	if(rigidbody) rigidbody->set(m);
+	updatePos(m * vec3(0,0,0));
 }
 
 /*
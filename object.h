@@ -33,7 +33,7 @@ public:
 	virtual ~Object();
 	
 	virtual void update(float ifps);	// update function
-	void updatePos(const vec3 &p);		// update position
+	void updatePos(const vec3 &p,int broadphase = 1);	// update position
 	
 	int bindMaterial(const char *name,Material *material);
 	
@@ -82,10 +82,17 @@ public:
 	
 	RigidBody *rigidbody;		// rigidbody dynamic
 	
+	int proxy;					// broadphase proxy
+	int id;						// creation order
+	
 	int is_identity;
 	mat4 transform;
 	mat4 itransform;
 	
+	int physic_identity;		// copies read by the physic thread
+	mat4 physic_transform;
+	mat4 physic_itransform;
+	
 	mat4 old_modelview;			// save old matrixes
 	mat4 old_imodelview;
 	mat4 old_transform;
@@ -0,0 +1,378 @@
+/* Occlusion (software depth buffer)
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define USE_SSE
+#include <xmmintrin.h>
+#include <string.h>
+#include "collide.h"
+#include "texture.h"
+#include "thread.h"
+#include "occlusion.h"
+
+#define DEPTH_BIAS	0.001f
+
+float Occlusion::min_area = 0.5f;
+
+int Occlusion::num_triangles;
+int Occlusion::num_tests;
+int Occlusion::num_culled;
+
+Occlusion::Occlusion() : enabled(0), num_screen_triangles(0), all_screen_triangles(0), screen_triangles(NULL) {
+	depth = new float[WIDTH * HEIGHT];
+	memset(depth,0,sizeof(float) * WIDTH * HEIGHT);
+}
+
+Occlusion::~Occlusion() {
+	delete [] screen_triangles;
+	delete [] depth;
+}
+
+/*
+ */
+void Occlusion::clear(const mat4 &modelviewprojection) {
+	this->modelviewprojection = modelviewprojection;
+	num_screen_triangles = 0;
+	memset(depth,0,sizeof(float) * WIDTH * HEIGHT);
+	enabled = 0;
+}
+
+/*
+ */
+void Occlusion::enable() {
+	enabled = 1;
+}
+
+void Occlusion::disable() {
+	enabled = 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* occluders                                                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+/* triangles are clipped by the near plane only, the rest is done by the tiles
+ */
+void Occlusion::addOccluder(const vec3 *vertex,int num_vertex) {
+	for(int i = 0; i < num_vertex - 2; i += 3) {
+		const vec3 *v = &vertex[i];
+		if(cross(v[1] - v[0],v[2] - v[0]).length() * 0.5f < min_area) continue;
+		vec4 c[3];
+		float d[3];
+		int outside[6] = { 0, 0, 0, 0, 0, 0 };
+		for(int j = 0; j < 3; j++) {
+			c[j] = modelviewprojection * vec4(v[j],1);
+			d[j] = c[j].z + c[j].w;
+			if(c[j].x > c[j].w) outside[0]++;
+			if(c[j].x < -c[j].w) outside[1]++;
+			if(c[j].y > c[j].w) outside[2]++;
+			if(c[j].y < -c[j].w) outside[3]++;
+			if(d[j] < 0.0f) outside[4]++;
+			if(c[j].z > c[j].w) outside[5]++;
+		}
+		int k = 0;
+		for(; k < 6; k++) if(outside[k] == 3) break;
+		if(k != 6) continue;
+		if(outside[4] == 0) {
+			addTriangle(c);
+			continue;
+		}
+		// the polygon in front of the near plane
+		vec4 p[4];
+		int num = 0;
+		for(int j = 0; j < 3; j++) {
+			int k = (j + 1) % 3;
+			if(d[j] >= 0.0f) p[num++] = c[j];
+			if((d[j] >= 0.0f) != (d[k] >= 0.0f)) {
+				float t = d[j] / (d[j] - d[k]);
+				p[num++] = c[j] * (1.0f - t) + c[k] * t;
+			}
+		}
+		for(int j = 2; j < num; j++) {
+			vec4 t[3] = { p[0], p[j - 1], p[j] };
+			addTriangle(t);
+		}
+	}
+}
+
+/*
+ */
+void Occlusion::addTriangle(const vec4 *v) {
+	float x[3],y[3],iw[3];
+	for(int i = 0; i < 3; i++) {
+		if(v[i].w < EPSILON) return;
+		iw[i] = 1.0f / v[i].w;
+		x[i] = (v[i].x * iw[i] * 0.5f + 0.5f) * WIDTH;
+		y[i] = (v[i].y * iw[i] * 0.5f + 0.5f) * HEIGHT;
+	}
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if(fabs(area) < EPSILON) return;
+	
+	if(num_screen_triangles == all_screen_triangles) {
+		all_screen_triangles = all_screen_triangles ? all_screen_triangles * 2 : 256;
+		Triangle *triangles = new Triangle[all_screen_triangles];
+		if(screen_triangles) memcpy(triangles,screen_triangles,sizeof(Triangle) * num_screen_triangles);
+		delete [] screen_triangles;
+		screen_triangles = triangles;
+	}
+	Triangle *t = &screen_triangles[num_screen_triangles++];
+	num_triangles++;
+	
+	t->min_x = t->max_x = x[0];
+	t->min_y = t->max_y = y[0];
+	for(int i = 1; i < 3; i++) {
+		if(t->min_x > x[i]) t->min_x = x[i];
+		if(t->max_x < x[i]) t->max_x = x[i];
+		if(t->min_y > y[i]) t->min_y = y[i];
+		if(t->max_y < y[i]) t->max_y = y[i];
+	}
+	
+	// both windings are occluders
+	// the edges are moved inside by the half of the pixel, so the center test
+	// gives only the pixels covered completely
+	float s = area > 0.0f ? 1.0f : -1.0f;
+	for(int i = 0; i < 3; i++) {
+		int j = (i + 1) % 3;
+		t->edges[i][0] = (y[i] - y[j]) * s;
+		t->edges[i][1] = (x[j] - x[i]) * s;
+		t->edges[i][2] = (x[i] * y[j] - x[j] * y[i]) * s;
+		t->edges[i][2] -= (fabs(t->edges[i][0]) + fabs(t->edges[i][1])) * 0.5f;
+	}
+	
+	// the farthest depth over the pixel
+	t->plane[0] = ((iw[1] - iw[0]) * (y[2] - y[0]) - (iw[2] - iw[0]) * (y[1] - y[0])) / area;
+	t->plane[1] = ((iw[2] - iw[0]) * (x[1] - x[0]) - (iw[1] - iw[0]) * (x[2] - x[0])) / area;
+	t->plane[2] = iw[0] - t->plane[0] * x[0] - t->plane[1] * y[0];
+	t->plane[2] -= (fabs(t->plane[0]) + fabs(t->plane[1])) * 0.5f;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* rasterize                                                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+/* the workers are shared with the step of the physic thread
+ */
+void Occlusion::rasterize() {
+	int num_tiles = (WIDTH / TILE_WIDTH) * (HEIGHT / TILE_HEIGHT);
+	Thread::run(rasterize_tile,this,num_tiles);
+	enabled = 1;
+}
+
+void Occlusion::rasterize_tile(void *data,int tile) {
+	((Occlusion*)data)->rasterizeTile(tile);
+}
+
+/* the pixels are sampled at the centers of the shrunk triangles, four of them at once
+ */
+void Occlusion::rasterizeTile(int tile) {
+	int x0 = (tile % (WIDTH / TILE_WIDTH)) * TILE_WIDTH;
+	int y0 = (tile / (WIDTH / TILE_WIDTH)) * TILE_HEIGHT;
+	int x1 = x0 + TILE_WIDTH;
+	int y1 = y0 + TILE_HEIGHT;
+	for(int i = 0; i < num_screen_triangles; i++) {
+		const Triangle *t = &screen_triangles[i];
+		if(t->max_x < x0 || t->min_x > x1 || t->max_y < y0 || t->min_y > y1) continue;
+		int min_x = t->min_x > x0 ? (int)t->min_x & ~3 : x0;
+		int max_x = t->max_x < x1 ? ((int)t->max_x + 4) & ~3 : x1;
+		int min_y = t->min_y > y0 ? (int)t->min_y : y0;
+		int max_y = t->max_y < y1 - 1 ? (int)t->max_y + 1 : y1;
+		if(max_x > x1) max_x = x1;
+		const float (*e)[3] = t->edges;
+		const float *p = t->plane;
+#ifdef USE_SSE
+		if(Collide::simd) {
+			__m128 offset = _mm_set_ps(3.5f,2.5f,1.5f,0.5f);
+			__m128 zero = _mm_setzero_ps();
+			__m128 a0 = _mm_set1_ps(e[0][0]);
+			__m128 a1 = _mm_set1_ps(e[1][0]);
+			__m128 a2 = _mm_set1_ps(e[2][0]);
+			__m128 a = _mm_set1_ps(p[0]);
+			for(int y = min_y; y < max_y; y++) {
+				float py = y + 0.5f;
+				__m128 b0 = _mm_set1_ps(e[0][1] * py + e[0][2]);
+				__m128 b1 = _mm_set1_ps(e[1][1] * py + e[1][2]);
+				__m128 b2 = _mm_set1_ps(e[2][1] * py + e[2][2]);
+				__m128 b = _mm_set1_ps(p[1] * py + p[2]);
+				float *row = depth + y * WIDTH;
+				for(int x = min_x; x < max_x; x += 4) {
+					__m128 px = _mm_add_ps(_mm_set1_ps((float)x),offset);
+					__m128 m = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0,px),b0),zero);
+					m = _mm_and_ps(m,_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1,px),b1),zero));
+					m = _mm_and_ps(m,_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2,px),b2),zero));
+					__m128 d = _mm_and_ps(m,_mm_add_ps(_mm_mul_ps(a,px),b));
+					_mm_storeu_ps(row + x,_mm_max_ps(_mm_loadu_ps(row + x),d));
+				}
+			}
+			continue;
+		}
+#endif
+		for(int y = min_y; y < max_y; y++) {
+			float py = y + 0.5f;
+			float b0 = e[0][1] * py + e[0][2];
+			float b1 = e[1][1] * py + e[1][2];
+			float b2 = e[2][1] * py + e[2][2];
+			float b = p[1] * py + p[2];
+			float *row = depth + y * WIDTH;
+			for(int x = min_x; x < max_x; x++) {
+				float px = x + 0.5f;
+				if(e[0][0] * px + b0 < 0.0f) continue;
+				if(e[1][0] * px + b1 < 0.0f) continue;
+				if(e[2][0] * px + b2 < 0.0f) continue;
+				float d = p[0] * px + b;
+				if(row[x] < d) row[x] = d;
+			}
+		}
+	}
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* inside                                                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+/* the nearest corner of the box is compared with all the pixels of its screen bound
+ */
+int Occlusion::inside(const vec3 &min,const vec3 &max) {
+	if(enabled == 0) return 1;
+	num_tests++;
+	float min_x = 1000000.0f;
+	float min_y = 1000000.0f;
+	float max_x = -1000000.0f;
+	float max_y = -1000000.0f;
+	float iw = 0.0f;
+	for(int i = 0; i < 8; i++) {
+		vec3 v((i & 1) ? max.x : min.x,(i & 2) ? max.y : min.y,(i & 4) ? max.z : min.z);
+		vec4 c = modelviewprojection * vec4(v,1);
+		if(c.z + c.w < 0.0f || c.w < EPSILON) return 1;	// the box crosses the near plane
+		float w = 1.0f / c.w;
+		float x = (c.x * w * 0.5f + 0.5f) * WIDTH;
+		float y = (c.y * w * 0.5f + 0.5f) * HEIGHT;
+		if(min_x > x) min_x = x;
+		if(max_x < x) max_x = x;
+		if(min_y > y) min_y = y;
+		if(max_y < y) max_y = y;
+		if(iw < w) iw = w;
+	}
+	iw *= 1.0f + DEPTH_BIAS;	// the faces of the box itself are not occluders
+	if(min_x < 0.0f) min_x = 0.0f;
+	if(min_y < 0.0f) min_y = 0.0f;
+	if(max_x > WIDTH - 1) max_x = WIDTH - 1;
+	if(max_y > HEIGHT - 1) max_y = HEIGHT - 1;
+	if(min_x > max_x || min_y > max_y) return 1;
+	int x0 = (int)min_x;
+	int x1 = (int)max_x + 1;
+	int y0 = (int)min_y;
+	int y1 = (int)max_y + 1;
+	for(int y = y0; y < y1; y++) {
+		const float *row = depth + y * WIDTH;
+		int x = x0;
+#ifdef USE_SSE
+		if(Collide::simd) {
+			__m128 w = _mm_set1_ps(iw);
+			for(; x + 4 <= x1; x += 4) {
+				if(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(row + x),w))) return 1;
+			}
+		}
+#endif
+		for(; x < x1; x++) {
+			if(row[x] < iw) return 1;
+		}
+	}
+	num_culled++;
+	return 0;
+}
+
+int Occlusion::inside(const vec3 &center,float radius) {
+	return inside(center - vec3(radius,radius,radius),center + vec3(radius,radius,radius));
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* depth image                                                               */
+/*                                                                           */
+/*****************************************************************************/
+
+/*
+ */
+int Occlusion::getWidth() {
+	return WIDTH;
+}
+
+int Occlusion::getHeight() {
+	return HEIGHT;
+}
+
+const float *Occlusion::getDepth() {
+	return depth;
+}
+
+/* the depth is scaled by the nearest pixel, the first row is the top of the screen
+ */
+int Occlusion::save(const char *name) {
+	float max = 0.0f;
+	for(int i = 0; i < WIDTH * HEIGHT; i++) {
+		if(max < depth[i]) max = depth[i];
+	}
+	float scale = max > 0.0f ? 255.0f / max : 0.0f;
+	unsigned char *data = new unsigned char[WIDTH * HEIGHT * 4];
+	for(int y = 0; y < HEIGHT; y++) {
+		const float *row = depth + (HEIGHT - y - 1) * WIDTH;
+		unsigned char *d = data + y * WIDTH * 4;
+		for(int x = 0; x < WIDTH; x++, d += 4) {
+			d[0] = d[1] = d[2] = (unsigned char)(row[x] * scale + 0.5f);
+			d[3] = 255;
+		}
+	}
+	int ret = Texture::save(name,data,WIDTH,HEIGHT);
+	delete [] data;
+	return ret;
+}
+
+/* one level of difference is allowed for the rounding
+ */
+int Occlusion::compare(const char *name) {
+	int width,height;
+	unsigned char *data = Texture::load(name,width,height);
+	if(data == NULL) return -1;
+	if(width != WIDTH || height != HEIGHT) {
+		fprintf(stderr,"Occlusion::compare(): \"%s\" is %dx%d image\n",name,width,height);
+		delete [] data;
+		return -1;
+	}
+	float max = 0.0f;
+	for(int i = 0; i < WIDTH * HEIGHT; i++) {
+		if(max < depth[i]) max = depth[i];
+	}
+	float scale = max > 0.0f ? 255.0f / max : 0.0f;
+	int ret = 0;
+	for(int y = 0; y < HEIGHT; y++) {
+		const float *row = depth + (HEIGHT - y - 1) * WIDTH;
+		const unsigned char *d = data + y * WIDTH * 4;
+		for(int x = 0; x < WIDTH; x++, d += 4) {
+			int v = (int)(row[x] * scale + 0.5f);
+			if(abs(v - d[0]) > 1) ret++;
+		}
+	}
+	delete [] data;
+	return ret;
+}
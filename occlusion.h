@@ -0,0 +1,91 @@
+/* Occlusion (software depth buffer)
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __OCCLUSION_H__
+#define __OCCLUSION_H__
+
+#include "mathlib.h"
+
+/* big occluders are drawn into a low resolution depth buffer on the cpu
+ * the buffer keeps 1/w, zero is the far side, so a bound is hidden when its
+ * nearest point is farther than the buffer over all the pixels it covers
+ * the tiles of the screen are drawn by the worker threads
+ */
+class Occlusion {
+public:
+	
+	Occlusion();
+	~Occlusion();
+	
+	void clear(const mat4 &modelviewprojection);
+	void addOccluder(const vec3 *vertex,int num_vertex);	// triangle list
+	void rasterize();
+	
+	void enable();
+	void disable();
+	
+	// zero if the bound is hidden by the occluders
+	int inside(const vec3 &min,const vec3 &max);
+	int inside(const vec3 &center,float radius);
+	
+	int getWidth();
+	int getHeight();
+	const float *getDepth();
+	
+	// depth as the grayscale image and the number of different pixels with the image
+	int save(const char *name);
+	int compare(const char *name);
+	
+	enum {
+		WIDTH = 256,
+		HEIGHT = 128,
+		TILE_WIDTH = 64,
+		TILE_HEIGHT = 32,
+	};
+	
+	static float min_area;		// smaller triangles are not occluders
+	
+	static int num_triangles;	// counters for the frame
+	static int num_tests;
+	static int num_culled;
+
+protected:
+	
+	struct Triangle {
+		float min_x,min_y,max_x,max_y;	// screen bound
+		float edges[3][3];				// edge functions, positive inside
+		float plane[3];					// 1/w = plane[0] * x + plane[1] * y + plane[2]
+	};
+	
+	void addTriangle(const vec4 *v);
+	
+	static void rasterize_tile(void *data,int tile);
+	void rasterizeTile(int tile);
+	
+	int enabled;
+	mat4 modelviewprojection;
+	
+	int num_screen_triangles;
+	int all_screen_triangles;
+	Triangle *screen_triangles;
+	
+	float *depth;
+};
+
+#endif /* __OCCLUSION_H__ */
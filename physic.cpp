@@ -19,9 +19,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "object.h"
 #include "rigidbody.h"
 #include "collide.h"
 #include "joint.h"
+#include "thread.h"
 #include "physic.h"
 
 float Physic::time = 0.0;
@@ -29,12 +33,28 @@ float Physic::time_step = 1.0f / 50.0f;
 float Physic::gravitation = -9.8f * 0.5f;
 float Physic::velocity_max = 20.0f;
 float Physic::velocity_threshold = 0.1f * 0.1f;
-float Physic::angularVelocity_threshold = (2.0f * DEG2RAD) * (2.0f * DEG2RAD);
+float Physic::angularVelocity_threshold = (6.0f * DEG2RAD) * (6.0f * DEG2RAD);
 float Physic::time_to_frost = 1.0f / 10.f;
 float Physic::penetration_speed = 1.0f / 5.0f;
+float Physic::penetration_tolerance = 0.02f;
+float Physic::contact_distance = 0.05f;
+float Physic::warm_starting = 0.9f;
+float Physic::residual_threshold = 0.01f;
+int Physic::continuous = 1;
+int Physic::joint_chains = 1;
+int Physic::max_contacts = 31;
+int Physic::incremental_sort = 1;
 int Physic::num_first_iterations = 5;
 int Physic::num_second_iterations = 15;
 
+int Physic::num_iterations = 0;
+float Physic::residual = 0.0;
+int Physic::num_contacts = 0;
+int Physic::num_frozen_rigidbodies = 0;
+
+int Physic::threaded = 0;
+int Physic::num_threads = 1;
+
 int Physic::all_joints = 0;
 int Physic::num_joints = 0;
 Joint **Physic::joints = NULL;
@@ -42,6 +62,44 @@ Joint **Physic::joints = NULL;
 int Physic::all_rigidbodies = 0;
 int Physic::num_rigidbodies = 0;
 RigidBody **Physic::rigidbodies = NULL;
+int Physic::integrate_counter = 0;
+
+int Physic::num_sorted_rigidbodies = 0;
+int Physic::all_sorted_rigidbodies = 0;
+RigidBody **Physic::sorted_rigidbodies = NULL;
+float Physic::sort_time = 0.0;
+
+int Physic::all_contact_rigidbodies = 0;
+int Physic::num_contact_rigidbodies = 0;
+RigidBody **Physic::contact_rigidbodies = NULL;
+float Physic::contacts_time = 0.0;
+
+int Physic::num_next_joints = 0;
+Joint **Physic::next_joints = NULL;
+int Physic::num_next_rigidbodies = 0;
+RigidBody **Physic::next_rigidbodies = NULL;
+
+#ifdef _WIN32
+HANDLE Physic::thread;
+#else
+pthread_t Physic::thread;
+#endif
+Semaphore *Physic::thread_start = NULL;
+Semaphore *Physic::thread_done = NULL;
+int Physic::thread_exit = 0;
+float Physic::thread_ifps = 0.0f;
+int Physic::running = 0;
+
+int Physic::island_counter = 0;
+int Physic::island_zero_restitution = 0;
+int Physic::island_iteration = 0;
+
+int Physic::all_islands = 0;
+int Physic::num_islands = 0;
+Physic::Island *Physic::islands = NULL;
+RigidBody **Physic::island_rigidbodies = NULL;
+int Physic::all_island_joints = 0;
+Joint **Physic::island_joints = NULL;
 
 /*
  */
@@ -50,14 +108,136 @@ int rigidbody_cmp(const void *a,const void *b) {
 	RigidBody *r1 = *(RigidBody**)b;
 	if(r0->pos.z > r1->pos.z) return 1;
 	if(r0->pos.z < r1->pos.z) return -1;
-	return 0;
+	return r0->object->id - r1->object->id;	// the order doesn`t depend on the registration
 }
 
-/*
+/* simulation in the calling thread
  */
 void Physic::update(float ifps) {
+	wait();
+	swap();
+	step(ifps);
+}
+
+/* rigidbodies and joints registered since the last step are simulated
+ * the worker pool is changed here, it is used by the main thread during the step
+ */
+void Physic::swap() {
+	
+	Thread::init(num_threads);
+	
+	RigidBody **rb = rigidbodies;
+	rigidbodies = next_rigidbodies;
+	next_rigidbodies = rb;
+	num_rigidbodies = num_next_rigidbodies;
+	num_next_rigidbodies = 0;
+	
+	Joint **j = joints;
+	joints = next_joints;
+	next_joints = j;
+	num_joints = num_next_joints;
+	num_next_joints = 0;
+	
+	// new simulate - new objects
+	for(int i = 0; i < num_rigidbodies; i++) {
+		rigidbodies[i]->simulated = 0;
+	}
+	
+	copyObjects();
+}
+
+/* objects without rigidbody are moved by the main thread during the step
+ * the physic thread collides with their copies made between the steps
+ */
+void Physic::copyObjects() {
+	for(int i = 0; i < Engine::num_objects; i++) {
+		copyObject(Engine::objects[i]);
+	}
+}
+
+void Physic::copyObject(Object *object) {
+	if(object->rigidbody || (object->is_identity && object->physic_identity)) return;
+	object->physic_identity = object->is_identity;
+	object->physic_transform = object->transform;
+	object->physic_itransform = object->itransform;
+}
+
+/* rigidbodies are moved a little between the steps,
+ * so the order of the last step is almost sorted
+ */
+void Physic::sortRigidBodies() {
 	
-	qsort(rigidbodies,num_rigidbodies,sizeof(RigidBody*),rigidbody_cmp);
+	double time = Thread::getTime();
+	
+	if(incremental_sort) {
+		int num = num_sorted_rigidbodies + num_rigidbodies;
+		if(all_sorted_rigidbodies < num) {
+			delete [] sorted_rigidbodies;
+			all_sorted_rigidbodies = num * 2;
+			sorted_rigidbodies = new RigidBody*[all_sorted_rigidbodies];
+		}
+		
+		// rigidbodies on the places of the last step and the new ones
+		RigidBody **last = sorted_rigidbodies;
+		RigidBody **added = sorted_rigidbodies + num_sorted_rigidbodies;
+		int num_added = 0;
+		memset(last,0,sizeof(RigidBody*) * num_sorted_rigidbodies);
+		for(int i = 0; i < num_rigidbodies; i++) {
+			RigidBody *rb = rigidbodies[i];
+			if(rb->order >= 0 && rb->order < num_sorted_rigidbodies && last[rb->order] == NULL) last[rb->order] = rb;
+			else added[num_added++] = rb;
+		}
+		int num_last = 0;
+		for(int i = 0; i < num_sorted_rigidbodies; i++) {
+			if(last[i]) last[num_last++] = last[i];
+		}
+		
+		// insertion sort while the rigidbodies are moved a little
+		int num_moves = 0;
+		for(int i = 1; i < num_last && num_moves <= num_last * 4; i++) {
+			RigidBody *rb = last[i];
+			int j = i;
+			for(; j > 0 && rigidbody_cmp(&last[j - 1],&rb) > 0; j--) last[j] = last[j - 1];
+			last[j] = rb;
+			num_moves += i - j;
+		}
+		if(num_moves > num_last * 4) qsort(last,num_last,sizeof(RigidBody*),rigidbody_cmp);
+		qsort(added,num_added,sizeof(RigidBody*),rigidbody_cmp);
+		
+		// merge
+		int i = 0;
+		int j = 0;
+		num = 0;
+		while(i < num_last && j < num_added) {
+			if(rigidbody_cmp(&last[i],&added[j]) < 0) rigidbodies[num++] = last[i++];
+			else rigidbodies[num++] = added[j++];
+		}
+		while(i < num_last) rigidbodies[num++] = last[i++];
+		while(j < num_added) rigidbodies[num++] = added[j++];
+	} else {
+		qsort(rigidbodies,num_rigidbodies,sizeof(RigidBody*),rigidbody_cmp);
+	}
+	
+	for(int i = 0; i < num_rigidbodies; i++) {
+		rigidbodies[i]->order = i;
+	}
+	num_sorted_rigidbodies = num_rigidbodies;
+	
+	sort_time = (float)(Thread::getTime() - time);
+}
+
+/*
+ */
+void Physic::step(float ifps) {
+	
+	sortRigidBodies();
+	
+	if(all_contact_rigidbodies < num_rigidbodies) {
+		delete [] contact_rigidbodies;
+		all_contact_rigidbodies = num_rigidbodies;
+		contact_rigidbodies = new RigidBody*[all_contact_rigidbodies];
+	}
+	contacts_time = 0.0;
 	
 	time += ifps;
 	
@@ -65,80 +245,670 @@ void Physic::update(float ifps) {
 		
 		time -= time_step;
 		
+		// state before the step for the interpolation
+		if(running) {
+			for(int i = 0; i < num_rigidbodies; i++) {
+				RigidBody *rb = rigidbodies[i];
+				rb->old_pos = rb->pos;
+				rb->old_orienation = rb->orienation;
+			}
+		}
+		
+		num_contact_rigidbodies = 0;
 		for(int i = 0; i < num_rigidbodies; i++) {
 			RigidBody *rb = rigidbodies[i];
 			
+			if(rb->frozen) continue;
+			
 			rb->force = vec3(0,0,0);
 			rb->torque = vec3(0,0,0);
 			
-			if(rb->frozen == 0) rb->findContacts(time_step);
-			
-			rb->frozen = 0;
+			contact_rigidbodies[num_contact_rigidbodies++] = rb;
 		}
+		findContacts();
 		
-		for(int i = 0; i < num_first_iterations; i++) {
-			int done = 1;
-			for(int j = 0; j < num_rigidbodies; j++) {
-				if(rigidbodies[j]->contactsResponse(time_step) == 0) done = 0;
-			}
-			for(int j = 0; j < num_joints; j++) {
-				joints[j]->response(time_step);
-			}
-			if(done) break;
-		}
+		wakeIslands();
 		
+		findIslands();
+		solveIslands(num_first_iterations,0);
+		
+		num_contact_rigidbodies = 0;
 		for(int i = 0; i < num_rigidbodies; i++) {
 			RigidBody *rb = rigidbodies[i];
 			
-			if(rb->collide->num_contacts > 0 && rb->num_joints == 0 &&
+			if(rb->frozen) continue;
+			
+			if((rb->collide->num_contacts > 0 || rb->num_joints > 0) &&
 				rb->velocity * rb->velocity < velocity_threshold &&
 				rb->angularVelocity * rb->angularVelocity < angularVelocity_threshold) {
 				
 				rb->frozen_time += time_step;
-				if(rb->frozen_time > time_to_frost) {
-					if(rb->frozen_num_objects == rb->collide->num_objects) {
-						rb->frozen = 1;
-						rb->velocity = vec3(0,0,0);
-						rb->angularVelocity = vec3(0,0,0);
-					} else {
-						rb->frozen = 0;
-						rb->frozen_time = 0.0;
-						rb->findContacts(time_step);
-					}
-				}
-				rb->frozen_num_objects = rb->collide->num_objects;
 			} else {
-				rb->frozen = 0;
 				rb->frozen_time = 0.0;
-				rb->findContacts(time_step);
+				contact_rigidbodies[num_contact_rigidbodies++] = rb;
 			}
-			
-			rb->calcForce(time_step);
-			rb->integrateVelocity(time_step);
 		}
+		findContacts();
 		
-		for(int i = 0; i < num_second_iterations; i++) {
-			int done = 1;
-			for(int j = 0; j < num_rigidbodies; j++) {
-				if(rigidbodies[j]->contactsResponse(time_step,true) == 0) done = 0;
-			}
-			for(int j = 0; j < num_joints; j++) {
-				joints[j]->response(time_step);
-			}
-			if(done) break;
+		integrate_counter++;
+		for(int i = 0; i < num_rigidbodies; i++) {
+			RigidBody *rb = rigidbodies[i];
+			if(rb->frozen == 0) rb->counter = integrate_counter;
 		}
+		RigidBody::integrateVelocity(integrate_counter,time_step);
+		
+		findIslands();	// contacts are changed
+		solveIslands(num_second_iterations,1);
 		
+		num_contacts = 0;
+		num_frozen_rigidbodies = 0;
+		integrate_counter++;
 		for(int i = 0; i < num_rigidbodies; i++) {
-			if(rigidbodies[i]->frozen == 0) rigidbodies[i]->integratePos(time_step);
+			RigidBody *rb = rigidbodies[i];
+			if(rb->frozen) {
+				num_frozen_rigidbodies++;
+				continue;
+			}
+			num_contacts += rb->collide->num_contacts;
+			rb->counter = integrate_counter;
+		}
+		RigidBody::integratePos(integrate_counter,time_step);
+		for(int i = 0; i < num_rigidbodies; i++) {
+			RigidBody *rb = rigidbodies[i];
+			if(rb->frozen) continue;
+			rb->updateTransform();
+			rb->updatePos();
 		}
+		
+		freezeIslands();
 	}
 	
-	// new simulate - new objects
 	for(int i = 0; i < num_rigidbodies; i++) {
-		rigidbodies[i]->simulated = 0;
 		rigidbodies[i]->immovable = 0;
 	}
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* contacts                                                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+/* all rigidbodies are moved to the predicted positions before the narrowphase,
+ * so the contacts don`t depend on the order of the rigidbodies and the number of threads
+ * the broadphase is updated in the order of rigidbodies between the passes
+ */
+void Physic::findContacts() {
+	double t = Thread::getTime();
+	Thread::run(predictContacts,NULL,num_contact_rigidbodies);
+	for(int i = 0; i < num_contact_rigidbodies; i++) {
+		contact_rigidbodies[i]->updatePos();
+	}
+	Thread::run(collideContacts,NULL,num_contact_rigidbodies);
+	for(int i = 0; i < num_contact_rigidbodies; i++) {
+		contact_rigidbodies[i]->restorePos();
+	}
+	contacts_time += (float)(Thread::getTime() - t);
+}
+
+void Physic::predictContacts(void*,int num) {
+	contact_rigidbodies[num]->predictPos(time_step);
+}
+
+void Physic::collideContacts(void*,int num) {
+	contact_rigidbodies[num]->findContacts();
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* physic thread                                                             */
+/*                                                                           */
+/*****************************************************************************/
+
+/* the physic thread doesn`t touch the objects, the renderer draws them
+ * between the last two steps while the next one is simulated
+ * everything which changes the rigidbodies waits for the step first
+ */
+void Physic::begin(float ifps) {
+	
+	if(threaded == 0) {
+		shutdown();
+		update(ifps);
+		return;
+	}
+	
+	if(thread_start == NULL) {
+		thread_start = new Semaphore();
+		thread_done = new Semaphore();
+		thread_exit = 0;
+#ifdef _WIN32
+		DWORD id;
+		thread = CreateThread(NULL,0,worker,NULL,0,&id);
+#else
+		if(pthread_create(&thread,NULL,worker,NULL)) {
+			fprintf(stderr,"Physic::begin(): can`t create thread\n");
+			delete thread_start;
+			delete thread_done;
+			thread_start = NULL;
+			thread_done = NULL;
+			threaded = 0;
+			update(ifps);
+			return;
+		}
+#endif
+	}
+	
+	wait();
+	swap();
+	
+	thread_ifps = ifps;
+	running = 1;
+	thread_start->post();
+}
+
+/*
+ */
+void Physic::wait() {
+	if(running == 0) return;
+	thread_done->wait();
+	running = 0;
+	publish();
+}
+
+/*
+ */
+void Physic::shutdown() {
+	if(thread_start == NULL) return;
+	wait();
+	thread_exit = 1;
+	thread_start->post();
+#ifdef _WIN32
+	WaitForSingleObject(thread,INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread,NULL);
+#endif
+	delete thread_start;
+	delete thread_done;
+	thread_start = NULL;
+	thread_done = NULL;
+}
+
+/* objects are placed between the last two steps
+ */
+void Physic::publish() {
+	float k = time / time_step;
+	for(int i = 0; i < num_rigidbodies; i++) {
+		RigidBody *rb = rigidbodies[i];
+		if(rb->frozen && rb->old_pos == rb->pos) continue;
+		quat q;
+		q.slerp(quat(rb->old_orienation),quat(rb->orienation),k);
+		vec3 pos = rb->old_pos + (rb->pos - rb->old_pos) * k;
+		Object *object = rb->object;
+		object->transform = mat4(q.to_matrix());
+		object->transform[12] = pos.x;
+		object->transform[13] = pos.y;
+		object->transform[14] = pos.z;
+		object->itransform = object->transform.inverse();
+		object->updatePos(pos,0);	// the proxy follows the simulated body
+	}
+}
+
+/*
+ */
+#ifdef _WIN32
+DWORD WINAPI Physic::worker(void*) {
+#else
+void *Physic::worker(void*) {
+#endif
+	while(1) {
+		thread_start->wait();
+		if(thread_exit) break;
+		step(thread_ifps);
+		thread_done->post();
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* snapshot                                                                  */
+/*                                                                           */
+/*****************************************************************************/
+
+/*
+ */
+int Physic::getSnapshotSize() {
+	wait();
+	int size = sizeof(Snapshot);
+	for(int i = 0; i < num_rigidbodies; i++) {
+		RigidBody *rb = rigidbodies[i];
+		size += sizeof(SnapshotRigidBody) + sizeof(RigidBody::Impulse) * rb->num_impulses;
+		if(rb->frozen) size += sizeof(Collide::Contact) * rb->collide->num_contacts;
+	}
+	return size;
+}
+
+/* the state which is saved by the step,
+ * all the rest is found again from it
+ */
+int Physic::saveSnapshot(void *data) {
+	
+	wait();
+	
+	unsigned char *d = (unsigned char*)data;
+	
+	Snapshot *snapshot = (Snapshot*)d;
+	snapshot->num_rigidbodies = num_rigidbodies;
+	snapshot->time = time;
+	d += sizeof(Snapshot);
+	
+	for(int i = 0; i < num_rigidbodies; i++) {
+		RigidBody *rb = rigidbodies[i];
+		
+		SnapshotRigidBody *s = (SnapshotRigidBody*)d;
+		s->handle = rb->handle;
+		s->generation = rb->generation;
+		s->frozen_next_handle = rb->frozen_next->handle;
+		s->frozen_next_generation = rb->frozen_next->generation;
+		s->pos = rb->pos;
+		s->orienation = rb->orienation;
+		s->iWorldInertiaTensor = rb->iWorldInertiaTensor;
+		s->velocity = rb->velocity;
+		s->angularVelocity = rb->angularVelocity;
+		s->angularMomentum = rb->angularMomentum;
+		s->force = rb->force;
+		s->torque = rb->torque;
+		s->frozen_time = rb->frozen_time;
+		s->frozen = rb->frozen;
+		s->immovable = rb->immovable;
+		s->num_impulses = rb->num_impulses;
+		s->num_contacts = rb->frozen ? rb->collide->num_contacts : 0;
+		d += sizeof(SnapshotRigidBody);
+		
+		RigidBody::Impulse *impulses = (RigidBody::Impulse*)d;
+		for(int j = 0; j < s->num_impulses; j++) {
+			impulses[j] = rb->impulses[j];
+		}
+		d += sizeof(RigidBody::Impulse) * s->num_impulses;
+		
+		// awake rigidbodies find the contacts again
+		Collide::Contact *contacts = (Collide::Contact*)d;
+		for(int j = 0; j < s->num_contacts; j++) {
+			contacts[j] = rb->collide->contacts[j];
+		}
+		d += sizeof(Collide::Contact) * s->num_contacts;
+	}
+	
+	snapshot->size = (int)(d - (unsigned char*)data);
+	
+	return snapshot->size;
+}
+
+/* transformations are calculated in the same way as by the RigidBody::integratePos(),
+ * so the simulation is repeated exactly
+ */
+int Physic::restoreSnapshot(const void *data,int size) {
+	
+	wait();
+	
+	const unsigned char *d = (const unsigned char*)data;
+	
+	const Snapshot *snapshot = (const Snapshot*)d;
+	if(size < (int)sizeof(Snapshot) || snapshot->size != size) {
+		fprintf(stderr,"Physic::restoreSnapshot(): bad snapshot size %d\n",size);
+		return 0;
+	}
+	time = snapshot->time;
+	d += sizeof(Snapshot);
+	
+	int num_deleted = 0;
+	for(int i = 0; i < snapshot->num_rigidbodies; i++) {
+		const SnapshotRigidBody *s = (const SnapshotRigidBody*)d;
+		d += sizeof(SnapshotRigidBody);
+		
+		// the rigidbody is deleted after the save
+		RigidBody *rb = RigidBody::getHandle(s->handle,s->generation);
+		if(rb == NULL) {
+			d += sizeof(RigidBody::Impulse) * s->num_impulses;
+			if(s->frozen) d += sizeof(Collide::Contact) * s->num_contacts;
+			num_deleted++;
+			continue;
+		}
+		
+		rb->frozen_next = RigidBody::getHandle(s->frozen_next_handle,s->frozen_next_generation);
+		rb->pos = s->pos;
+		rb->orienation = s->orienation;
+		rb->iWorldInertiaTensor = s->iWorldInertiaTensor;
+		rb->velocity = s->velocity;
+		rb->angularVelocity = s->angularVelocity;
+		rb->angularMomentum = s->angularMomentum;
+		rb->force = s->force;
+		rb->torque = s->torque;
+		rb->frozen_time = s->frozen_time;
+		rb->frozen = s->frozen;
+		rb->immovable = s->immovable;
+		
+		const RigidBody::Impulse *impulses = (const RigidBody::Impulse*)d;
+		for(int j = 0; j < s->num_impulses; j++) {
+			rb->impulses[j] = impulses[j];
+		}
+		rb->num_impulses = s->num_impulses;
+		d += sizeof(RigidBody::Impulse) * s->num_impulses;
+		
+		if(s->frozen) {
+			const Collide::Contact *contacts = (const Collide::Contact*)d;
+			for(int j = 0; j < s->num_contacts; j++) {
+				rb->collide->contacts[j] = contacts[j];
+			}
+			rb->collide->num_contacts = s->num_contacts;
+			d += sizeof(Collide::Contact) * s->num_contacts;
+		}
+		
+		// derived state
+		rb->transform = mat4(rb->orienation);
+		rb->transform[12] = rb->pos.x;
+		rb->transform[13] = rb->pos.y;
+		rb->transform[14] = rb->pos.z;
+		rb->itransform = rb->transform.inverse();
+		
+		rb->old_pos = rb->pos;
+		rb->old_orienation = rb->orienation;
+		rb->position = rb->pos;
+		
+		Object *object = rb->object;
+		object->transform = rb->transform;
+		object->itransform = rb->itransform;
+		object->updatePos(rb->pos);
+	}
+	
+	if(num_deleted == 0) return 1;
+	
+	// the frozen islands of the deleted rigidbodies are broken,
+	// their rigidbodies are awake and find the contacts again
+	d = (const unsigned char*)data + sizeof(Snapshot);
+	for(int i = 0; i < snapshot->num_rigidbodies; i++) {
+		const SnapshotRigidBody *s = (const SnapshotRigidBody*)d;
+		d += sizeof(SnapshotRigidBody) + sizeof(RigidBody::Impulse) * s->num_impulses;
+		if(s->frozen) d += sizeof(Collide::Contact) * s->num_contacts;
+		RigidBody *rb = RigidBody::getHandle(s->handle,s->generation);
+		if(rb == NULL || rb->frozen == 0) continue;
+		RigidBody *next = rb->frozen_next;
+		for(int j = 0; next && next != rb && j < snapshot->num_rigidbodies; j++) next = next->frozen_next;
+		if(next != rb) rb->frozen = 0;
+	}
+	d = (const unsigned char*)data + sizeof(Snapshot);
+	for(int i = 0; i < snapshot->num_rigidbodies; i++) {
+		const SnapshotRigidBody *s = (const SnapshotRigidBody*)d;
+		d += sizeof(SnapshotRigidBody) + sizeof(RigidBody::Impulse) * s->num_impulses;
+		if(s->frozen) d += sizeof(Collide::Contact) * s->num_contacts;
+		RigidBody *rb = RigidBody::getHandle(s->handle,s->generation);
+		if(rb == NULL || s->frozen == 0 || rb->frozen) continue;
+		rb->frozen_time = 0.0f;
+		rb->frozen_next = rb;
+	}
+	
+	return 1;
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* islands                                                                   */
+/*                                                                           */
+/*****************************************************************************/
+
+/* union-find with path halving
+ * bodies are reinitialized lazily by the island_counter stamp, so rigidbodies
+ * which are touched through contacts but are not simulated are handled too
+ */
+RigidBody *Physic::findIsland(RigidBody *rb) {
+	if(rb->island_counter != island_counter) {
+		rb->island_counter = island_counter;
+		rb->island_parent = rb;
+		rb->island = -1;
+		return rb;
+	}
+	while(rb->island_parent != rb) {
+		rb->island_parent = rb->island_parent->island_parent;
+		rb = rb->island_parent;
+	}
+	return rb;
+}
+
+/* bodies connected by rigidbody contacts or joints are solved together
+ * each island keeps the global order of rigidbodies and joints
+ * frozen rigidbodies are left out, the others see them as immovable
+ */
+void Physic::findIslands() {
+	
+	island_counter++;
+	
+	for(int i = 0; i < num_rigidbodies; i++) {
+		RigidBody *rb = rigidbodies[i];
+		if(rb->frozen) continue;
+		RigidBody *root = findIsland(rb);
+		for(int j = 0; j < rb->collide->num_contacts; j++) {
+			RigidBody *other = rb->collide->contacts[j].object->rigidbody;
+			if(other == NULL || other->frozen) continue;
+			RigidBody *other_root = findIsland(other);
+			if(other_root != root) {
+				other_root->island_parent = root;
+			}
+		}
+		for(int j = 0; j < rb->num_joints; j++) {
+			if(rb->joined_rigidbodies[j]->frozen) continue;
+			RigidBody *other_root = findIsland(rb->joined_rigidbodies[j]);
+			if(other_root != root) {
+				other_root->island_parent = root;
+			}
+		}
+	}
+	
+	if(all_islands < num_rigidbodies) {
+		delete [] islands;
+		delete [] island_rigidbodies;
+		all_islands = num_rigidbodies;
+		islands = new Island[all_islands];
+		island_rigidbodies = new RigidBody*[all_islands];
+	}
+	if(all_island_joints < num_joints) {
+		delete [] island_joints;
+		all_island_joints = num_joints;
+		island_joints = new Joint*[all_island_joints];
+	}
 	
-	num_rigidbodies = 0;
-	num_joints = 0;
+	// count
+	num_islands = 0;
+	for(int i = 0; i < num_rigidbodies; i++) {
+		if(rigidbodies[i]->frozen) continue;
+		RigidBody *root = findIsland(rigidbodies[i]);
+		if(root->island == -1) {
+			Island *island = &islands[num_islands];
+			island->num_rigidbodies = 0;
+			island->num_joints = 0;
+			island->num_chain_joints = 0;
+			island->done = 0;
+			island->residual = 0.0f;
+			island->time = 0.0f;
+			root->island = num_islands++;
+		}
+		rigidbodies[i]->island = root->island;
+		islands[root->island].num_rigidbodies++;
+	}
+	for(int i = 0; i < num_joints; i++) {
+		if(joints[i]->rigidbody_0->frozen) continue;
+		Island *island = &islands[findIsland(joints[i]->rigidbody_0)->island];
+		island->num_joints++;
+		if(joint_chains && joints[i]->chain) island->num_chain_joints++;
+	}
+	
+	// fill
+	RigidBody **rb = island_rigidbodies;
+	Joint **j = island_joints;
+	for(int i = 0; i < num_islands; i++) {
+		Island *island = &islands[i];
+		island->rigidbodies = rb;
+		island->joints = j;
+		rb += island->num_rigidbodies;
+		j += island->num_joints;
+		island->num_rigidbodies = 0;
+		island->num_joints = 0;
+	}
+	for(int i = 0; i < num_rigidbodies; i++) {
+		if(rigidbodies[i]->frozen) continue;
+		Island *island = &islands[rigidbodies[i]->island];
+		island->rigidbodies[island->num_rigidbodies++] = rigidbodies[i];
+	}
+	for(int i = 0; i < num_joints; i++) {
+		if(joints[i]->rigidbody_0->frozen) continue;
+		Island *island = &islands[findIsland(joints[i]->rigidbody_0)->island];
+		island->joints[island->num_joints++] = joints[i];
+	}
+}
+
+/* frozen islands touched by awake rigidbodies are woken up
+ * woken rigidbodies keep the contacts found before they were frozen
+ */
+void Physic::wakeIslands() {
+	for(int i = 0; i < num_rigidbodies; i++) {
+		RigidBody *rb = rigidbodies[i];
+		if(rb->frozen) continue;
+		for(int j = 0; j < rb->collide->num_contacts; j++) {
+			RigidBody *other = rb->collide->contacts[j].object->rigidbody;
+			if(other && other->frozen) other->wake();
+		}
+		for(int j = 0; j < rb->num_joints; j++) {
+			if(rb->joined_rigidbodies[j]->frozen) rb->joined_rigidbodies[j]->wake();
+		}
+	}
+}
+
+/* an island is frozen when all its rigidbodies are at rest
+ * frozen rigidbodies are linked in the ring, so the whole island is woken up at once
+ */
+void Physic::freezeIslands() {
+	for(int i = 0; i < num_islands; i++) {
+		Island *island = &islands[i];
+		int j = 0;
+		for(; j < island->num_rigidbodies; j++) {
+			if(island->rigidbodies[j]->frozen_time < time_to_frost) break;
+		}
+		if(j != island->num_rigidbodies) continue;
+		for(j = 0; j < island->num_rigidbodies; j++) {
+			RigidBody *rb = island->rigidbodies[j];
+			rb->frozen = 1;
+			rb->frozen_next = island->rigidbodies[(j + 1) % island->num_rigidbodies];
+			rb->velocity = vec3(0,0,0);
+			rb->angularVelocity = vec3(0,0,0);
+			rb->angularMomentum = vec3(0,0,0);
+		}
+	}
+}
+
+/* all islands make the same iterations as the serial solver would,
+ * so the result doesn't depend on the number of threads
+ * an island which is done is left untouched, unless it has joints
+ * outside of the chains, they are converged only by the iterations
+ */
+void Physic::solveIslands(int num_iterations,int zero_restitution) {
+	island_zero_restitution = zero_restitution;
+	if(zero_restitution) {
+		Physic::num_iterations = 0;
+		residual = 0.0;
+	}
+	for(int i = 0; i < num_iterations; i++) {
+		island_iteration = i;
+		Thread::run(solveIsland,NULL,num_islands);
+		int done = 1;
+		if(zero_restitution) {
+			Physic::num_iterations++;
+			residual = 0.0;
+			for(int j = 0; j < num_islands; j++) {
+				if(residual < islands[j].residual) residual = islands[j].residual;
+			}
+		}
+		for(int j = 0; j < num_islands; j++) {
+			if(islands[j].done == 0) {
+				done = 0;
+				break;
+			}
+		}
+		if(done) break;
+	}
+}
+
+void Physic::solveIsland(void*,int num) {
+	Island *island = &islands[num];
+	if(island->done && island->num_joints == island->num_chain_joints) return;
+	double time = Thread::getTime();
+	int done = 1;
+	if(island_zero_restitution && island_iteration == 0) {
+		for(int i = 0; i < island->num_rigidbodies; i++) {
+			island->rigidbodies[i]->warmStart();
+		}
+	}
+	island->residual = 0.0;
+	for(int i = 0; i < island->num_rigidbodies; i++) {
+		RigidBody *rb = island->rigidbodies[i];
+		if(rb->contactsResponse(time_step,island_zero_restitution) == 0) done = 0;
+		if(island_zero_restitution && island->residual < rb->residual) island->residual = rb->residual;
+	}
+	for(int i = 0; i < island->num_joints; i++) {
+		Joint *joint = island->joints[i];
+		if(island->num_chain_joints && joint->chain) {
+			// whole chain is solved at its first joint
+			JointChain *chain = joint->chain;
+			if(chain->joints[0] != joint) continue;
+			if(chain->response(time_step,island_iteration == 0) == 0) done = 0;
+			if(island_zero_restitution && island->residual < chain->residual) island->residual = chain->residual;
+			continue;
+		}
+		joint->response(time_step);
+	}
+	island->done = done;
+	island->time += (float)(Thread::getTime() - time);
+}
+
+/*
+ */
+int Physic::getNumIterations() {
+	return num_iterations;
+}
+
+float Physic::getResidual() {
+	return residual;
+}
+
+int Physic::getNumContacts() {
+	return num_contacts;
+}
+
+int Physic::getNumFrozenRigidBodies() {
+	return num_frozen_rigidbodies;
+}
+
+float Physic::getContactsTime() {
+	return contacts_time;
+}
+
+float Physic::getSortTime() {
+	return sort_time;
+}
+
+/*
+ */
+int Physic::getNumIslands() {
+	return num_islands;
+}
+
+int Physic::getIslandNumRigidBodies(int island) {
+	return islands[island].num_rigidbodies;
+}
+
+int Physic::getIslandNumJoints(int island) {
+	return islands[island].num_joints;
+}
+
+float Physic::getIslandTime(int island) {
+	return islands[island].time;
 }
@@ -20,6 +20,10 @@
 #ifndef __PHYSIC_H__
 #define __PHYSIC_H__
 
+#include "mathlib.h"
+#include "thread.h"
+
+class Object;
 class Joint;
 class RigidBody;
 
@@ -27,6 +31,46 @@ class Physic {
 public:
 	
 	static void update(float ifps);
+	
+	// physic thread
+	static void begin(float ifps);	// publish the last step and start the next one
+	static void wait();				// wait for the step of the physic thread
+	static void shutdown();
+	
+	static void copyObject(Object *object);	// transformation of the object without rigidbody for the next step
+	
+	static int threaded;		// simulate in the physic thread
+	static int num_threads;		// contact and island solver threads
+	
+	static float time_step;
+	static float velocity_max;
+	static int continuous;		// continuous collision of fast spheres
+	static int joint_chains;	// direct solve of the joint chains
+	static int max_contacts;	// contacts of the rigidbody for the solver
+	static int incremental_sort;	// rigidbodies are sorted from the order of the last step
+	
+	static int num_first_iterations;	// restitution pass
+	static int num_second_iterations;	// accumulated impulses pass
+	
+	// solver of the last step
+	static int getNumIterations();
+	static float getResidual();
+	static int getNumContacts();
+	static int getNumFrozenRigidBodies();
+	static float getContactsTime();
+	static float getSortTime();
+	
+	// snapshot of the simulated rigidbodies for the rollback
+	// rigidbodies are referenced by the pool handles, the deleted ones are skipped by the restore
+	static int getSnapshotSize();
+	static int saveSnapshot(void *data);	// returns the size of the snapshot
+	static int restoreSnapshot(const void *data,int size);
+	
+	// islands of the last solver pass
+	static int getNumIslands();
+	static int getIslandNumRigidBodies(int island);
+	static int getIslandNumJoints(int island);
+	static float getIslandTime(int island);
 
 protected:
 	
@@ -35,17 +79,23 @@ protected:
 	friend class JointBall;
 	friend class JointHinge;
 	friend class JointUniversal;
+	friend class JointChain;
 	
 	static float time;
-	static float time_step;
 	static float gravitation;
-	static float velocity_max;
 	static float velocity_threshold;
 	static float angularVelocity_threshold;
 	static float time_to_frost;
 	static float penetration_speed;
-	static int num_first_iterations;
-	static int num_second_iterations;
+	static float penetration_tolerance;
+	static float contact_distance;
+	static float warm_starting;
+	static float residual_threshold;
+	
+	static int num_iterations;
+	static float residual;
+	static int num_contacts;
+	static int num_frozen_rigidbodies;
 	
 	static int all_joints;
 	static int num_joints;
@@ -54,6 +104,111 @@ protected:
 	static int all_rigidbodies;
 	static int num_rigidbodies;
 	static RigidBody **rigidbodies;
+	static int integrate_counter;	// rigidbodies integrated by the pool loops
+	
+	// order of the last step
+	static void sortRigidBodies();
+	
+	static int num_sorted_rigidbodies;
+	static int all_sorted_rigidbodies;
+	static RigidBody **sorted_rigidbodies;
+	static float sort_time;
+	
+	// registered by RigidBody::simulate() for the next step
+	static int num_next_joints;
+	static Joint **next_joints;
+	static int num_next_rigidbodies;
+	static RigidBody **next_rigidbodies;
+	
+	static void swap();
+	static void copyObjects();
+	static void step(float ifps);
+	static void publish();
+	
+	// contacts
+	static void findContacts();
+	static void predictContacts(void *data,int num);
+	static void collideContacts(void *data,int num);
+	
+	static int all_contact_rigidbodies;
+	static int num_contact_rigidbodies;
+	static RigidBody **contact_rigidbodies;
+	static float contacts_time;
+	
+	// physic thread
+#ifdef _WIN32
+	static DWORD WINAPI worker(void *data);
+#else
+	static void *worker(void *data);
+#endif
+
+#ifdef _WIN32
+	static HANDLE thread;
+#else
+	static pthread_t thread;
+#endif
+	static Semaphore *thread_start;
+	static Semaphore *thread_done;
+	static int thread_exit;
+	static float thread_ifps;
+	static int running;
+	
+	// snapshot
+	struct Snapshot {
+		int size;
+		int num_rigidbodies;
+		float time;
+	};
+	
+	struct SnapshotRigidBody {
+		int handle;				// handles and generations of the pool
+		int generation;
+		int frozen_next_handle;	// ring of the frozen island
+		int frozen_next_generation;
+		vec3 pos;
+		mat3 orienation;
+		mat3 iWorldInertiaTensor;		// it is not updated before the first step
+		vec3 velocity;
+		vec3 angularVelocity;
+		vec3 angularMomentum;
+		vec3 force;				// damping of the last step is used by the prediction
+		vec3 torque;
+		float frozen_time;
+		int frozen;
+		int immovable;
+		int num_impulses;		// warm starting impulses follow the rigidbody
+		int num_contacts;		// contacts of the frozen rigidbody follow the impulses
+	};
+	
+	// islands
+	struct Island {
+		int num_rigidbodies;
+		RigidBody **rigidbodies;
+		int num_joints;
+		Joint **joints;
+		int num_chain_joints;	// joints solved by the chains
+		int done;
+		float residual;
+		float time;
+	};
+	
+	static RigidBody *findIsland(RigidBody *rb);
+	static void findIslands();
+	static void wakeIslands();
+	static void freezeIslands();
+	static void solveIslands(int num_iterations,int zero_restitution);
+	static void solveIsland(void *data,int island);
+	
+	static int island_counter;
+	static int island_zero_restitution;
+	static int island_iteration;
+	
+	static int all_islands;
+	static int num_islands;
+	static Island *islands;
+	static RigidBody **island_rigidbodies;
+	static int all_island_joints;
+	static Joint **island_joints;
 };
 
 #endif /* __PHYSIC_H__ */
@@ -0,0 +1,450 @@
+/* 3D Engine_v0.2 headless physic benchmark
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+
+#include "engine.h"
+#include "console.h"
+#include "bsp.h"
+#include "frustum.h"
+#include "mesh.h"
+#include "object.h"
+#include "objectmesh.h"
+#include "objectskinnedmesh.h"
+#include "skinnedmesh.h"
+#include "ragdoll.h"
+#include "material.h"
+#include "rigidbody.h"
+#include "physic.h"
+#include "occlusion.h"
+#include "thread.h"
+
+/* the scenes are generated inside of the loaded map,
+ * because objects are placed through the bsp sectors
+ */
+#define BENCH_MAP		"physic.map"
+#define BENCH_POS		vec3(-0.8,1.0,-1.7)
+
+/*****************************************************************************/
+/*                                                                           */
+/* scenes                                                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+/* same random sequence on all platforms
+ */
+static unsigned int seed = 1;
+
+/* analytic shapes or convex hulls instead of the meshes
+ * both of them alternate, so the shapes collide with the hulls
+ */
+static int shapes = 0;
+static int hulls = 0;
+static int num_flags = 0;
+
+static int collide_flag(int flag) {
+	if(shapes && hulls) return (num_flags++ & 1) ? RigidBody::COLLIDE_HULL : RigidBody::COLLIDE_SHAPE;
+	if(shapes) return RigidBody::COLLIDE_SHAPE;
+	if(hulls) return RigidBody::COLLIDE_HULL;
+	return flag;
+}
+
+static float bench_random(float from,float to) {
+	seed = seed * 1664525 + 1013904223;
+	return from + (to - from) * (float)(seed >> 8) / (float)(1 << 24);
+}
+
+/* wall pyramid of num rows
+ */
+static void create_pyramid(const vec3 &pos,int num) {
+	Mesh *mesh = Engine::loadMesh("box.mesh");
+	Material *material = Engine::loadMaterial("box.mat");
+	vec3 size = mesh->getMax() - mesh->getMin();
+	for(int i = 0; i < num; i++) {
+		for(int j = 0; j < num - i; j++) {
+			ObjectMesh *object = new ObjectMesh(mesh);
+			object->bindMaterial("*",material);
+			object->setRigidBody(new RigidBody(object,10,0.0,0.5,collide_flag(RigidBody::COLLIDE_MESH) | RigidBody::BODY_BOX));
+			Engine::addObject(object);
+			object->set(pos + vec3((j - (num - i - 1) * 0.5f) * size.x * 1.02f,0,(i + 0.5f) * size.z * 1.01f));
+		}
+	}
+}
+
+/* ragdolls fall on each other
+ */
+static void create_ragdolls(const vec3 &pos,int num) {
+	for(int i = 0; i < num; i++) {
+		ObjectSkinnedMesh *object = new ObjectSkinnedMesh("ufo/ragdoll.txt");
+		object->bindMaterial("*",Engine::loadMaterial("ufo_body.mat"));
+		Engine::addObject(object);
+		object->set(mat4(pos + vec3(bench_random(-0.2,0.2),bench_random(-0.2,0.2),1.0f + i * 1.0f)) * mat4(0,0,1,bench_random(0,360)));
+		object->setRagDoll(new RagDoll(object->skinnedmesh,"ufo/ragdoll.conf"));
+	}
+}
+
+/* spheres fall from the ceiling
+ */
+static void create_rain(const vec3 &pos,int num) {
+	Mesh *mesh = Engine::loadMesh("robot_wheel.mesh");
+	Material *material = Engine::loadMaterial("robot_wheel.mat");
+	float radius = mesh->getRadius();
+	int side = (int)sqrt((float)num) + 1;
+	for(int i = 0; i < num; i++) {
+		ObjectMesh *object = new ObjectMesh(mesh);
+		object->bindMaterial("*",material);
+		object->setRigidBody(new RigidBody(object,10,0.3,0.6,collide_flag(RigidBody::COLLIDE_SPHERE) | RigidBody::BODY_SPHERE));
+		Engine::addObject(object);
+		float x = ((i % side) - side * 0.5f) * radius * 2.5f + bench_random(-0.05,0.05);
+		float y = (((i / side) % side) - side * 0.5f) * radius * 2.5f + bench_random(-0.05,0.05);
+		float z = 0.5f + (i / (side * side)) * radius * 2.5f + bench_random(0.0,radius * 0.25f);
+		object->set(pos + vec3(x,y,z));
+	}
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* main                                                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+/*
+ */
+static void usage() {
+	printf("usage: physicbench [options]\n");
+	printf("  -map name       map file (%s)\n",BENCH_MAP);
+	printf("  -scene name     none, pyramid, ragdoll or rain (pyramid)\n");
+	printf("  -num n          scene size: pyramid rows, ragdolls or spheres\n");
+	printf("  -pos x y z      scene position\n");
+	printf("  -steps n        measured steps (500)\n");
+	printf("  -warmup n       steps before the measurement (0)\n");
+	printf("  -threads n      contact and island solver threads (1)\n");
+	printf("  -shapes         analytic box and sphere colliders\n");
+	printf("  -hulls          convex hull colliders, alternated with -shapes\n");
+	printf("  -nochains       iterative solve of the ragdoll joints\n");
+	printf("  -qsort          full sort of the rigidbodies every step\n");
+	printf("  -rollback       every step is simulated, restored and simulated again\n");
+	printf("  -delete         one rigidbody is deleted between the save and the restore at the end,\n");
+	printf("                  the bones of the ragdolls can`t be deleted\n");
+	printf("  -rays n         line of sight segments after the simulation (0)\n");
+	printf("  -occlusion file occlusion depth of the first view from the scene position\n");
+	printf("  -reference file compare the occlusion depth with the image\n");
+	printf("  -frustum dist   frustum culling of the tree from the views behind the sectors\n");
+	printf("  -o file         append the result line to the file\n");
+}
+
+/*
+ */
+int main(int argc,char **argv) {
+	
+	const char *map = BENCH_MAP;
+	const char *scene = "pyramid";
+	const char *output = NULL;
+	int num = -1;
+	vec3 pos = BENCH_POS;
+	int num_steps = 500;
+	int num_warmup = 0;
+	int num_threads = 1;
+	int rollback = 0;
+	int delete_rigidbody = 0;
+	int num_rays = 0;
+	const char *occlusion_image = NULL;
+	const char *occlusion_reference = NULL;
+	float frustum_distance = 0.0f;
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i],"-map") && i + 1 < argc) map = argv[++i];
+		else if(!strcmp(argv[i],"-scene") && i + 1 < argc) scene = argv[++i];
+		else if(!strcmp(argv[i],"-num") && i + 1 < argc) num = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-pos") && i + 3 < argc) {
+			pos.x = atof(argv[++i]);
+			pos.y = atof(argv[++i]);
+			pos.z = atof(argv[++i]);
+		}
+		else if(!strcmp(argv[i],"-steps") && i + 1 < argc) num_steps = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-warmup") && i + 1 < argc) num_warmup = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-threads") && i + 1 < argc) num_threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-shapes")) shapes = 1;
+		else if(!strcmp(argv[i],"-hulls")) hulls = 1;
+		else if(!strcmp(argv[i],"-nochains")) Physic::joint_chains = 0;
+		else if(!strcmp(argv[i],"-qsort")) Physic::incremental_sort = 0;
+		else if(!strcmp(argv[i],"-rollback")) rollback = 1;
+		else if(!strcmp(argv[i],"-delete")) delete_rigidbody = 1;
+		else if(!strcmp(argv[i],"-rays") && i + 1 < argc) num_rays = atoi(argv[++i]);
+		else if(!strcmp(argv[i],"-occlusion") && i + 1 < argc) occlusion_image = argv[++i];
+		else if(!strcmp(argv[i],"-reference") && i + 1 < argc) occlusion_reference = argv[++i];
+		else if(!strcmp(argv[i],"-frustum") && i + 1 < argc) frustum_distance = atof(argv[++i]);
+		else if(!strcmp(argv[i],"-o") && i + 1 < argc) output = argv[++i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+	
+	// engine
+	Engine::headless = 1;
+	Engine::addPath("data/,"
+		"data/engine/,"
+		"data/textures/,"
+		"data/textures/cube/,"
+		"data/materials/,"
+		"data/shaders/,"
+		"data/meshes/,"
+		"data/physic/");
+	
+	if(Engine::init() == 0) return 1;
+	
+	Engine::load(map);
+	
+	if(!strcmp(scene,"pyramid")) create_pyramid(pos,num < 0 ? num = 10 : num);
+	else if(!strcmp(scene,"ragdoll")) create_ragdolls(pos,num < 0 ? num = 8 : num);
+	else if(!strcmp(scene,"rain")) create_rain(pos,num < 0 ? num = 200 : num);
+	else if(!strcmp(scene,"none")) num = 0;
+	else {
+		fprintf(stderr,"physicbench: unknown scene \"%s\"\n",scene);
+		return 1;
+	}
+	
+	Physic::num_threads = num_threads;
+	
+	// simulation
+	float ifps = 1.0f / 50.0f;
+	for(int i = 0; i < Engine::num_objects; i++) Engine::objects[i]->update(0.0f);
+	Physic::update(ifps);	// one step per update after this
+	
+	double time = 0.0;
+	double min_time = 1e10;
+	double max_time = 0.0;
+	double num_contacts = 0.0;
+	double num_iterations = 0.0;
+	double contacts_time = 0.0;
+	double sort_time = 0.0;
+	double snapshot_time = 0.0;
+	double snapshot_size = 0.0;
+	int all_snapshot = 0;
+	unsigned char *snapshot = NULL;
+	for(int i = -num_warmup; i < num_steps; i++) {
+		for(int j = 0; j < Engine::num_objects; j++) Engine::objects[j]->update(ifps);
+		
+		// the result must be the same as without the rollback
+		if(rollback) {
+			double t = Thread::getTime();
+			int size = Physic::getSnapshotSize();
+			if(all_snapshot < size) {
+				delete [] snapshot;
+				all_snapshot = size * 2;
+				snapshot = new unsigned char[all_snapshot];
+			}
+			Physic::saveSnapshot(snapshot);
+			t = Thread::getTime() - t;
+			Physic::update(ifps);
+			double r = Thread::getTime();
+			Physic::restoreSnapshot(snapshot,size);
+			t += Thread::getTime() - r;
+			for(int j = 0; j < Engine::num_objects; j++) Engine::objects[j]->update(0.0f);
+			if(i >= 0) {
+				snapshot_time += t;
+				snapshot_size += size;
+			}
+		}
+		
+		double t = Thread::getTime();
+		Physic::update(ifps);
+		t = Thread::getTime() - t;
+		if(i < 0) continue;
+		time += t;
+		if(min_time > t) min_time = t;
+		if(max_time < t) max_time = t;
+		num_contacts += Physic::getNumContacts();
+		num_iterations += Physic::getNumIterations();
+		contacts_time += Physic::getContactsTime();
+		sort_time += Physic::getSortTime();
+	}
+	if(num_steps < 1) num_steps = 1;
+	delete [] snapshot;
+	
+	// line of sight queries one by one, by the packets and with the first hit
+	double rays_time = 0.0;
+	double rays_batch_time = 0.0;
+	double rays_any_time = 0.0;
+	int num_hits = 0;
+	if(num_rays > 0) {
+		vec3 *line0 = new vec3[num_rays];
+		vec3 *line1 = new vec3[num_rays];
+		Object **objects = new Object*[num_rays];
+		vec3 *points = new vec3[num_rays];
+		for(int i = 0; i < num_rays; i++) {
+			// every agent looks at four targets
+			if(i % 4 == 0) line0[i] = pos + vec3(bench_random(-6.0,6.0),bench_random(-6.0,6.0),bench_random(0.0,4.0));
+			else line0[i] = line0[i - 1];
+			line1[i] = pos + vec3(bench_random(-6.0,6.0),bench_random(-6.0,6.0),bench_random(0.0,4.0));
+		}
+		double t = Thread::getTime();
+		for(int i = 0; i < num_rays; i++) {
+			vec3 point,normal;
+			if(Engine::intersection(line0[i],line1[i],point,normal)) num_hits++;
+		}
+		rays_time = Thread::getTime() - t;
+		t = Thread::getTime();
+		int num_batch_hits = Engine::intersection(line0,line1,num_rays,objects,points);
+		rays_batch_time = Thread::getTime() - t;
+		t = Thread::getTime();
+		int num_any_hits = Engine::intersection(line0,line1,num_rays,objects,points,1);
+		rays_any_time = Thread::getTime() - t;
+		if(num_batch_hits != num_hits || num_any_hits != num_hits) {
+			fprintf(stderr,"physicbench: %d segments are crossed, %d by the packets, %d by the first hit\n",num_hits,num_batch_hits,num_any_hits);
+		}
+		delete [] line0;
+		delete [] line1;
+		delete [] objects;
+		delete [] points;
+	}
+	
+	// software occlusion around the scene position
+	// bounds of the tree and of the objects are tested against the buffer
+	const int num_views = 8;
+	double occlusion_time = 0.0;
+	int occlusion_diff = -1;
+	if(occlusion_image || occlusion_reference) {
+		mat4 projection;
+		projection.perspective(89,4.0f / 3.0f,0.1,500);
+		Occlusion::num_triangles = 0;
+		Occlusion::num_tests = 0;
+		Occlusion::num_culled = 0;
+		for(int i = 0; i < num_views; i++) {
+			float angle = PI * 2.0f * i / num_views;
+			Engine::modelview.look_at(pos,pos + vec3(cos(angle),sin(angle),0),vec3(0,0,1));
+			Engine::imodelview = Engine::modelview.inverse();
+			Engine::camera = pos;
+			double t = Thread::getTime();
+			Engine::occlusion->clear(projection * Engine::modelview);
+			Engine::bsp->addOccluders();
+			Engine::occlusion->rasterize();
+			occlusion_time += Thread::getTime() - t;
+			for(int j = 0; j < Bsp::num_sectors; j++) {
+				Sector *s = &Bsp::sectors[j];
+				for(int k = 0; k < s->num_node_objects; k++) {
+					Engine::occlusion->inside(s->node_objects[k]->getMin(),s->node_objects[k]->getMax());
+				}
+			}
+			for(int j = 0; j < Engine::num_objects; j++) {
+				Object *o = Engine::objects[j];
+				Engine::occlusion->inside(o->pos + o->getCenter(),o->getRadius());
+			}
+			if(i) continue;
+			if(occlusion_image) Engine::occlusion->save(occlusion_image);
+			if(occlusion_reference) occlusion_diff = Engine::occlusion->compare(occlusion_reference);
+		}
+	}
+	
+	// frustum culling of the tree from the views across the sector centers
+	// the objects are marked as drawn, so only the tree is walked
+	if(frustum_distance > 0.0f) {
+		mat4 projection;
+		projection.perspective(60,4.0f / 3.0f,1,1000);
+		Engine::occlusion->disable();
+		Frustum::num_tests = 0;
+		Frustum::num_saved_tests = 0;
+		Frustum::num_inside = 0;
+		for(int i = 0; i < Bsp::num_sectors * num_views; i++) {
+			float angle = PI * 2.0f * (i % num_views) / num_views;
+			vec3 dir = vec3(cos(angle),sin(angle),0);
+			vec3 center = Bsp::sectors[i / num_views].center;
+			Engine::modelview.look_at(center - dir * frustum_distance,center,vec3(0,0,1));
+			Engine::imodelview = Engine::modelview.inverse();
+			Engine::camera = Engine::imodelview * vec3(0,0,0);
+			Engine::frustum->set(projection * Engine::modelview);
+			Engine::frame++;
+			for(int j = 0; j < Bsp::num_sectors; j++) {
+				Sector *s = &Bsp::sectors[j];
+				for(int k = 0; k < s->num_node_objects; k++) s->node_objects[k]->frame = Engine::frame;
+			}
+			for(int j = 0; j < Engine::num_objects; j++) Engine::objects[j]->frame = Engine::frame;
+			Engine::bsp->render();
+		}
+		// the masks must reach zero for the boxes inside the frustum
+		if(Frustum::num_inside == 0) fprintf(stderr,"physicbench: no subtree is found inside the frustum\n");
+	}
+	
+	// the snapshot is restored without the deleted rigidbody
+	// the rest of its frozen island must wake up and be simulated
+	if(delete_rigidbody && !strcmp(scene,"ragdoll")) fprintf(stderr,"physicbench: the bones of the ragdolls can`t be deleted\n");
+	else if(delete_rigidbody) {
+		int size = Physic::getSnapshotSize();
+		unsigned char *data = new unsigned char[size];
+		Physic::saveSnapshot(data);
+		Object *object = NULL;
+		for(int i = Engine::num_objects - 1; i >= 0 && object == NULL; i--) {
+			if(Engine::objects[i]->rigidbody) object = Engine::objects[i];
+		}
+		if(object) {
+			Engine::removeObject(object);
+			delete object;
+		}
+		if(Physic::restoreSnapshot(data,size) == 0) fprintf(stderr,"physicbench: the snapshot isn`t restored after the delete\n");
+		delete [] data;
+		for(int i = 0; i < 50; i++) {
+			for(int j = 0; j < Engine::num_objects; j++) Engine::objects[j]->update(ifps);
+			Physic::update(ifps);
+		}
+		for(int i = 0; i < Engine::num_objects; i++) {
+			Object *o = Engine::objects[i];
+			if(o->rigidbody == NULL) continue;
+			vec3 p = o->transform * vec3(0,0,0);
+			if(p.x == p.x && p.y == p.y && p.z == p.z) continue;
+			fprintf(stderr,"physicbench: the rigidbody is broken after the delete\n");
+			break;
+		}
+	}
+	
+	// final state
+	int num_rigidbodies = 0;
+	unsigned int hash = 0;
+	for(int i = 0; i < Engine::num_objects; i++) {
+		Object *o = Engine::objects[i];
+		if(!o->rigidbody) continue;
+		num_rigidbodies++;
+		unsigned int *m = (unsigned int*)(float*)o->transform;
+		for(int j = 0; j < 16; j++) hash = hash * 31 + m[j];
+	}
+	
+	// one line for the regression scripts
+	FILE *file = output ? fopen(output,"ab") : stdout;
+	if(!file) {
+		fprintf(stderr,"physicbench: can`t open \"%s\" file\n",output);
+		return 1;
+	}
+	fprintf(file,"{ \"map\": \"%s\", \"scene\": \"%s\", \"num\": %d, \"rigidbodies\": %d, \"threads\": %d, \"shapes\": %d, \"hulls\": %d, \"chains\": %d, \"incremental_sort\": %d, \"rollback\": %d, \"steps\": %d, ",
+		map,scene,num,num_rigidbodies,num_threads,shapes,hulls,Physic::joint_chains,Physic::incremental_sort,rollback,num_steps);
+	fprintf(file,"\"ms_per_step\": %.4f, \"ms_min\": %.4f, \"ms_max\": %.4f, \"ms_contacts\": %.4f, \"ms_sort\": %.4f, ",
+		time * 1000.0 / num_steps,min_time * 1000.0,max_time * 1000.0,contacts_time * 1000.0 / num_steps,sort_time * 1000.0 / num_steps);
+	if(rollback) fprintf(file,"\"ms_snapshot\": %.4f, \"snapshot_bytes\": %.0f, ",snapshot_time * 1000.0 / num_steps,snapshot_size / num_steps);
+	if(num_rays > 0) fprintf(file,"\"rays\": %d, \"ray_hits\": %d, \"ms_rays\": %.4f, \"ms_rays_packets\": %.4f, \"ms_rays_any\": %.4f, ",
+		num_rays,num_hits,rays_time * 1000.0,rays_batch_time * 1000.0,rays_any_time * 1000.0);
+	if(occlusion_image || occlusion_reference) fprintf(file,"\"occlusion_triangles\": %d, \"ms_occlusion\": %.4f, \"occlusion_tested\": %d, \"occlusion_culled\": %d, \"occlusion_diff\": %d, ",
+		Occlusion::num_triangles / num_views,occlusion_time * 1000.0 / num_views,Occlusion::num_tests / num_views,Occlusion::num_culled / num_views,occlusion_diff);
+	if(frustum_distance > 0.0f) fprintf(file,"\"frustum_tests\": %d, \"frustum_saved\": %d, \"frustum_inside\": %d, ",
+		Frustum::num_tests / (Bsp::num_sectors * num_views),Frustum::num_saved_tests / (Bsp::num_sectors * num_views),Frustum::num_inside);
+	fprintf(file,"\"contacts\": %.2f, \"iterations\": %.2f, \"frozen\": %d, \"hash\": \"%08x\" }\n",
+		num_contacts / num_steps,num_iterations / num_steps,Physic::getNumFrozenRigidBodies(),hash);
+	if(output) fclose(file);
+	
+	Engine::clear();
+	
+	return 0;
+}
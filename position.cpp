@@ -21,6 +21,7 @@
 #include "object.h"
 #include "rigidbody.h"
 #include "parser.h"
+#include "broadphase.h"
 #include "position.h"
 
 Position::Position() : spline(NULL), expression(NULL), sector(-1), radius(0.0), num_sectors(0) {
@@ -157,6 +158,8 @@ void Position::update(float time,Object *object) {
 			object->transform = transform;
 			object->itransform = transform.inverse();
 			for(int i = 0; i < num_sectors; i++) Bsp::sectors[sectors[i]].addObject(object);
+			if(num_sectors) Broadphase::updateObject(object);
+			else Broadphase::removeObject(object);
 		}
 	}
 }
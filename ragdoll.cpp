@@ -27,7 +27,7 @@
 #include "parser.h"
 #include "ragdoll.h"
 
-RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinnedmesh), num_bones(0), root(-1) {
+RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinnedmesh), num_bones(0), chain(NULL), root(-1) {
 
 	Parser *parser = new Parser(Engine::findFile(name));
 	
@@ -97,6 +97,7 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 				if(!strcmp(body,"box")) flag = RigidBody::BODY_BOX;
 				else if(!strcmp(body,"sphere")) flag = RigidBody::BODY_SPHERE;
 				else if(!strcmp(body,"cylinder")) flag = RigidBody::BODY_CYLINDER;
+				else if(!strcmp(body,"capsule")) flag = RigidBody::BODY_CAPSULE;
 				break;
 			}
 		}
@@ -118,7 +119,7 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 		vec3 center = (m->getMax() + m->getMin()) / 2.0f;
 		offsets[i].translate(-center);
 		m->transform(offsets[i]);
-		meshes[i] = new ObjectMesh(new MeshVBO(m));
+		meshes[i] = new ObjectMesh(Engine::headless ? new Mesh(m) : new MeshVBO(m));
 		delete m;
 		
 		//meshes[i]->bindMaterial("*",Engine::loadMaterial("default.mat"));
@@ -140,6 +141,7 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 	}
 	
 	// create joints
+	chain = new JointChain();
 	char *s = parser->get("joints");
 	while(*s) {
 		char bone_0_name[1024];
@@ -200,8 +202,8 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 				&restriction_axis_0.x,&restriction_axis_0.y,&restriction_axis_0.z,
 				&restriction_axis_1.x,&restriction_axis_1.y,&restriction_axis_1.z,
 				&restriction_angle);
-			if(num == 7) new JointBall(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),restriction_axis_0,restriction_axis_1,restriction_angle);
-			else if(num == 0) new JointBall(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0));
+			if(num == 7) chain->addJoint(new JointBall(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),restriction_axis_0,restriction_axis_1,restriction_angle));
+			else if(num == 0) chain->addJoint(new JointBall(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0)));
 			else fprintf(stderr,"RagDoll::RagDoll(): bad arguments for \"%s\" \"%s\" bones in \"%s\" file\n",bone_0_name,bone_1_name,name);
 		} else if(!strcmp(type,"hinge")) {	// hinge joint
 			vec3 axis,restriction_axis_0,restriction_axis_1;
@@ -211,8 +213,8 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 				&restriction_axis_0.x,&restriction_axis_0.y,&restriction_axis_0.z,
 				&restriction_axis_1.x,&restriction_axis_1.y,&restriction_axis_1.z,
 				&restriction_angle);
-			if(num == 10) new JointHinge(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis,restriction_axis_0,restriction_axis_1,restriction_angle);
-			else if(num == 3) new JointHinge(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis);
+			if(num == 10) chain->addJoint(new JointHinge(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis,restriction_axis_0,restriction_axis_1,restriction_angle));
+			else if(num == 3) chain->addJoint(new JointHinge(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis));
 			else fprintf(stderr,"RagDoll::RagDoll(): bad arguments for \"%s\" \"%s\" bones in \"%s\" file\n",bone_0_name,bone_1_name,name);
 		} else if(!strcmp(type,"universal")) {	// universal joint
 			vec3 axis_0,axis_1,restriction_axis_0,restriction_axis_1;
@@ -222,8 +224,8 @@ RagDoll::RagDoll(SkinnedMesh *skinnedmesh,const char *name) : skinnedmesh(skinne
 				&restriction_axis_0.x,&restriction_axis_0.y,&restriction_axis_0.z,
 				&restriction_axis_1.x,&restriction_axis_1.y,&restriction_axis_1.z,
 				&restriction_angle);
-			if(num == 13) new JointUniversal(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis_0,axis_1,restriction_axis_0,restriction_axis_1,restriction_angle);
-			else if(num == 6) new JointUniversal(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis_0,axis_1);
+			if(num == 13) chain->addJoint(new JointUniversal(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis_0,axis_1,restriction_axis_0,restriction_axis_1,restriction_angle));
+			else if(num == 6) chain->addJoint(new JointUniversal(rigidbodies[bone_0],rigidbodies[bone_1],bones[bone_1].transform * vec3(0,0,0),axis_0,axis_1));
 			else fprintf(stderr,"RagDoll::RagDoll(): bad arguments for \"%s\" \"%s\" bones in \"%s\" file\n",bone_0_name,bone_1_name,name);
 		} else {
 			fprintf(stderr,"RagDoll::RagDoll(): unknown joint type \"%s\" in \"%s\" file\n",type,name);
@@ -241,6 +243,7 @@ RagDoll::~RagDoll() {
 			delete meshes[i];
 		}
 	}
+	delete chain;
 	delete meshes;
 	delete offsets;
 	delete ioffsets;
@@ -25,6 +25,7 @@
 
 class Object;
 class RigidBody;
+class JointChain;
 
 class RagDoll {
 public:
@@ -49,6 +50,8 @@ protected:
 	mat4 *offsets;
 	mat4 *ioffsets;
 	
+	JointChain *chain;	// all joints are solved together
+	
 	int root;
 	
 	mat4 transform;
@@ -22,22 +22,87 @@
 #include "collide.h"
 #include "physic.h"
 #include "joint.h"
+#include "mesh.h"
 #include "object.h"
+#include "objectmesh.h"
 #include "collide.h"
 #include "engine.h"
+#include "broadphase.h"
 #include "rigidbody.h"
 
+int RigidBody::num_pools = 0;
+RigidBody::Pool **RigidBody::pools = NULL;
+int RigidBody::num_handles = 0;
+int RigidBody::num_free_handles = 0;
+int *RigidBody::free_handles = NULL;
+int RigidBody::generation_counter = 0;
+int RigidBody::num_active_handles = 0;
+int *RigidBody::active_handles = NULL;
+int RigidBody::num_sphere_handles = 0;
+int *RigidBody::sphere_handles = NULL;
+
+/*
+ */
 RigidBody::RigidBody(Object *object,float mass,float restitution,float friction,int flag) :
-	object(object), mass(mass), restitution(restitution), friction(friction),
-	frozen(0), frozen_time(0.0), frozen_num_objects(0), num_joints(0), simulated(0), immovable(0) {
+	object(object), handle(allocHandle(this)),
+	generation(pools[handle / POOL_SIZE]->generation[handle % POOL_SIZE]),
+	counter(pools[handle / POOL_SIZE]->counter[handle % POOL_SIZE]),
+	radius(pools[handle / POOL_SIZE]->radius[handle % POOL_SIZE]),
+	mass(pools[handle / POOL_SIZE]->mass[handle % POOL_SIZE]),
+	restitution(restitution), friction(friction),
+	pos(pools[handle / POOL_SIZE]->pos[handle % POOL_SIZE]),
+	orienation(pools[handle / POOL_SIZE]->orienation[handle % POOL_SIZE]),
+	velocity(pools[handle / POOL_SIZE]->velocity[handle % POOL_SIZE]),
+	angularVelocity(pools[handle / POOL_SIZE]->angularVelocity[handle % POOL_SIZE]),
+	angularMomentum(pools[handle / POOL_SIZE]->angularMomentum[handle % POOL_SIZE]),
+	force(pools[handle / POOL_SIZE]->force[handle % POOL_SIZE]),
+	torque(pools[handle / POOL_SIZE]->torque[handle % POOL_SIZE]),
+	iBodyInertiaTensor(pools[handle / POOL_SIZE]->iBodyInertiaTensor[handle % POOL_SIZE]),
+	iWorldInertiaTensor(pools[handle / POOL_SIZE]->iWorldInertiaTensor[handle % POOL_SIZE]),
+	frozen(0), frozen_time(0.0), frozen_next(this), num_joints(0), simulated(0), immovable(0), order(-1),
+	num_impulses(0), all_impulses(0), impulses(NULL), old_impulses(NULL), residual(0.0), island_counter(0), island(-1), island_parent(this) {
+	
+	this->mass = mass;
 	
 	if(flag & COLLIDE_MESH) collide_type = COLLIDE_MESH;
 	else if(flag & COLLIDE_SPHERE) collide_type = COLLIDE_SPHERE;
+	else if(flag & COLLIDE_SHAPE) collide_type = COLLIDE_SHAPE;
+	else if(flag & COLLIDE_HULL) collide_type = COLLIDE_HULL;
 	collide = new Collide();
 	
-	if(flag && BODY_BOX) {
-		vec3 min = object->getMin();
-		vec3 max = object->getMax();
+	// shape from the bound box of the mesh
+	vec3 min = object->getMin();
+	vec3 max = object->getMax();
+	body_type = flag & (BODY_BOX | BODY_SPHERE | BODY_CYLINDER | BODY_CAPSULE);
+	body_center = (min + max) / 2.0f;
+	body_size = (max - min) / 2.0f;
+	if(body_type & BODY_SPHERE) {
+		body_center = object->getCenter();
+		body_size = vec3(object->getRadius(),object->getRadius(),object->getRadius());
+	} else if(body_type & (BODY_CYLINDER | BODY_CAPSULE)) {
+		float radius = body_size.x > body_size.y ? body_size.x : body_size.y;
+		float height = body_size.z;
+		if(body_type & BODY_CAPSULE) height = height > radius ? height - radius : 0.0f;
+		body_size = vec3(radius,radius,height);
+	}
+	if(collide_type == COLLIDE_SHAPE && body_type != BODY_BOX && body_type != BODY_SPHERE &&
+		body_type != BODY_CYLINDER && body_type != BODY_CAPSULE) {
+		fprintf(stderr,"RigidBody::RigidBody(): one body shape is required for the shape collision\n");
+		collide_type = COLLIDE_MESH;
+	}
+	
+	// the hull is created once for all objects of the mesh
+	if(collide_type == COLLIDE_HULL) {
+		Mesh *mesh = NULL;
+		if(object->type == Object::OBJECT_MESH) mesh = reinterpret_cast<ObjectMesh*>(object)->mesh;
+		if(mesh && mesh->getNumHullVertex() == 0) mesh->create_hull();
+		if(mesh == NULL || mesh->getNumHullPlanes() == 0) {
+			fprintf(stderr,"RigidBody::RigidBody(): can`t create convex hull of the object\n");
+			collide_type = COLLIDE_MESH;
+		}
+	}
+	
+	if(flag & BODY_BOX) {
 		vec3 v = (max - min) / 2.0;
 		mat3 inertiaTensor;
 		inertiaTensor[0] = 1.0f / 12.0f * mass * (v.y * v.y + v.z * v.z);
@@ -45,7 +110,7 @@ RigidBody::RigidBody(Object *object,float mass,float restitution,float friction,
 		inertiaTensor[8] = 1.0f / 12.0f * mass * (v.x * v.x + v.y * v.y);
 		iBodyInertiaTensor = inertiaTensor.inverse();
 	}
-	else if(flag && BODY_SPHERE) {
+	else if(flag & BODY_SPHERE) {
 		float radius = object->getRadius();
 		mat3 inertiaTensor;
 		inertiaTensor[0] = 2.0f / 5.0f * mass * radius * radius;
@@ -53,9 +118,7 @@ RigidBody::RigidBody(Object *object,float mass,float restitution,float friction,
 		inertiaTensor[8] = 2.0f / 5.0f * mass * radius * radius;
 		iBodyInertiaTensor = inertiaTensor.inverse();
 	}
-	else if(flag && BODY_CYLINDER) {
-		vec3 min = object->getMin();
-		vec3 max = object->getMax();
+	else if(flag & (BODY_CYLINDER | BODY_CAPSULE)) {
 		float radius = max.x - min.x;
 		float height = max.z - min.z;
 		mat3 inertiaTensor;
@@ -65,23 +128,252 @@ RigidBody::RigidBody(Object *object,float mass,float restitution,float friction,
 		iBodyInertiaTensor = inertiaTensor.inverse();
 	}
 	
+	// fast spheres are swept against the static objects
+	radius = (collide_type == COLLIDE_SPHERE) ? object->getRadius() : 0.0f;
+	
 	set(object->transform);
-		
-	RigidBody **rb = new RigidBody*[++Physic::all_rigidbodies];
-	memcpy(rb,Physic::rigidbodies,sizeof(RigidBody*) * (Physic::all_rigidbodies - 1));
-	if(Physic::rigidbodies) delete Physic::rigidbodies;
-	Physic::rigidbodies = rb;
+}
+
+/* the order of the other rigidbodies is kept
+ */
+static void remove_rigidbody(RigidBody **rigidbodies,int &num_rigidbodies,RigidBody *rigidbody) {
+	int num = 0;
+	for(int i = 0; i < num_rigidbodies; i++) {
+		if(rigidbodies[i] != rigidbody) rigidbodies[num++] = rigidbodies[i];
+	}
+	num_rigidbodies = num;
 }
 
 RigidBody::~RigidBody() {
+	Physic::wait();
+	
+	// the rigidbody isn`t simulated and published anymore
+	remove_rigidbody(Physic::rigidbodies,Physic::num_rigidbodies,this);
+	remove_rigidbody(Physic::next_rigidbodies,Physic::num_next_rigidbodies,this);
+	
+	wake();
+	
 	delete collide;
 	
-	if(num_joints) delete joints[0];
+	delete [] impulses;
+	delete [] old_impulses;
+	
+	// the joints remove themselves from the rigidbodies
+	while(num_joints) delete joints[0];
+	
+	freeHandle(handle);
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* pool                                                                      */
+/*                                                                           */
+/*****************************************************************************/
+
+/* the free handles are reused, the lists of the physic grow twice
+ */
+int RigidBody::allocHandle(RigidBody *rigidbody) {
+	
+	Physic::wait();
 	
-	if(Physic::all_rigidbodies) Physic::all_rigidbodies--;
+	int handle;
+	if(num_free_handles) handle = free_handles[--num_free_handles];
 	else {
-		delete Physic::rigidbodies;
-		Physic::rigidbodies = NULL;
+		if(num_handles == num_pools * POOL_SIZE) {
+			Pool **p = new Pool*[num_pools + 1];
+			if(pools) memcpy(p,pools,sizeof(Pool*) * num_pools);
+			delete [] pools;
+			pools = p;
+			pools[num_pools++] = new Pool;
+			
+			int *f = new int[num_pools * POOL_SIZE];
+			if(free_handles) memcpy(f,free_handles,sizeof(int) * num_free_handles);
+			delete [] free_handles;
+			free_handles = f;
+			
+			delete [] active_handles;
+			active_handles = new int[num_pools * POOL_SIZE];
+			delete [] sphere_handles;
+			sphere_handles = new int[num_pools * POOL_SIZE];
+		}
+		handle = num_handles++;
+	}
+	
+	Pool *pool = pools[handle / POOL_SIZE];
+	pool->rigidbodies[handle % POOL_SIZE] = rigidbody;
+	pool->generation[handle % POOL_SIZE] = ++generation_counter;
+	pool->counter[handle % POOL_SIZE] = -1;
+	pool->fraction[handle % POOL_SIZE] = 1.0f;
+	
+	int num = num_handles - num_free_handles;
+	if(Physic::all_rigidbodies < num) {
+		Physic::all_rigidbodies = num * 2;
+		
+		RigidBody **rb = new RigidBody*[Physic::all_rigidbodies];
+		if(Physic::rigidbodies) memcpy(rb,Physic::rigidbodies,sizeof(RigidBody*) * Physic::num_rigidbodies);
+		delete [] Physic::rigidbodies;
+		Physic::rigidbodies = rb;
+		
+		rb = new RigidBody*[Physic::all_rigidbodies];
+		if(Physic::next_rigidbodies) memcpy(rb,Physic::next_rigidbodies,sizeof(RigidBody*) * Physic::num_next_rigidbodies);
+		delete [] Physic::next_rigidbodies;
+		Physic::next_rigidbodies = rb;
+	}
+	
+	return handle;
+}
+
+void RigidBody::freeHandle(int handle) {
+	
+	Pool *pool = pools[handle / POOL_SIZE];
+	pool->rigidbodies[handle % POOL_SIZE] = NULL;
+	pool->generation[handle % POOL_SIZE] = 0;
+	pool->counter[handle % POOL_SIZE] = -1;
+	free_handles[num_free_handles++] = handle;
+	
+	if(num_free_handles != num_handles) return;
+	
+	// the last rigidbody
+	for(int i = 0; i < num_pools; i++) {
+		delete pools[i];
+	}
+	delete [] pools;
+	pools = NULL;
+	num_pools = 0;
+	delete [] free_handles;
+	free_handles = NULL;
+	num_handles = 0;
+	num_free_handles = 0;
+	delete [] active_handles;
+	active_handles = NULL;
+	delete [] sphere_handles;
+	sphere_handles = NULL;
+	num_active_handles = 0;
+	num_sphere_handles = 0;
+	
+	delete [] Physic::rigidbodies;
+	Physic::rigidbodies = NULL;
+	delete [] Physic::next_rigidbodies;
+	Physic::next_rigidbodies = NULL;
+	Physic::all_rigidbodies = 0;
+	Physic::num_rigidbodies = 0;
+	Physic::num_next_rigidbodies = 0;
+}
+
+/* the generation isn`t reused, so the handle of the deleted rigidbody isn`t found
+ * even if the slot belongs to the new one
+ */
+RigidBody *RigidBody::getHandle(int handle,int generation) {
+	if(handle < 0 || handle >= num_handles) return NULL;
+	Pool *pool = pools[handle / POOL_SIZE];
+	if(pool->generation[handle % POOL_SIZE] != generation) return NULL;
+	return pool->rigidbodies[handle % POOL_SIZE];
+}
+
+/* the integration of one rigidbody in the pool
+ */
+void RigidBody::calcForce(Pool *pool,int num) {
+	pool->force[num] = vec3(0,0,0);
+	pool->torque[num] = vec3(0,0,0);
+	pool->force[num].z += Physic::gravitation * pool->mass[num];
+	pool->force[num] -= pool->velocity[num] * 0.1f;
+}
+
+void RigidBody::integrateVelocity(Pool *pool,int num,float ifps) {
+	
+	vec3 &velocity = pool->velocity[num];
+	velocity += pool->force[num] * ifps / pool->mass[num];
+	
+	// the multiplication by one keeps the slow bodies bit-exact
+	float k = Physic::velocity_max / velocity.length();
+	velocity *= (k < 1.0f) ? k : 1.0f;
+	
+	pool->angularMomentum[num] += pool->torque[num] * ifps;
+	pool->angularVelocity[num] = pool->iWorldInertiaTensor[num] * pool->angularMomentum[num];
+}
+
+/* fast spheres are stopped at the time of impact with the static objects
+ * the sphere is left inside by the penetration tolerance for the contact of the next step
+ */
+void RigidBody::sweepPos(Pool *pool,int num,float ifps) {
+	const vec3 &pos = pool->pos[num];
+	vec3 offset = pool->velocity[num] * ifps;
+	float radius = pool->radius[num];
+	if(offset.length() <= radius * 0.5f) return;
+	RigidBody *rb = pool->rigidbodies[num];
+	pool->fraction[num] = rb->collide->sweep(rb->object,pos,pos + offset,radius - Physic::penetration_tolerance);
+}
+
+void RigidBody::integrateLinear(Pool *pool,int num,float ifps) {
+	vec3 offset = pool->velocity[num] * ifps;
+	offset *= pool->fraction[num];
+	pool->pos[num] += offset;
+	pool->fraction[num] = 1.0f;
+}
+
+void RigidBody::integrateAngular(Pool *pool,int num,float ifps) {
+	
+	const vec3 &angularVelocity = pool->angularVelocity[num];
+	mat3 &orienation = pool->orienation[num];
+	mat3 m;
+	m[0] = 0.0; m[3] = -angularVelocity[2]; m[6] = angularVelocity[1];
+	m[1] = angularVelocity[2]; m[4] = 0.0; m[7] = -angularVelocity[0];
+	m[2] = -angularVelocity[1]; m[5] = angularVelocity[0]; m[8] = 0.0;
+	orienation += (m * orienation) * ifps;
+	orienation.orthonormalize();
+	
+	pool->iWorldInertiaTensor[num] = orienation * pool->iBodyInertiaTensor[num] * orienation.transpose();
+}
+
+/* compact lists of the marked handles in the pool order
+ * every handle is written and only the marked ones are counted
+ */
+void RigidBody::findActive(int counter) {
+	num_active_handles = 0;
+	num_sphere_handles = 0;
+	for(int i = 0; i < num_pools; i++) {
+		Pool *pool = pools[i];
+		int num = num_handles - i * POOL_SIZE;
+		if(num > POOL_SIZE) num = POOL_SIZE;
+		for(int j = 0; j < num; j++) {
+			int active = (pool->counter[j] == counter);
+			active_handles[num_active_handles] = i * POOL_SIZE + j;
+			num_active_handles += active;
+			sphere_handles[num_sphere_handles] = i * POOL_SIZE + j;
+			num_sphere_handles += active & (pool->radius[j] > 0.0f);
+		}
+	}
+}
+
+/* all rigidbodies of the step
+ */
+void RigidBody::integrateVelocity(int counter,float ifps) {
+	findActive(counter);
+	for(int i = 0; i < num_active_handles; i++) {
+		int handle = active_handles[i];
+		Pool *pool = pools[handle / POOL_SIZE];
+		calcForce(pool,handle % POOL_SIZE);
+		integrateVelocity(pool,handle % POOL_SIZE,ifps);
+	}
+}
+
+/* the sweeps of the spheres are done before the positions are changed
+ */
+void RigidBody::integratePos(int counter,float ifps) {
+	findActive(counter);
+	if(Physic::continuous) {
+		for(int i = 0; i < num_sphere_handles; i++) {
+			int handle = sphere_handles[i];
+			sweepPos(pools[handle / POOL_SIZE],handle % POOL_SIZE,ifps);
+		}
+	}
+	for(int i = 0; i < num_active_handles; i++) {
+		int handle = active_handles[i];
+		integrateLinear(pools[handle / POOL_SIZE],handle % POOL_SIZE,ifps);
+	}
+	for(int i = 0; i < num_active_handles; i++) {
+		int handle = active_handles[i];
+		integrateAngular(pools[handle / POOL_SIZE],handle % POOL_SIZE,ifps);
 	}
 }
 
@@ -97,12 +389,14 @@ void RigidBody::set(const vec3 &p) {
  */
 void RigidBody::set(const mat4 &m) {
 	
-	vec3 old_pos = pos;
-	
 	pos = m * vec3(0,0,0);
 	orienation = mat3(m);
 	
-	mat4 old_transform = transform;
+	old_pos = pos;
+	old_orienation = orienation;
+	
+	position.radius = object->getRadius();
+	position = pos;
 	
 	transform = m;
 	itransform = transform.inverse();
@@ -115,9 +409,11 @@ void RigidBody::set(const mat4 &m) {
 	
 	iWorldInertiaTensor.identity();
 	
-	frozen = 0;
+	wake();
 	frozen_time = 0.0f;
 	immovable = 1;
+	
+	num_impulses = 0;
 }
 
 /*
@@ -125,11 +421,11 @@ void RigidBody::set(const mat4 &m) {
 void RigidBody::simulate() {
 	if(simulated) return;
 	simulated = 1;
-	Physic::rigidbodies[Physic::num_rigidbodies++] = this;
+	Physic::next_rigidbodies[Physic::num_next_rigidbodies++] = this;
 	for(int i = 0; i < num_joints; i++) {	// add all joined rigid bodies
 		RigidBody *rb = joined_rigidbodies[i];
 		if(rb->simulated == 0) {
-			Physic::joints[Physic::num_joints++] = joints[i];
+			Physic::next_joints[Physic::num_next_joints++] = joints[i];
 			rb->simulate();
 		}
 	}
@@ -138,11 +434,33 @@ void RigidBody::simulate() {
 /*
  */
 void RigidBody::addImpulse(const vec3 &point,const vec3 &impulse) {
+	Physic::wait();
+	applyImpulse(point,impulse);
+}
+
+/* impulse of the solver
+ */
+void RigidBody::applyImpulse(const vec3 &point,const vec3 &impulse) {
+	wake();
 	velocity += impulse / mass;
 	angularMomentum += cross(point - pos,impulse);
 	angularVelocity = iWorldInertiaTensor * angularMomentum;
 }
 
+/* all rigidbodies of the frozen island are linked in the ring
+ */
+void RigidBody::wake() {
+	if(frozen == 0) return;
+	RigidBody *rb = this;
+	do {
+		RigidBody *next = rb->frozen_next;
+		rb->frozen = 0;
+		rb->frozen_time = 0.0f;
+		rb->frozen_next = rb;
+		rb = next;
+	} while(rb != this);
+}
+
 /*****************************************************************************/
 /*                                                                           */
 /*                                                                           */
@@ -151,78 +469,62 @@ void RigidBody::addImpulse(const vec3 &point,const vec3 &impulse) {
 
 /*
  */
-void RigidBody::calcForce(float ifps) {
-	
-	force = vec3(0,0,0);
-	torque = vec3(0,0,0);	
+void RigidBody::predictPos(float ifps) {
 	
-	if(!frozen) force.z += Physic::gravitation * mass;
-
-	force -= velocity * 0.1f;
-}
-
-/*
- */
-void RigidBody::findContacts(float ifps) {
-	
-	static vec3 old_velicity;
-	static vec3 old_angularMomentum;
-	static vec3 old_angularVelocity;
-	static Position old_pos;
-	static mat3 old_orientation;
-	static mat3 old_iWorldInertiaTensor;
-	
-	old_velicity = velocity;
-	old_angularMomentum = angularMomentum;
-	old_angularVelocity = angularVelocity;
-	old_pos = pos;
-	old_orientation = orienation;
-	old_iWorldInertiaTensor = iWorldInertiaTensor;
+	State *s = &predicted_state;
+	s->velocity = velocity;
+	s->angularMomentum = angularMomentum;
+	s->angularVelocity = angularVelocity;
+	s->pos = pos;
+	s->orienation = orienation;
+	s->iWorldInertiaTensor = iWorldInertiaTensor;
 	
 	// predicted new position
 	integrateVelocity(ifps);
 	
 	integratePos(ifps);
-	
-	// find conact points
-	if(collide_type == COLLIDE_MESH) collide->collide(object);
-	else if(collide_type == COLLIDE_SPHERE) collide->collide(object,object->pos,object->getRadius());
-	
-	velocity = old_velicity;	// restore old values
-	angularMomentum = old_angularMomentum;
-	angularVelocity = old_angularVelocity;
-	pos = old_pos;
-	orienation = old_orientation;
-	iWorldInertiaTensor = old_iWorldInertiaTensor;
+}
+
+/* contacts at the predicted positions of all rigidbodies
+ * it is called from the worker threads, everything is written into the own collide
+ */
+void RigidBody::findContacts() {
+	collide->max_contacts = Physic::max_contacts;
+	if(collide_type == COLLIDE_MESH || collide_type == COLLIDE_SHAPE || collide_type == COLLIDE_HULL) collide->collide(object);
+	else if(collide_type == COLLIDE_SPHERE) collide->collide(object,position,pos,object->getRadius());
+}
+
+/* the transformation is left predicted till the integration
+ */
+void RigidBody::restorePos() {
+	State *s = &predicted_state;
+	velocity = s->velocity;
+	angularMomentum = s->angularMomentum;
+	angularVelocity = s->angularVelocity;
+	pos = s->pos;
+	orienation = s->orienation;
+	iWorldInertiaTensor = s->iWorldInertiaTensor;
 }
 
 /*
  */
 void RigidBody::integrateVelocity(float ifps) {
-	
-	velocity += force * ifps / mass;
-	
-	float vel = velocity.length();
-	if(vel > Physic::velocity_max) velocity *= Physic::velocity_max / vel;
-	
-	angularMomentum += torque * ifps;
-	angularVelocity = iWorldInertiaTensor * angularMomentum;
+	integrateVelocity(pools[handle / POOL_SIZE],handle % POOL_SIZE,ifps);
 }
 
 /*
  */
 void RigidBody::integratePos(float ifps) {
-	
-	pos += velocity * ifps;
-	
-	mat3 m;
-	m[0] = 0.0; m[3] = -angularVelocity[2]; m[6] = angularVelocity[1];
-	m[1] = angularVelocity[2]; m[4] = 0.0; m[7] = -angularVelocity[0];
-	m[2] = -angularVelocity[1]; m[5] = angularVelocity[0]; m[8] = 0.0;
-	orienation += (m * orienation) * ifps;
-	orienation.orthonormalize();
-	
-	iWorldInertiaTensor = orienation * iBodyInertiaTensor * orienation.transpose();
+	Pool *pool = pools[handle / POOL_SIZE];
+	if(radius > 0.0f && Physic::continuous) sweepPos(pool,handle % POOL_SIZE,ifps);
+	integrateLinear(pool,handle % POOL_SIZE,ifps);
+	integrateAngular(pool,handle % POOL_SIZE,ifps);
+	updateTransform();
+}
+
+/* transformation and sectors of the integrated position
+ */
+void RigidBody::updateTransform() {
 	
 	transform = mat4(orienation);
 	transform[12] = pos.x;
@@ -230,18 +532,161 @@ void RigidBody::integratePos(float ifps) {
 	transform[14] = pos.z;
 	itransform = transform.inverse();
 	
+	position = pos;
+}
+
+/*
+ */
+void RigidBody::updatePos() {
+	
+	// objects are updated by Physic::publish() after the step of the physic thread
+	if(Physic::running) {
+		if(position.num_sectors) Broadphase::updateObject(object);
+		else Broadphase::removeObject(object);
+		return;
+	}
+	
 	object->transform = transform;
 	object->itransform = itransform;
 	
 	object->updatePos(pos);
 }
 
+/* contacts of the step are matched with the contacts of the previous step
+ * by the contact object and the point in the body space
+ * accumulated impulses of the matched contacts are applied again
+ */
+void RigidBody::warmStart() {
+	
+	if(all_impulses < collide->num_contacts) {
+		all_impulses = collide->num_contacts * 2;
+		Impulse *i = new Impulse[all_impulses];
+		for(int j = 0; j < num_impulses; j++) i[j] = impulses[j];
+		delete [] impulses;
+		impulses = i;
+		delete [] old_impulses;
+		old_impulses = new Impulse[all_impulses];
+	}
+	
+	Impulse *swap = old_impulses;
+	old_impulses = impulses;
+	impulses = swap;
+	
+	int num_old_impulses = num_impulses;
+	num_impulses = collide->num_contacts;
+	
+	float distance = Physic::contact_distance * Physic::contact_distance;
+	
+	for(int i = 0; i < num_impulses; i++) {
+		Collide::Contact *c = &collide->contacts[i];
+		Impulse *imp = &impulses[i];
+		imp->object = c->object;
+		imp->point = itransform * c->point;
+		imp->normal = 0.0;
+		imp->friction = vec3(0,0,0);
+		for(int j = 0; j < num_old_impulses; j++) {
+			Impulse *old = &old_impulses[j];
+			if(old->object != imp->object) continue;
+			vec3 d = old->point - imp->point;
+			if(d * d > distance) continue;
+			imp->normal = old->normal * Physic::warm_starting;
+			imp->friction = old->friction * Physic::warm_starting;
+			break;
+		}
+		
+		// friction is kept in the tangent plane of the new contact
+		imp->friction -= c->normal * (c->normal * imp->friction);
+		
+		RigidBody *rb = c->object->rigidbody;
+		if(rb == NULL && frozen) continue;
+		
+		vec3 r0 = c->point - pos;
+		vec3 r1 = rb ? c->point - rb->pos : vec3(0,0,0);
+		applyImpulse(rb,r0,r1,c->normal * imp->normal + imp->friction);
+	}
+}
+
+/*
+ */
+void RigidBody::applyImpulse(RigidBody *rb,const vec3 &r0,const vec3 &r1,const vec3 &impulse) {
+	if(frozen == 0 && immovable == 0) {
+		velocity += impulse / mass;
+		angularMomentum += cross(r0,impulse);
+		angularVelocity = iWorldInertiaTensor * angularMomentum;
+	}
+	if(rb && rb->frozen == 0 && rb->immovable == 0) {
+		rb->velocity -= impulse / rb->mass;
+		rb->angularMomentum -= cross(r1,impulse);
+		rb->angularVelocity = rb->iWorldInertiaTensor * rb->angularMomentum;
+	}
+}
+
 /*
  */
 int RigidBody::contactsResponse(float ifps,int zero_restitution) {
 	
 	int done = 1;
 	
+	// accumulated impulses with penetration correction
+	if(zero_restitution) {
+		
+		residual = 0.0;
+		
+		for(int i = 0; i < num_impulses; i++) {
+			Collide::Contact *c = &collide->contacts[i];
+			Impulse *imp = &impulses[i];
+			
+			RigidBody *rb = c->object->rigidbody;
+			if(rb == NULL && frozen) continue;
+			
+			vec3 r0 = c->point - pos;
+			vec3 r1 = rb ? c->point - rb->pos : vec3(0,0,0);
+			
+			vec3 vel = cross(angularVelocity,r0) + velocity;
+			if(rb) vel -= cross(rb->angularVelocity,r1) + rb->velocity;
+			
+			float normal_vel = c->normal * vel;
+			
+			float impulse_denominator = 1.0f / mass + c->normal * cross(iWorldInertiaTensor * cross(r0,c->normal),r0);
+			if(rb) impulse_denominator += 1.0f / rb->mass + c->normal * cross(rb->iWorldInertiaTensor * cross(r1,c->normal),r1);
+			
+			// normal impulse is never negative
+			float depth = c->depth - Physic::penetration_tolerance;	// penetration correction
+			if(depth < 0.0) depth = 0.0;
+			float impulse = (-normal_vel + depth * Physic::penetration_speed / ifps) / impulse_denominator;
+			float old_impulse = imp->normal;
+			imp->normal += impulse;
+			if(imp->normal < 0.0) imp->normal = 0.0;
+			impulse = imp->normal - old_impulse;
+			
+			applyImpulse(rb,r0,r1,c->normal * impulse);
+			
+			float correction = fabs(impulse) * impulse_denominator;
+			if(residual < correction) residual = correction;
+			
+			// friction impulse is inside the friction cone
+			vel = cross(angularVelocity,r0) + velocity;
+			if(rb) vel -= cross(rb->angularVelocity,r1) + rb->velocity;
+			
+			vec3 tangent = -(vel - c->normal * (c->normal * vel));
+			float tangent_vel = tangent.normalize();
+			if(tangent_vel < EPSILON) continue;
+			
+			float friction_denominator = 1.0f / mass + tangent * cross(iWorldInertiaTensor * cross(r0,tangent),r0);
+			if(rb) friction_denominator += 1.0f / rb->mass + tangent * cross(rb->iWorldInertiaTensor * cross(r1,tangent),r1);
+			
+			vec3 old_friction = imp->friction;
+			imp->friction += tangent * (tangent_vel / friction_denominator);
+			float length = imp->friction.length();
+			float max_friction = imp->normal * friction;
+			if(length > max_friction) imp->friction *= max_friction / length;
+			
+			applyImpulse(rb,r0,r1,imp->friction - old_friction);
+		}
+		
+		return residual < Physic::residual_threshold;
+	}
+	
 	for(int i = 0; i < collide->num_contacts; i++) {
 		Collide::Contact *c = &collide->contacts[i];
 		
@@ -256,9 +701,7 @@ int RigidBody::contactsResponse(float ifps,int zero_restitution) {
 			float normal_vel = c->normal * vel;
 			if(normal_vel > -EPSILON) continue;
 			
-			float impulse_numerator;
-			if(!zero_restitution) impulse_numerator = -(1.0f + restitution) * normal_vel;
-			else impulse_numerator = -normal_vel + c->depth * Physic::penetration_speed / ifps;
+			float impulse_numerator = -(1.0f + restitution) * normal_vel;
 			
 			if(impulse_numerator < EPSILON) continue;
 			
@@ -320,9 +763,7 @@ int RigidBody::contactsResponse(float ifps,int zero_restitution) {
 			float normal_vel = c->normal * vel;
 			if(normal_vel > -EPSILON) continue;
 			
-			float impulse_numerator;
-			if(!zero_restitution) impulse_numerator = -(1.0f + restitution) * normal_vel;
-			else impulse_numerator = -normal_vel + c->depth * Physic::penetration_speed / ifps;
+			float impulse_numerator = -(1.0f + restitution) * normal_vel;
 			
 			if(impulse_numerator < EPSILON) continue;
 			
@@ -21,6 +21,7 @@
 #define __RIGID_BODY_H__
 
 #include "mathlib.h"
+#include "position.h"
 
 class Object;
 class Collide;
@@ -37,6 +38,9 @@ public:
 		BODY_BOX = 1 << 2,
 		BODY_SPHERE = 1 << 3,
 		BODY_CYLINDER = 1 << 4,
+		COLLIDE_SHAPE = 1 << 5,		// collide with the analytic body shape
+		BODY_CAPSULE = 1 << 6,
+		COLLIDE_HULL = 1 << 7,		// collide with the convex hull of the mesh
 		NUM_JOINTS = 6,
 	};
 	
@@ -48,52 +52,139 @@ public:
 	
 	void simulate();
 	void addImpulse(const vec3 &point,const vec3 &impulse);	// add impulse to this rb
-	
+	void wake();	// wake up the frozen island of this rb
+
 protected:
 	
 	friend class Physic;
 	friend class Collide;
+	friend class Broadphase;
 	friend class Joint;
 	friend class JointBall;
 	friend class JointHinge;
 	friend class JointUniversal;
+	friend class JointChain;
 	
 	friend int rigidbody_cmp(const void *a,const void *b);
 	
-	void calcForce(float ifps);
-	void findContacts(float ifps);
+	void predictPos(float ifps);
+	void findContacts();
+	void restorePos();
 	void integrateVelocity(float ifps);
 	void integratePos(float ifps);
+	void updateTransform();
+	void updatePos();
 	int contactsResponse(float ifps,int zero_restitution = 0);
 	
+	void warmStart();
+	void applyImpulse(const vec3 &point,const vec3 &impulse);
+	void applyImpulse(RigidBody *rb,const vec3 &r0,const vec3 &r1,const vec3 &impulse);
+	
+	// pool of the integration data
+	// the blocks are never moved, so the handles and the references of the rigidbodies are stable,
+	// and the step integrates all rigidbodies by the loops over the arrays
+	enum {
+		POOL_SIZE = 256,
+	};
+	
+	struct Pool {
+		RigidBody *rigidbodies[POOL_SIZE];
+		int generation[POOL_SIZE];			// unique number of the rigidbody in the slot
+		int counter[POOL_SIZE];				// integrated by the step with this counter
+		float radius[POOL_SIZE];			// continuous collision of the spheres
+		float fraction[POOL_SIZE];			// time of impact of the sphere in the step
+		float mass[POOL_SIZE];
+		vec3 pos[POOL_SIZE];
+		mat3 orienation[POOL_SIZE];
+		vec3 velocity[POOL_SIZE];
+		vec3 angularVelocity[POOL_SIZE];
+		vec3 angularMomentum[POOL_SIZE];
+		vec3 force[POOL_SIZE];
+		vec3 torque[POOL_SIZE];
+		mat3 iBodyInertiaTensor[POOL_SIZE];
+		mat3 iWorldInertiaTensor[POOL_SIZE];
+	};
+	
+	static int allocHandle(RigidBody *rigidbody);
+	static void freeHandle(int handle);
+	static RigidBody *getHandle(int handle,int generation);	// NULL if the rigidbody is deleted
+	
+	static void calcForce(Pool *pool,int num);
+	static void integrateVelocity(Pool *pool,int num,float ifps);
+	static void sweepPos(Pool *pool,int num,float ifps);
+	static void integrateLinear(Pool *pool,int num,float ifps);
+	static void integrateAngular(Pool *pool,int num,float ifps);
+	
+	// all rigidbodies marked by the counter
+	static void findActive(int counter);
+	static void integrateVelocity(int counter,float ifps);
+	static void integratePos(int counter,float ifps);
+	
+	static int num_pools;
+	static Pool **pools;
+	static int num_handles;
+	static int num_free_handles;
+	static int *free_handles;
+	static int generation_counter;
+	
+	static int num_active_handles;	// handles marked by the counter
+	static int *active_handles;
+	static int num_sphere_handles;	// marked spheres for the continuous collision
+	static int *sphere_handles;
+	
 	Object *object;
 	
+	int handle;				// slot in the pool
+	int &generation;
+	int &counter;
+	float &radius;
+	
 	int collide_type;
 	Collide *collide;
 	
-	float mass;	// physical values
+	int body_type;			// shape of the body
+	vec3 body_center;		// shape in the body space
+	vec3 body_size;			// half sizes or radius and half height along the z axis
+	
+	float &mass;	// physical values
 	float restitution;
 	float friction;
 	
-	vec3 pos;
-	mat3 orienation;
+	vec3 &pos;
+	mat3 &orienation;
+	
+	vec3 old_pos;			// state before the last step
+	mat3 old_orienation;
+	
+	Position position;		// sectors of the simulated position
+	
+	struct State {
+		vec3 velocity;
+		vec3 angularMomentum;
+		vec3 angularVelocity;
+		vec3 pos;
+		mat3 orienation;
+		mat3 iWorldInertiaTensor;
+	};
+	
+	State predicted_state;	// state saved by predictPos()
 	
 	mat4 transform;
 	mat4 itransform;
 	
-	vec3 velocity;
-	vec3 angularVelocity;
-	vec3 angularMomentum;
+	vec3 &velocity;
+	vec3 &angularVelocity;
+	vec3 &angularMomentum;
 	
-	vec3 force;
-	vec3 torque;
+	vec3 &force;
+	vec3 &torque;
 	
-	mat3 iBodyInertiaTensor;
-	mat3 iWorldInertiaTensor;
+	mat3 &iBodyInertiaTensor;
+	mat3 &iWorldInertiaTensor;
 	
 	int frozen;
-	float frozen_time;
-	int frozen_num_objects;
+	float frozen_time;			// time at rest
+	RigidBody *frozen_next;		// ring of the frozen island
 	
 	int num_joints;
 	Joint *joints[NUM_JOINTS];
@@ -101,6 +192,24 @@ protected:
 	
 	int simulated;
 	int immovable;
+	int order;				// place in the sorted rigidbodies of the last step
+	
+	struct Impulse {
+		Object *object;		// contact object
+		vec3 point;			// contact point in the body space
+		float normal;		// accumulated impulses
+		vec3 friction;
+	};
+	
+	int num_impulses;		// persistent contacts
+	int all_impulses;
+	Impulse *impulses;
+	Impulse *old_impulses;
+	float residual;			// max velocity correction of the last iteration
+	
+	int island_counter;		// island union-find
+	int island;
+	RigidBody *island_parent;
 };
 
 #endif /* __RIGID_BODY_H__ */
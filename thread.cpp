@@ -0,0 +1,288 @@
+/* Threads
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+#include "thread.h"
+
+/*****************************************************************************/
+/*                                                                           */
+/* Mutex                                                                     */
+/*                                                                           */
+/*****************************************************************************/
+
+Mutex::Mutex() {
+#ifdef _WIN32
+	InitializeCriticalSection(&mutex);
+#else
+	pthread_mutex_init(&mutex,NULL);
+#endif
+}
+
+Mutex::~Mutex() {
+#ifdef _WIN32
+	DeleteCriticalSection(&mutex);
+#else
+	pthread_mutex_destroy(&mutex);
+#endif
+}
+
+/*
+ */
+void Mutex::lock() {
+#ifdef _WIN32
+	EnterCriticalSection(&mutex);
+#else
+	pthread_mutex_lock(&mutex);
+#endif
+}
+
+void Mutex::unlock() {
+#ifdef _WIN32
+	LeaveCriticalSection(&mutex);
+#else
+	pthread_mutex_unlock(&mutex);
+#endif
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* Semaphore                                                                 */
+/*                                                                           */
+/*****************************************************************************/
+
+Semaphore::Semaphore(int value) {
+#ifdef _WIN32
+	semaphore = CreateSemaphore(NULL,value,0x7fffffff,NULL);
+#else
+	sem_init(&semaphore,0,value);
+#endif
+}
+
+Semaphore::~Semaphore() {
+#ifdef _WIN32
+	CloseHandle(semaphore);
+#else
+	sem_destroy(&semaphore);
+#endif
+}
+
+/*
+ */
+void Semaphore::post() {
+#ifdef _WIN32
+	ReleaseSemaphore(semaphore,1,NULL);
+#else
+	sem_post(&semaphore);
+#endif
+}
+
+void Semaphore::wait() {
+#ifdef _WIN32
+	WaitForSingleObject(semaphore,INFINITE);
+#else
+	while(sem_wait(&semaphore) != 0);
+#endif
+}
+
+/*****************************************************************************/
+/*                                                                           */
+/* Thread                                                                    */
+/*                                                                           */
+/*****************************************************************************/
+
+int Thread::num_threads = 1;
+#ifdef _WIN32
+HANDLE *Thread::threads = NULL;
+#else
+pthread_t *Thread::threads = NULL;
+#endif
+
+Semaphore *Thread::start = NULL;
+Mutex *Thread::mutex = NULL;
+
+int Thread::exit = 0;
+
+int Thread::num_jobs = 0;
+Thread::Jobs *Thread::jobs[NUM_JOBS];
+
+/*
+ */
+void Thread::init(int num) {
+	if(num < 1) num = 1;
+	if(num > NUM_THREADS) num = NUM_THREADS;
+	if(num == num_threads && (num == 1 || threads)) return;
+	
+	shutdown();
+	
+	num_threads = num;
+	if(num_threads == 1) return;
+	
+	start = new Semaphore();
+	mutex = new Mutex();
+	exit = 0;
+	
+	// the calling thread is the first worker
+#ifdef _WIN32
+	threads = new HANDLE[num_threads - 1];
+	for(int i = 0; i < num_threads - 1; i++) {
+		DWORD id;
+		threads[i] = CreateThread(NULL,0,worker,NULL,0,&id);
+	}
+#else
+	threads = new pthread_t[num_threads - 1];
+	for(int i = 0; i < num_threads - 1; i++) {
+		if(pthread_create(&threads[i],NULL,worker,NULL)) {
+			fprintf(stderr,"Thread::init(): can`t create thread\n");
+			num_threads = i + 1;
+			break;
+		}
+	}
+#endif
+}
+
+void Thread::shutdown() {
+	if(threads) {
+		exit = 1;
+		for(int i = 0; i < num_threads - 1; i++) start->post();
+#ifdef _WIN32
+		for(int i = 0; i < num_threads - 1; i++) {
+			WaitForSingleObject(threads[i],INFINITE);
+			CloseHandle(threads[i]);
+		}
+#else
+		for(int i = 0; i < num_threads - 1; i++) pthread_join(threads[i],NULL);
+#endif
+		delete [] threads;
+		threads = NULL;
+		delete start;
+		delete mutex;
+		start = NULL;
+		mutex = NULL;
+	}
+	num_threads = 1;
+}
+
+/*
+ */
+int Thread::getNumThreads() {
+	return num_threads;
+}
+
+int Thread::getNumCPUs() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	int num = sysconf(_SC_NPROCESSORS_ONLN);
+	return num > 0 ? num : 1;
+#endif
+}
+
+/*
+ */
+void Thread::run(void (*f)(void*,int),void *d,int num) {
+	if(num <= 0) return;
+	if(threads == NULL || num == 1) {
+		for(int i = 0; i < num; i++) f(d,i);
+		return;
+	}
+	Jobs j;
+	j.func = f;
+	j.data = d;
+	j.num_jobs = num;
+	j.current_job = 0;
+	j.done_jobs = 0;
+	mutex->lock();
+	if(num_jobs == NUM_JOBS) {
+		mutex->unlock();
+		for(int i = 0; i < num; i++) f(d,i);
+		return;
+	}
+	jobs[num_jobs++] = &j;
+	mutex->unlock();
+	for(int i = 0; i < num_threads - 1 && i < num - 1; i++) start->post();
+	while(process(&j));
+	j.done.wait();
+	mutex->lock();
+	for(int i = 0; i < num_jobs; i++) {
+		if(jobs[i] != &j) continue;
+		jobs[i] = jobs[--num_jobs];
+		break;
+	}
+	mutex->unlock();
+}
+
+/* one job of the set or of any running set for the NULL,
+ * returns zero when there are no jobs
+ */
+int Thread::process(Jobs *j) {
+	mutex->lock();
+	if(j == NULL) {
+		for(int i = 0; i < num_jobs && j == NULL; i++) {
+			if(jobs[i]->current_job < jobs[i]->num_jobs) j = jobs[i];
+		}
+	}
+	if(j == NULL || j->current_job >= j->num_jobs) {
+		mutex->unlock();
+		return 0;
+	}
+	int job = j->current_job++;
+	mutex->unlock();
+	j->func(j->data,job);
+	mutex->lock();
+	if(++j->done_jobs == j->num_jobs) j->done.post();
+	mutex->unlock();
+	return 1;
+}
+
+/*
+ */
+#ifdef _WIN32
+DWORD WINAPI Thread::worker(void*) {
+#else
+void *Thread::worker(void*) {
+#endif
+	while(1) {
+		start->wait();
+		if(exit) break;
+		while(process(NULL));
+	}
+	return 0;
+}
+
+/*
+ */
+double Thread::getTime() {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timeval tval;
+	gettimeofday(&tval,NULL);
+	return (double)tval.tv_sec + (double)tval.tv_usec / 1000000.0;
+#endif
+}
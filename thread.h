@@ -0,0 +1,133 @@
+/* Threads
+ *
+ * Copyright (C) 2003-2004, Alexander Zaprjagaev <frustum@frustum.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+/*
+ */
+class Mutex {
+public:
+	
+	Mutex();
+	~Mutex();
+	
+	void lock();
+	void unlock();
+
+protected:
+
+#ifdef _WIN32
+	CRITICAL_SECTION mutex;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+/*
+ */
+class Semaphore {
+public:
+	
+	Semaphore(int value = 0);
+	~Semaphore();
+	
+	void post();
+	void wait();
+
+protected:
+
+#ifdef _WIN32
+	HANDLE semaphore;
+#else
+	sem_t semaphore;
+#endif
+};
+
+/* worker pool
+ * run() splits num_jobs between the calling thread and the workers
+ * and returns when all of them are done
+ * the physic thread and the main thread can run their jobs at once,
+ * the workers take the jobs of all running sets
+ */
+class Thread {
+public:
+	
+	enum {
+		NUM_THREADS = 32,
+	};
+	
+	static void init(int num_threads);
+	static void shutdown();
+	
+	static int getNumThreads();
+	static int getNumCPUs();
+	
+	static void run(void (*func)(void*,int),void *data,int num_jobs);
+	
+	// time in seconds
+	static double getTime();
+
+protected:
+
+#ifdef _WIN32
+	static DWORD WINAPI worker(void *data);
+#else
+	static void *worker(void *data);
+#endif
+	
+	struct Jobs {
+		void (*func)(void*,int);
+		void *data;
+		int num_jobs;
+		int current_job;
+		int done_jobs;
+		Semaphore done;			// posted by the thread which has done the last job
+	};
+	
+	enum {
+		NUM_JOBS = 8,
+	};
+	
+	static int process(Jobs *jobs);
+	
+	static int num_threads;
+#ifdef _WIN32
+	static HANDLE *threads;
+#else
+	static pthread_t *threads;
+#endif
+	
+	static Semaphore *start;
+	static Mutex *mutex;
+	
+	static int exit;
+	
+	static int num_jobs;		// running sets
+	static Jobs *jobs[NUM_JOBS];
+};
+
+#endif /* __THREAD_H__ */